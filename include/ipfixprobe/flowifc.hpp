@@ -37,7 +37,9 @@
 #include <config.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/time.h>
+#include <string>
 
 #ifdef WITH_NEMEA
 #include <unirec/unirec.h>
@@ -56,6 +58,42 @@ namespace ipxp {
 int register_extension();
 int get_extension_cnt();
 
+/**
+ * \brief Counters of extension allocations done by a thread.
+ */
+struct ExtensionAllocStats {
+   uint64_t allocated; /**< Extensions allocated from the system. */
+   uint64_t reused; /**< Extensions allocated from freed extensions kept by the thread. */
+};
+
+void *alloc_extension(size_t size);
+void free_extension(void *ptr, size_t size);
+ExtensionAllocStats get_extension_alloc_stats();
+
+class FlowReturnQueue;
+
+/**
+ * \brief Copy a field of an extension to snapshot buffer, helper of RecordExt::save().
+ * \return Buffer position after the field.
+ */
+template<typename T>
+inline uint8_t *save_field(uint8_t *buffer, const T &field)
+{
+   memcpy(buffer, &field, sizeof(field));
+   return buffer + sizeof(field);
+}
+
+/**
+ * \brief Copy a field of an extension from snapshot buffer, helper of RecordExt::load().
+ * \return Buffer position after the field.
+ */
+template<typename T>
+inline const uint8_t *load_field(const uint8_t *buffer, T &field)
+{
+   memcpy(&field, buffer, sizeof(field));
+   return buffer + sizeof(field);
+}
+
 /**
  * \brief Flow record extension base struct.
  */
@@ -71,6 +109,19 @@ struct RecordExt {
    {
    }
 
+   /**
+    * \brief Allocate extension from extensions of the same size freed by the thread.
+    */
+   static void *operator new(size_t size)
+   {
+      return alloc_extension(size);
+   }
+
+   static void operator delete(void *ptr, size_t size)
+   {
+      free_extension(ptr, size);
+   }
+
 #ifdef WITH_NEMEA
    /**
     * \brief Fill unirec record with stored extension data.
@@ -120,6 +171,28 @@ struct RecordExt {
       return "";
    }
 
+   /**
+    * \brief Save state of the extension to flow cache snapshot, so the flow continues after restart.
+    * \param [out] buffer Snapshot buffer.
+    * \param [in] size Snapshot buffer size.
+    * \return Number of bytes written to buffer or -1 if state cannot be saved.
+    */
+   virtual int save(uint8_t *buffer, int size) const
+   {
+      return -1;
+   }
+
+   /**
+    * \brief Restore state of the extension saved by save() of the same plugin.
+    * \param [in] buffer Saved state.
+    * \param [in] size Size of saved state.
+    * \return True when the state was restored.
+    */
+   virtual bool load(const uint8_t *buffer, int size)
+   {
+      return false;
+   }
+
    /**
     * \brief Add extension at the end of linked list.
     * \param [in] ext Extension to add.
@@ -144,12 +217,19 @@ struct RecordExt {
    }
 };
 
+/**
+ * \brief Record with extension headers.
+ *
+ * Extensions are kept in a list in the order of their addition and the first extension of
+ * each registered ID is also kept in a slot indexed by the ID, so lookups do not walk the list.
+ */
 struct Record {
    RecordExt *m_exts; /**< Extension headers. */
+   uint64_t m_ext_mask; /**< Bits of IDs of present extensions, IDs from 64 are not included. */
 
    /**
     * \brief Add new extension header.
-    * \param [in] ext Pointer to the extension header.
+    * \param [in] ext Pointer to the extension header, it may be followed by other extensions.
     */
    void add_extension(RecordExt* ext)
    {
@@ -162,6 +242,9 @@ struct Record {
          }
          ext_ptr->m_next = ext;
       }
+      for (; ext != nullptr; ext = ext->m_next) {
+         add_slot(ext);
+      }
    }
 
    /**
@@ -171,14 +254,11 @@ struct Record {
     */
    RecordExt *get_extension(int id) const
    {
-      RecordExt *ext = m_exts;
-      while (ext != nullptr) {
-         if (ext->m_ext_id == id) {
-            return ext;
-         }
-         ext = ext->m_next;
+      if (static_cast<unsigned>(id) < m_ext_slot_cnt) {
+         return m_ext_slots[id];
       }
-      return nullptr;
+      // Extensions with ID which was not registered have no slot
+      return id < 0 ? find_extension(id) : nullptr;
    }
     /**
      * \brief Remove given extension.
@@ -201,6 +281,12 @@ struct Record {
              }
              ext->m_next = nullptr;
              delete ext;
+             if (static_cast<unsigned>(id) < m_ext_slot_cnt) {
+                m_ext_slots[id] = find_extension(id);
+                if (m_ext_slots[id] == nullptr && id < 64) {
+                   m_ext_mask &= ~(static_cast<uint64_t>(1) << id);
+                }
+             }
              return true;
           }
           prev_ext = ext;
@@ -215,16 +301,53 @@ struct Record {
    void remove_extensions()
    {
       if (m_exts != nullptr) {
-         delete m_exts;
-         m_exts = nullptr;
+         RecordExt *exts = m_exts;
+         release_extensions();
+         delete exts;
       }
    }
 
+   /**
+    * \brief Forget extension headers without deleting them, used when another record took them over.
+    */
+   void release_extensions()
+   {
+      for (RecordExt *ext = m_exts; ext != nullptr; ext = ext->m_next) {
+         if (static_cast<unsigned>(ext->m_ext_id) < m_ext_slot_cnt) {
+            m_ext_slots[ext->m_ext_id] = nullptr;
+         }
+      }
+      m_exts = nullptr;
+      m_ext_mask = 0;
+   }
+
    /**
     * \brief Constructor.
     */
-   Record() : m_exts(nullptr)
+   Record() : m_exts(nullptr), m_ext_mask(0), m_ext_slots(nullptr), m_ext_slot_cnt(0)
+   {
+   }
+
+   /**
+    * \brief Copy the record, extension headers are shared with the other record.
+    */
+   Record(const Record &other) : m_exts(other.m_exts), m_ext_mask(0), m_ext_slots(nullptr), m_ext_slot_cnt(0)
    {
+      for (RecordExt *ext = m_exts; ext != nullptr; ext = ext->m_next) {
+         add_slot(ext);
+      }
+   }
+
+   Record &operator=(const Record &other)
+   {
+      if (this != &other) {
+         release_extensions();
+         m_exts = other.m_exts;
+         for (RecordExt *ext = m_exts; ext != nullptr; ext = ext->m_next) {
+            add_slot(ext);
+         }
+      }
+      return *this;
    }
 
    /**
@@ -233,6 +356,48 @@ struct Record {
    virtual ~Record()
    {
       remove_extensions();
+      delete[] m_ext_slots;
+   }
+
+private:
+   RecordExt **m_ext_slots; /**< First extension of each ID, kept allocated when extensions are removed. */
+   uint32_t m_ext_slot_cnt;
+
+   RecordExt *find_extension(int id) const
+   {
+      RecordExt *ext = m_exts;
+      while (ext != nullptr) {
+         if (ext->m_ext_id == id) {
+            return ext;
+         }
+         ext = ext->m_next;
+      }
+      return nullptr;
+   }
+
+   void add_slot(RecordExt *ext)
+   {
+      int id = ext->m_ext_id;
+      if (id < 0) {
+         return;
+      }
+      if (static_cast<unsigned>(id) >= m_ext_slot_cnt) {
+         // Slots grow up to the highest ID used by the record, rounded up to avoid repeated growth
+         uint32_t cnt = (static_cast<uint32_t>(id) | 7) + 1;
+         RecordExt **slots = new RecordExt *[cnt]();
+         for (uint32_t i = 0; i < m_ext_slot_cnt; i++) {
+            slots[i] = m_ext_slots[i];
+         }
+         delete[] m_ext_slots;
+         m_ext_slots = slots;
+         m_ext_slot_cnt = cnt;
+      }
+      if (m_ext_slots[id] == nullptr) {
+         m_ext_slots[id] = ext;
+      }
+      if (id < 64) {
+         m_ext_mask |= static_cast<uint64_t>(1) << id;
+      }
    }
 };
 
@@ -266,6 +431,12 @@ struct Flow : public Record {
    uint8_t src_mac[6];
    uint8_t dst_mac[6];
    uint8_t end_reason;
+
+   FlowReturnQueue *return_queue; /**< Queue the record is returned to after export, nullptr when the record is not reused. */
+
+   Flow() : return_queue(nullptr)
+   {
+   }
 };
 
 }
@@ -80,6 +80,10 @@ namespace ipxp {
 #define INPUT_INTERFACE(F)            F(0,       10,    4,   &this->dir_bit_field)
 #define OUTPUT_INTERFACE(F)           F(0,       14,    2,   nullptr)
 #define FLOW_END_REASON(F)            F(0,      136,    1,   &flow.end_reason)
+#define SAMPLING_PACKET_INTERVAL(F)   F(0,      305,    4,   nullptr)
+#define SAMPLING_PACKET_SPACE(F)      F(0,      306,    4,   nullptr)
+#define SAMPLING_FLOW_INTERVAL(F)     F(0,      396,    4,   nullptr)
+#define SAMPLING_FLOW_SPACING(F)      F(0,      397,    4,   nullptr)
 
 #define ETHERTYPE(F)                  F(0,      256,    2,   nullptr)
 
@@ -509,6 +513,12 @@ namespace ipxp {
 #define IPFIX_ICMP_TEMPLATE(F) \
    F(L4_ICMP_TYPE_CODE)
 
+#define IPFIX_SAMPLING_TEMPLATE(F) \
+   F(SAMPLING_PACKET_INTERVAL) \
+   F(SAMPLING_PACKET_SPACE) \
+   F(SAMPLING_FLOW_INTERVAL) \
+   F(SAMPLING_FLOW_SPACING)
+
 #define IPFIX_NETTISA_TEMPLATE(F) \
   F(NTS_MEAN) \
   F(NTS_MIN) \
@@ -568,7 +578,8 @@ namespace ipxp {
    IPFIX_FLEXPROBE_ENCR_TEMPLATE(F) \
    IPFIX_SSADETECTOR_TEMPLATE(F) \
    IPFIX_ICMP_TEMPLATE(F) \
-   IPFIX_NETTISA_TEMPLATE(F)
+   IPFIX_NETTISA_TEMPLATE(F) \
+   IPFIX_SAMPLING_TEMPLATE(F)
 
 /**
  * Helper macro, convert FIELD into its name as a C literal.
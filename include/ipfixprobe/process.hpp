@@ -52,6 +52,30 @@ namespace ipxp {
  */
 #define FLOW_FLUSH_WITH_REINSERT    0x3
 
+#define PROCESS_HOOK_PRE_CREATE     0x01
+#define PROCESS_HOOK_POST_CREATE    0x02
+#define PROCESS_HOOK_PRE_UPDATE     0x04
+#define PROCESS_HOOK_POST_UPDATE    0x08
+#define PROCESS_HOOK_PRE_EXPORT     0x10
+#define PROCESS_HOOK_ALL            0x1F
+
+/**
+ * \brief Hooks and packets a processing plugin wants to be called for.
+ * Empty protocol and port lists match any packet, a port matches either the source or the destination port.
+ * When payload is set, packets without payload are skipped. The pre_export hook is matched against the protocol
+ * and ports of the flow only.
+ */
+struct ProcessInterest {
+   uint8_t hooks;                   /**< PROCESS_HOOK_* flags of the implemented hooks. */
+   bool payload;                    /**< Call the packet hooks only for packets with payload. */
+   std::vector<uint8_t> protocols;  /**< IP protocol numbers. */
+   std::vector<uint16_t> ports;     /**< L4 ports. */
+
+   ProcessInterest() : hooks(PROCESS_HOOK_ALL), payload(false)
+   {
+   }
+};
+
 /**
  * \brief Class template for flow cache plugins.
  */
@@ -67,6 +91,16 @@ public:
       return nullptr;
    }
 
+   /**
+    * \brief Get hooks and packets the plugin wants to be called for, called once after init.
+    * Storage plugin skips the plugin for the rest, so the default interest covers every hook and packet.
+    * \return Interest of the plugin.
+    */
+   virtual ProcessInterest get_interest() const
+   {
+      return ProcessInterest();
+   }
+
    /**
     * \brief Called before a new flow record is created.
     * \param [in] pkt Parsed packet.
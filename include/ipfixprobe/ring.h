@@ -88,6 +88,31 @@ ipx_ring_destroy(ipx_ring_t *ring);
 IPX_API void
 ipx_ring_push(ipx_ring_t *ring, ipx_msg_t *msg);
 
+/**
+ * \brief Add messages into the ring buffer
+ *
+ * Same as calling ipx_ring_push() for each message, but the messages are written by blocks
+ * of empty fields and the writer head and synchronization with the reader are updated once
+ * per block instead of once per message. In the multi-writer mode, messages are not
+ * interleaved with messages of other writers.
+ * \note The function blocks until all messages are added.
+ * \param[in] ring Ring buffer
+ * \param[in] msgs Messages to be added into the ring buffer
+ * \param[in] cnt  Number of messages
+ */
+IPX_API void
+ipx_ring_push_bulk(ipx_ring_t *ring, ipx_msg_t **msgs, uint32_t cnt);
+
+/**
+ * \brief Make all added messages visible to the reader
+ *
+ * Messages are normally handed over to the reader in blocks of 1/8 of the ring size or when
+ * the reader waits for them too long.
+ * \param[in] ring Ring buffer
+ */
+IPX_API void
+ipx_ring_flush(ipx_ring_t *ring);
+
 /**
  * \brief Get a message from the ring buffer
  *
@@ -99,6 +124,21 @@ ipx_ring_push(ipx_ring_t *ring, ipx_msg_t *msg);
 IPX_API ipx_msg_t *
 ipx_ring_pop(ipx_ring_t *ring);
 
+/**
+ * \brief Get up to \p max messages from the ring buffer
+ *
+ * Messages ready for the reader are copied at once. As in ipx_ring_pop(), their fields are
+ * released on the next call, so they are counted by ipx_ring_cnt() meanwhile.
+ * \note The function waits for messages at most for a short timeout.
+ * \warning Cannot be used concurrently by multiple threads at the same time.
+ * \param[in]  ring Ring buffer
+ * \param[out] msgs Array for at least \p max messages
+ * \param[in]  max  Maximal number of messages to get
+ * \return Number of messages, 0 after timeout
+ */
+IPX_API uint32_t
+ipx_ring_pop_bulk(ipx_ring_t *ring, ipx_msg_t **msgs, uint32_t max);
+
 /**
  * \brief Change (i.e. disable/enable) multi-writer mode
  *
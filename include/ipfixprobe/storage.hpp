@@ -30,7 +30,11 @@
 #ifndef IPXP_STORAGE_HPP
 #define IPXP_STORAGE_HPP
 
+#include <atomic>
+#include <bitset>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include "plugin.hpp"
 #include "packet.hpp"
@@ -40,6 +44,162 @@
 
 namespace ipxp {
 
+#define STORAGE_PROBE_DEPTHS 8 /**< Number of buckets of the probe depth histogram. */
+#define STORAGE_EXPORT_REASONS (FLOW_END_NO_RES + 1)
+#define STORAGE_PARTITIONS 16 /**< Maximal number of cache partitions. */
+
+/**
+ * \brief Queue of exported records going back to the storage which owns them.
+ *
+ * Records are pushed by the output worker after they are exported and popped by the storage,
+ * which reuses a record only after it is returned. Queue is never full, it has room for all
+ * records of its owner.
+ */
+class FlowReturnQueue
+{
+public:
+   /**
+    * \brief Create queue.
+    * \param [in] size Number of records which can be returned to the queue.
+    */
+   FlowReturnQueue(uint32_t size) : m_mask(1), m_head(0), m_tail(0)
+   {
+      while (m_mask < size) {
+         m_mask <<= 1;
+      }
+      m_records.resize(m_mask);
+      m_mask--;
+   }
+
+   /**
+    * \brief Return record, called only by the output worker.
+    */
+   void push(Flow *flow)
+   {
+      uint32_t head = m_head.load(std::memory_order_relaxed);
+      m_records[head & m_mask] = flow;
+      m_head.store(head + 1, std::memory_order_release);
+   }
+
+   /**
+    * \brief Take returned record, called only by the owner of records.
+    * \return Record or nullptr when no record was returned.
+    */
+   Flow *pop()
+   {
+      if (m_tail == m_head.load(std::memory_order_acquire)) {
+         return nullptr;
+      }
+      return m_records[m_tail++ & m_mask];
+   }
+
+   /**
+    * \brief Wait until a record is returned, used when all records of the owner are exported.
+    */
+   Flow *wait()
+   {
+      Flow *flow;
+      while ((flow = pop()) == nullptr) {
+         std::this_thread::yield();
+      }
+      return flow;
+   }
+
+private:
+   std::vector<Flow *> m_records;
+   uint32_t m_mask;
+   /* Padding keeps the indexes on separate cache lines without over-aligning the queue,
+    * so it can be allocated by plain new. */
+   char m_pad_head[64];
+   std::atomic<uint32_t> m_head; /**< Written by the output worker. */
+   char m_pad_tail[64];
+   uint32_t m_tail;
+   char m_pad_end[64];
+};
+
+/**
+ * \brief Give exported record back to its storage, the record must not be accessed afterwards.
+ */
+inline void return_flow(Flow &flow)
+{
+   if (flow.return_queue != nullptr) {
+      flow.return_queue->push(&flow);
+   }
+}
+
+/**
+ * \brief Counters of a flow cache.
+ */
+struct StorageStats {
+   uint64_t flows; /**< Number of flows in the cache. */
+   uint64_t capacity; /**< Maximal number of flows in the cache. */
+   uint64_t hits; /**< Packets of flows which were already in the cache. */
+   uint64_t created; /**< Number of created flows. */
+   uint64_t flushed; /**< Flows flushed on request of a process plugin. */
+   uint64_t probe_depth[STORAGE_PROBE_DEPTHS]; /**< Hits by position of the flow in the cache, bucket i counts positions [2^i, 2^(i+1)), the last one counts the rest. */
+   uint64_t exported[STORAGE_EXPORT_REASONS]; /**< Exported flows by FLOW_END_* reason, FLOW_END_NO_RES counts evictions. */
+   uint64_t sampled; /**< Packets skipped by sampling. */
+   uint64_t staged; /**< Flows which entered the staging table. */
+   uint64_t promoted; /**< Staged flows moved to the cache by their second packet. */
+   uint64_t partitions; /**< Number of cache partitions, the first one holds flows without own partition. */
+   uint64_t partition_flows[STORAGE_PARTITIONS];
+   uint64_t partition_capacity[STORAGE_PARTITIONS];
+   uint64_t partition_evictions[STORAGE_PARTITIONS];
+   uint64_t sample_rate; /**< Packet sampling rate in effect, 1 out of sample_rate packets is processed. */
+   uint64_t ext_allocated; /**< Flow extensions allocated from the system by the thread of the cache. */
+   uint64_t ext_reused; /**< Flow extensions reused by the thread of the cache. */
+   int64_t cpu; /**< CPU the thread of the cache runs on, -1 when unknown, filled by the worker running the cache. */
+   int64_t node; /**< NUMA node of the CPU, -1 when unknown. */
+   uint64_t cputime; /**< CPU time of the thread of the cache in nanoseconds. */
+};
+
+/**
+ * \brief Processing plugin together with the packets it wants to be called for.
+ */
+struct ProcessDispatch {
+   ProcessPlugin *plugin;
+   uint8_t hooks;
+   bool payload;
+   bool any_protocol;
+   std::bitset<256> protocols;
+   std::vector<uint16_t> ports;
+
+   ProcessDispatch(ProcessPlugin *plugin, const ProcessInterest &interest) :
+      plugin(plugin), hooks(interest.hooks), payload(interest.payload), any_protocol(interest.protocols.empty()), ports(interest.ports)
+   {
+      for (auto proto : interest.protocols) {
+         protocols.set(proto);
+      }
+   }
+
+   /**
+    * \brief Check whether the plugin is interested in given protocol and ports.
+    */
+   bool match(uint8_t proto, uint16_t src_port, uint16_t dst_port) const
+   {
+      if (!any_protocol && !protocols.test(proto)) {
+         return false;
+      }
+      if (ports.empty()) {
+         return true;
+      }
+      for (auto port : ports) {
+         if (port == src_port || port == dst_port) {
+            return true;
+         }
+      }
+      return false;
+   }
+
+   /**
+    * \brief Check whether the plugin is interested in given packet.
+    */
+   bool match(const Packet &pkt) const
+   {
+      return (!payload || pkt.payload_len != 0) && match(pkt.ip_proto, pkt.src_port, pkt.dst_port);
+   }
+};
+
 /**
  * \brief Base class for flow caches.
  */
@@ -51,6 +211,12 @@ protected:
 private:
    ProcessPlugin **m_plugins; /**< Array of plugins. */
    uint32_t m_plugin_cnt;
+   /* Plugins by hook, in the order they were added, each hook calls only plugins interested in the packet. */
+   std::vector<ProcessDispatch> m_pre_create;
+   std::vector<ProcessDispatch> m_post_create;
+   std::vector<ProcessDispatch> m_pre_update;
+   std::vector<ProcessDispatch> m_post_update;
+   std::vector<ProcessDispatch> m_pre_export;
 
 public:
    StoragePlugin() : m_export_queue(nullptr), m_plugins(nullptr), m_plugin_cnt(0)
@@ -71,6 +237,20 @@ public:
     */
    virtual int put_pkt(Packet &pkt) = 0;
 
+   /**
+    * \brief Put block of packets into the cache.
+    * Packets are applied in the order of the block, implementations may prepare lookups of the whole block first.
+    * \param [in] block Input parsed packets.
+    * \return 0 on success.
+    */
+   virtual int put_pkts(PacketBlock &block)
+   {
+      for (size_t i = 0; i < block.cnt; i++) {
+         put_pkt(block.pkts[i]);
+      }
+      return 0;
+   }
+
    /**
     * \brief Set export queue
     */
@@ -87,16 +267,52 @@ public:
       return m_export_queue;
    }
 
+   /**
+    * \brief Called from the thread which will put packets into the cache, before the first packet.
+    */
+   virtual void thread_init()
+   {
+   }
+
    virtual void export_expired(time_t ts)
    {
    }
+
+   /**
+    * \brief Get counters of the cache, called from the thread which puts packets into the cache.
+    */
+   virtual StorageStats get_stats() const
+   {
+      return StorageStats();
+   }
+
+   /**
+    * \brief Request resize of the cache to given number of records, may be called from any thread.
+    * The resize is carried out gradually by the thread which puts packets into the cache.
+    * \param [in] size New number of records.
+    * \return True when the request was accepted.
+    */
+   virtual bool resize(uint32_t size)
+   {
+      return false;
+   }
+
+   /**
+    * \brief Report number of packets dropped by the input so far, called from the thread which puts packets into the cache.
+    */
+   virtual void set_input_drops(uint64_t dropped)
+   {
+   }
+
    virtual void finish()
    {
    }
 
    /**
     * \brief Add plugin to internal list of plugins.
-    * Plugins are always called in the same order, as they were added.
+    * Plugins are always called in the same order, as they were added, and only for hooks and packets
+    * they declared interest in.
+    * \param [in] plugin Initialized plugin.
     */
    void add_plugin(ProcessPlugin *plugin)
    {
@@ -114,27 +330,70 @@ public:
          }
       }
       m_plugins[m_plugin_cnt++] = plugin;
+
+      ProcessInterest interest = plugin->get_interest();
+      if (interest.hooks & PROCESS_HOOK_PRE_CREATE) {
+         m_pre_create.push_back(ProcessDispatch(plugin, interest));
+      }
+      if (interest.hooks & PROCESS_HOOK_POST_CREATE) {
+         m_post_create.push_back(ProcessDispatch(plugin, interest));
+      }
+      if (interest.hooks & PROCESS_HOOK_PRE_UPDATE) {
+         m_pre_update.push_back(ProcessDispatch(plugin, interest));
+      }
+      if (interest.hooks & PROCESS_HOOK_POST_UPDATE) {
+         m_post_update.push_back(ProcessDispatch(plugin, interest));
+      }
+      if (interest.hooks & PROCESS_HOOK_PRE_EXPORT) {
+         m_pre_export.push_back(ProcessDispatch(plugin, interest));
+      }
    }
 
 protected:
+   /**
+    * \brief Check whether any plugin was added, so flow data passed to plugins have to be kept up to date.
+    */
+   bool has_plugins() const
+   {
+      return m_plugin_cnt != 0;
+   }
+
+   /**
+    * \brief Get number of added plugins.
+    */
+   uint32_t get_plugin_cnt() const
+   {
+      return m_plugin_cnt;
+   }
+
+   /**
+    * \brief Get added plugin by its position.
+    */
+   ProcessPlugin *get_plugin(uint32_t idx) const
+   {
+      return m_plugins[idx];
+   }
+
    //Every StoragePlugin implementation should call these functions at appropriate places
 
    /**
-    * \brief Call pre_create function for each added plugin.
+    * \brief Call pre_create function for each interested plugin.
     * \param [in] pkt Input parsed packet.
     * \return Options for flow cache.
     */
    int plugins_pre_create(Packet &pkt)
    {
       int ret = 0;
-      for (unsigned int i = 0; i < m_plugin_cnt; i++) {
-         ret |= m_plugins[i]->pre_create(pkt);
+      for (const auto &it : m_pre_create) {
+         if (it.match(pkt)) {
+            ret |= it.plugin->pre_create(pkt);
+         }
       }
       return ret;
    }
 
    /**
-    * \brief Call post_create function for each added plugin.
+    * \brief Call post_create function for each interested plugin.
     * \param [in,out] rec Stored flow record.
     * \param [in] pkt Input parsed packet.
     * \return Options for flow cache.
@@ -142,14 +401,16 @@ protected:
    int plugins_post_create(Flow &rec, const Packet &pkt)
    {
       int ret = 0;
-      for (unsigned int i = 0; i < m_plugin_cnt; i++) {
-         ret |= m_plugins[i]->post_create(rec, pkt);
+      for (const auto &it : m_post_create) {
+         if (it.match(pkt)) {
+            ret |= it.plugin->post_create(rec, pkt);
+         }
       }
       return ret;
    }
 
    /**
-    * \brief Call pre_update function for each added plugin.
+    * \brief Call pre_update function for each interested plugin.
     * \param [in,out] rec Stored flow record.
     * \param [in] pkt Input parsed packet.
     * \return Options for flow cache.
@@ -157,34 +418,40 @@ protected:
    int plugins_pre_update(Flow &rec, Packet &pkt)
    {
       int ret = 0;
-      for (unsigned int i = 0; i < m_plugin_cnt; i++) {
-         ret |= m_plugins[i]->pre_update(rec, pkt);
+      for (const auto &it : m_pre_update) {
+         if (it.match(pkt)) {
+            ret |= it.plugin->pre_update(rec, pkt);
+         }
       }
       return ret;
    }
 
    /**
-    * \brief Call post_update function for each added plugin.
+    * \brief Call post_update function for each interested plugin.
     * \param [in,out] rec Stored flow record.
     * \param [in] pkt Input parsed packet.
     */
    int plugins_post_update(Flow &rec, const Packet &pkt)
    {
       int ret = 0;
-      for (unsigned int i = 0; i < m_plugin_cnt; i++) {
-         ret |= m_plugins[i]->post_update(rec, pkt);
+      for (const auto &it : m_post_update) {
+         if (it.match(pkt)) {
+            ret |= it.plugin->post_update(rec, pkt);
+         }
       }
       return ret;
    }
 
    /**
-    * \brief Call pre_export function for each added plugin.
+    * \brief Call pre_export function for each interested plugin.
     * \param [in,out] rec Stored flow record.
     */
    void plugins_pre_export(Flow &rec)
    {
-      for (unsigned int i = 0; i < m_plugin_cnt; i++) {
-         m_plugins[i]->pre_export(rec);
+      for (const auto &it : m_pre_export) {
+         if (it.match(rec.ip_proto, rec.src_port, rec.dst_port)) {
+            it.plugin->pre_export(rec);
+         }
       }
    }
 };
@@ -29,6 +29,8 @@
 #include <random>
 #include <chrono>
 #include <cstdint>
+#include <cmath>
+#include <algorithm>
 #include <sys/time.h>
 
 #include "benchmark.hpp"
@@ -71,6 +73,9 @@ void Benchmark::init(const char *params)
    } else if (parser.m_mode == "nf") {
       m_flowMode = BenchmarkMode::FLOW_N;
       m_generatePacketFunc = &Benchmark::generatePacketFlowN;
+   } else if (parser.m_mode == "zipf") {
+      m_flowMode = BenchmarkMode::FLOW_ZIPF;
+      m_generatePacketFunc = &Benchmark::generatePacketFlowZipf;
    } else {
       throw PluginError("invalid benchmark mode specified");
    }
@@ -90,6 +95,9 @@ void Benchmark::init(const char *params)
       std::seed_seq seed (parser.m_seed.begin(),parser.m_seed.end());
       m_rndGen = std::mt19937(seed);
    }
+   if (m_flowMode == BenchmarkMode::FLOW_ZIPF) {
+      generateZipfFlows(parser.m_flows, parser.m_skew);
+   }
    gettimeofday(&m_firstTs, nullptr);
 }
 
@@ -142,11 +150,20 @@ void Benchmark::swapEndpoints(Packet *pkt)
 
 void Benchmark::generatePacket(Packet *pkt)
 {
-   std::uniform_int_distribution<uint32_t> distrib;
-
    pkt->ts = m_currentTs;
    pkt->packet_len = std::uniform_int_distribution<uint16_t>(m_packetSizeFrom, m_packetSizeTo)(m_rndGen);
    pkt->packet_len_wire = pkt->packet_len;
+   generateKey(pkt);
+   generatePayload(pkt);
+}
+
+/**
+ * \brief Generate random addresses, ports and protocol of a packet.
+ */
+void Benchmark::generateKey(Packet *pkt)
+{
+   std::uniform_int_distribution<uint32_t> distrib;
+
    if (distrib(m_rndGen) & 1) {
       pkt->ethertype = 0x0800;
       pkt->ip_version = IP::v4;
@@ -165,10 +182,20 @@ void Benchmark::generatePacket(Packet *pkt)
    pkt->dst_port = distrib(m_rndGen);
    if (distrib(m_rndGen) & 1) {
       pkt->ip_proto = IPPROTO_TCP;
+   } else {
+      pkt->ip_proto = IPPROTO_UDP;
+   }
+}
+
+/**
+ * \brief Generate sizes and payload of a packet with already set protocol.
+ */
+void Benchmark::generatePayload(Packet *pkt)
+{
+   if (pkt->ip_proto == IPPROTO_TCP) {
       pkt->tcp_flags = 0x18; // PSH ACK
       pkt->ip_payload_len = BENCHMARK_L4_SIZE_TCP;
    } else {
-      pkt->ip_proto = IPPROTO_UDP;
       pkt->tcp_flags = 0;
       pkt->ip_payload_len = BENCHMARK_L4_SIZE_UDP;
    }
@@ -186,6 +213,31 @@ void Benchmark::generatePacket(Packet *pkt)
       max(BENCHMARK_L4_SIZE_TCP, BENCHMARK_L4_SIZE_UDP) <= BENCHMARK_MIN_PACKET_SIZE, "minimal packet size is too low");
 }
 
+/**
+ * \brief Generate keys of the zipf mode flows, flow with index i is chosen with probability proportional to 1 / (i + 1)^skew.
+ */
+void Benchmark::generateZipfFlows(uint32_t flows, double skew)
+{
+   Packet pkt;
+   double sum = 0;
+
+   m_zipfFlows.resize(flows);
+   m_zipfCdf.resize(flows);
+   for (uint32_t i = 0; i < flows; i++) {
+      BenchmarkFlow &flow = m_zipfFlows[i];
+      generateKey(&pkt);
+      flow.ip_version = pkt.ip_version;
+      flow.ip_proto = pkt.ip_proto;
+      flow.src_ip = pkt.src_ip;
+      flow.dst_ip = pkt.dst_ip;
+      flow.src_port = pkt.src_port;
+      flow.dst_port = pkt.dst_port;
+
+      sum += 1.0 / std::pow(i + 1, skew);
+      m_zipfCdf[i] = sum;
+   }
+}
+
 void Benchmark::generatePacketFlow1(Packet *pkt)
 {
    int tmp = m_pkt.packet_len - m_pkt.payload_len; // Non payload size
@@ -213,4 +265,25 @@ void Benchmark::generatePacketFlowN(Packet *pkt)
    generatePacket(pkt);
 }
 
+void Benchmark::generatePacketFlowZipf(Packet *pkt)
+{
+   std::uniform_real_distribution<double> distrib(0, m_zipfCdf.back());
+   size_t idx = std::upper_bound(m_zipfCdf.begin(), m_zipfCdf.end(), distrib(m_rndGen)) - m_zipfCdf.begin();
+   const BenchmarkFlow &flow = m_zipfFlows[std::min(idx, m_zipfFlows.size() - 1)];
+
+   pkt->ts = m_currentTs;
+   pkt->ethertype = flow.ip_version == IP::v4 ? 0x0800 : 0x86DD;
+   pkt->ip_version = flow.ip_version;
+   pkt->ip_proto = flow.ip_proto;
+   pkt->src_ip = flow.src_ip;
+   pkt->dst_ip = flow.dst_ip;
+   pkt->src_port = flow.src_port;
+   pkt->dst_port = flow.dst_port;
+   if (m_rndGen() & 1) {
+      swapEndpoints(pkt);
+   }
+   generatePayload(pkt);
+   pkt->packet_len_wire = pkt->packet_len;
+}
+
 }
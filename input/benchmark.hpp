@@ -32,6 +32,7 @@
 #include <chrono>
 #include <string>
 #include <cstdint>
+#include <vector>
 
 #include <ipfixprobe/input.hpp>
 #include <ipfixprobe/packet.hpp>
@@ -54,6 +55,8 @@ namespace ipxp {
 #define BENCHMARK_DEFAULT_PKT_CNT   BENCHMARK_PKT_CNT_INF
 #define BENCHMARK_DEFAULT_SIZE_FROM 512
 #define BENCHMARK_DEFAULT_SIZE_TO   512
+#define BENCHMARK_DEFAULT_ZIPF_FLOWS 1000000
+#define BENCHMARK_DEFAULT_ZIPF_SKEW  1.0
 
 class BenchmarkOptParser : public OptionsParser
 {
@@ -64,11 +67,14 @@ public:
    uint64_t m_pkt_cnt;
    uint16_t m_pkt_size;
    uint64_t m_link;
+   uint32_t m_flows;
+   double m_skew;
 
    BenchmarkOptParser() : OptionsParser("benchmark", "Input plugin for various benchmarking purposes"),
-      m_mode("1f"), m_seed(""), m_duration(0), m_pkt_cnt(0), m_pkt_size(BENCHMARK_DEFAULT_SIZE_FROM), m_link(0)
+      m_mode("1f"), m_seed(""), m_duration(0), m_pkt_cnt(0), m_pkt_size(BENCHMARK_DEFAULT_SIZE_FROM), m_link(0),
+      m_flows(BENCHMARK_DEFAULT_ZIPF_FLOWS), m_skew(BENCHMARK_DEFAULT_ZIPF_SKEW)
    {
-      register_option("m", "mode", "STR", "Benchmark mode 1f (1x N-packet flow) or nf (Nx 1-packet flow)", [this](const char *arg){m_mode = arg; return true;}, OptionFlags::RequiredArgument);
+      register_option("m", "mode", "STR", "Benchmark mode 1f (1x N-packet flow), nf (Nx 1-packet flow) or zipf (packets of F flows with Zipf distributed popularity)", [this](const char *arg){m_mode = arg; return true;}, OptionFlags::RequiredArgument);
       register_option("S", "seed", "STR", "String seed for random generator", [this](const char *arg){m_seed = arg; return true;}, OptionFlags::RequiredArgument);
       register_option("d", "duration", "TIME", "Duration in seconds",
          [this](const char *arg){try {m_duration = str2num<decltype(m_duration)>(arg);} catch(std::invalid_argument &e) {return false;} return true;},
@@ -82,15 +88,34 @@ public:
       register_option("I", "id", "NUM", "Link identifier number",
          [this](const char *arg){try {m_link = str2num<decltype(m_link)>(arg);} catch(std::invalid_argument &e) {return false;} return true;},
          OptionFlags::RequiredArgument);
+      register_option("F", "flows", "NUM", "Number of flows in zipf mode",
+         [this](const char *arg){try {m_flows = str2num<decltype(m_flows)>(arg);} catch(std::invalid_argument &e) {return false;} return m_flows > 0;},
+         OptionFlags::RequiredArgument);
+      register_option("z", "skew", "NUM", "Exponent of the Zipf distribution in zipf mode, higher values concentrate packets to fewer flows",
+         [this](const char *arg){try {m_skew = str2num<decltype(m_skew)>(arg);} catch(std::invalid_argument &e) {return false;} return true;},
+         OptionFlags::RequiredArgument);
    }
 };
 
+/**
+ * \brief Flow key of the zipf mode.
+ */
+struct BenchmarkFlow {
+   uint8_t ip_version;
+   uint8_t ip_proto;
+   ipaddr_t src_ip;
+   ipaddr_t dst_ip;
+   uint16_t src_port;
+   uint16_t dst_port;
+};
+
 class Benchmark : public InputPlugin
 {
 public:
    enum class BenchmarkMode {
       FLOW_1, /* 1x N-packet flow */
-      FLOW_N  /* Nx 1-packet flows */
+      FLOW_N, /* Nx 1-packet flows */
+      FLOW_ZIPF /* Packets of Zipf distributed flows */
    };
    Benchmark();
    ~Benchmark();
@@ -114,12 +139,18 @@ private:
    struct timeval m_firstTs;
    struct timeval m_currentTs;
    uint64_t m_pktCnt;
+   std::vector<BenchmarkFlow> m_zipfFlows;
+   std::vector<double> m_zipfCdf; /**< Cumulative popularity of m_zipfFlows. */
 
    InputPlugin::Result check_constraints() const;
    void swapEndpoints(Packet *pkt);
    void generatePacket(Packet *pkt);
+   void generateKey(Packet *pkt);
+   void generatePayload(Packet *pkt);
+   void generateZipfFlows(uint32_t flows, double skew);
    void generatePacketFlow1(Packet *pkt);
    void generatePacketFlowN(Packet *pkt);
+   void generatePacketFlowZipf(Packet *pkt);
 };
 
 }
@@ -28,6 +28,8 @@
 
 #include <config.h>
 #include <unistd.h>
+#include <algorithm>
+#include <cstring>
 #include <string>
 #include <iostream>
 #include <iomanip>
@@ -38,6 +40,8 @@
 #include <future>
 #include <signal.h>
 #include <poll.h>
+#include <pthread.h>
+#include <sched.h>
 
 #include "ipfixprobe.hpp"
 #ifdef WITH_LIBUNWIND
@@ -54,6 +58,7 @@ volatile sig_atomic_t terminate_input = 0;
 
 const uint32_t DEFAULT_IQUEUE_SIZE = 64;
 const uint32_t DEFAULT_OQUEUE_SIZE = 16536;
+const uint32_t DEFAULT_RSS_BLOCKS = 8;
 const uint32_t DEFAULT_FPS = 0; // unlimited
 
 /**
@@ -152,6 +157,64 @@ void process_plugin_argline(const std::string &args, std::string &plugin, std::s
    trim_str(params);
 }
 
+bool parse_cpus(const std::string &str, std::vector<int> &cpus)
+{
+   cpu_set_t allowed;
+   if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+      return false;
+   }
+
+   std::istringstream list(str);
+   std::string range;
+   while (std::getline(list, range, ',')) {
+      size_t delim = range.find('-');
+      int first;
+      int last;
+      try {
+         first = str2num<int>(range.substr(0, delim));
+         last = delim == std::string::npos ? first : str2num<int>(range.substr(delim + 1));
+      } catch (std::invalid_argument &e) {
+         return false;
+      }
+      if (first < 0 || first > last || last >= CPU_SETSIZE) {
+         return false;
+      }
+      for (int cpu = first; cpu <= last; cpu++) {
+         if (!CPU_ISSET(cpu, &allowed)) {
+            return false;
+         }
+         cpus.push_back(cpu);
+      }
+   }
+   return !cpus.empty();
+}
+
+/**
+ * \brief Run the calling thread on CPUs of a worker thread while the object exists.
+ * Plugins initialized meanwhile allocate and touch their memory on the NUMA node of the worker.
+ */
+class CpuScope
+{
+public:
+   CpuScope(const std::vector<int> &cpus) : m_pinned(false)
+   {
+      if (!cpus.empty() && pthread_getaffinity_np(pthread_self(), sizeof(m_saved), &m_saved) == 0) {
+         m_pinned = pin_thread(cpus);
+      }
+   }
+
+   ~CpuScope()
+   {
+      if (m_pinned) {
+         pthread_setaffinity_np(pthread_self(), sizeof(m_saved), &m_saved);
+      }
+   }
+
+private:
+   cpu_set_t m_saved;
+   bool m_pinned;
+};
+
 bool process_plugin_args(ipxp_conf_t &conf, IpfixprobeOptParser &parser)
 {
    auto deleter = [&](OutputPlugin::Plugins *p) {
@@ -220,6 +283,7 @@ bool process_plugin_args(ipxp_conf_t &conf, IpfixprobeOptParser &parser)
          throw IPXPError("invalid output plugin " + output_name);
       }
 
+      CpuScope scope(conf.output_cpus);
       output_plugin->init(output_params.c_str(), *process_plugins);
       conf.active.output.push_back(output_plugin);
       conf.active.all.push_back(output_plugin);
@@ -237,11 +301,11 @@ bool process_plugin_args(ipxp_conf_t &conf, IpfixprobeOptParser &parser)
 
    {
       std::promise<WorkerResult> *output_res = new std::promise<WorkerResult>();
-      auto output_stats = new std::atomic<OutputStats>();
+      auto output_stats = new SeqlockStats<OutputStats>();
       conf.output_stats.push_back(output_stats);
       OutputWorker tmp = {
               output_plugin,
-              new std::thread(output_worker, output_plugin, output_queue, output_res, output_stats, conf.fps),
+              new std::thread(output_worker, output_plugin, output_queue, output_res, output_stats, conf.fps, conf.output_cpus),
               output_res,
               output_stats,
               output_queue
@@ -254,9 +318,9 @@ bool process_plugin_args(ipxp_conf_t &conf, IpfixprobeOptParser &parser)
    size_t pipeline_idx = 0;
    for (auto &it : parser.m_input) {
       InputPlugin *input_plugin = nullptr;
-      StoragePlugin *storage_plugin = nullptr;
       std::string input_params;
       std::string input_name;
+      const std::vector<int> &cpus = conf.input_cpus[pipeline_idx];
       process_plugin_argline(it, input_name, input_params);
 
       try {
@@ -264,6 +328,7 @@ bool process_plugin_args(ipxp_conf_t &conf, IpfixprobeOptParser &parser)
          if (input_plugin == nullptr) {
             throw IPXPError("invalid input plugin " + input_name);
          }
+         CpuScope scope(thread_cpus(cpus, 0));
          input_plugin->init(input_params.c_str());
          conf.active.input.push_back(input_plugin);
          conf.active.all.push_back(input_plugin);
@@ -277,52 +342,75 @@ bool process_plugin_args(ipxp_conf_t &conf, IpfixprobeOptParser &parser)
          throw IPXPError(input_name + std::string(": ") + e.what());
       }
 
-      try {
-         storage_plugin = dynamic_cast<StoragePlugin *>(conf.mgr.get(storage_name));
-         if (storage_plugin == nullptr) {
-            throw IPXPError("invalid storage plugin " + storage_name);
+      std::vector<WorkPipeline::Storage> storage;
+      for (uint32_t i = 0; i < conf.rss_workers; i++) {
+         StoragePlugin *storage_plugin = nullptr;
+         ipx_ring_t *storage_queue = nullptr;
+         // Storages run in threads of their own when packets are parsed in a separate thread
+         bool pipelined = conf.iqueue_blocks != 0 || conf.rss_workers > 1;
+         CpuScope scope(thread_cpus(cpus, pipelined ? i + 1 : 0));
+         try {
+            storage_plugin = dynamic_cast<StoragePlugin *>(conf.mgr.get(storage_name));
+            if (storage_plugin == nullptr) {
+               throw IPXPError("invalid storage plugin " + storage_name);
+            }
+            if (conf.merge && conf.rss_workers > 1) {
+               // Flows of the storage are merged into the output queue by the input worker
+               storage_queue = ipx_ring_init(conf.oqueue_size, 0);
+               if (storage_queue == nullptr) {
+                  delete storage_plugin;
+                  throw IPXPError("unable to initialize ring buffer");
+               }
+            }
+            storage_plugin->set_queue(storage_queue != nullptr ? storage_queue : output_queue);
+            storage_plugin->init(storage_params.c_str());
+            conf.active.storage.push_back(storage_plugin);
+            conf.active.all.push_back(storage_plugin);
+         } catch (PluginError &e) {
+            delete storage_plugin;
+            if (storage_queue != nullptr) {
+               ipx_ring_destroy(storage_queue);
+            }
+            throw IPXPError(storage_name + std::string(": ") + e.what());
+         } catch (PluginExit &e) {
+            delete storage_plugin;
+            if (storage_queue != nullptr) {
+               ipx_ring_destroy(storage_queue);
+            }
+            return true;
+         } catch (PluginManagerError &e) {
+            throw IPXPError(storage_name + std::string(": ") + e.what());
          }
-         storage_plugin->set_queue(output_queue);
-         storage_plugin->init(storage_params.c_str());
-         conf.active.storage.push_back(storage_plugin);
-         conf.active.all.push_back(storage_plugin);
-      } catch (PluginError &e) {
-         delete storage_plugin;
-         throw IPXPError(storage_name + std::string(": ") + e.what());
-      } catch (PluginExit &e) {
-         delete storage_plugin;
-         return true;
-      } catch (PluginManagerError &e) {
-         throw IPXPError(storage_name + std::string(": ") + e.what());
-      }
 
-      std::vector<ProcessPlugin *> storage_process_plugins;
-      for (auto &it : *process_plugins) {
-         ProcessPlugin *tmp = it.second->copy();
-         storage_plugin->add_plugin(tmp);
-         conf.active.process.push_back(tmp);
-         conf.active.all.push_back(tmp);
-         storage_process_plugins.push_back(tmp);
+         std::vector<ProcessPlugin *> storage_process_plugins;
+         for (auto &it : *process_plugins) {
+            ProcessPlugin *tmp = it.second->copy();
+            storage_plugin->add_plugin(tmp);
+            conf.active.process.push_back(tmp);
+            conf.active.all.push_back(tmp);
+            storage_process_plugins.push_back(tmp);
+         }
+
+         auto storage_stats = new SeqlockStats<StorageStats>();
+         conf.storage_stats.push_back(storage_stats);
+         storage.push_back({storage_plugin, storage_process_plugins, storage_stats, storage_queue});
       }
 
       std::promise<WorkerResult> *input_res = new std::promise<WorkerResult>();
       conf.input_fut.push_back(input_res->get_future());
 
-      auto input_stats = new std::atomic<InputStats>();
+      auto input_stats = new SeqlockStats<InputStats>();
       conf.input_stats.push_back(input_stats);
 
       WorkPipeline tmp = {
          {
             input_plugin,
-            new std::thread(input_storage_worker, input_plugin, storage_plugin, conf.iqueue_size, 
-               conf.max_pkts, input_res, input_stats),
+            new std::thread(input_storage_worker, input_plugin, storage, output_queue, conf.iqueue_size,
+               conf.iqueue_blocks, conf.max_pkts, cpus, conf.idle, input_res, input_stats),
             input_res,
             input_stats
          },
-         {
-            storage_plugin,
-            storage_process_plugins
-         }
+         storage
       };
       conf.pipelines.push_back(tmp);
       pipeline_idx++;
@@ -344,8 +432,10 @@ void finish(ipxp_conf_t &conf)
 
    // Terminate all storages
    for (auto &it : conf.pipelines) {
-      for (auto &itp : it.storage.plugins) {
-         itp->close();
+      for (auto &its : it.storage) {
+         for (auto &itp : its.plugins) {
+            itp->close();
+         }
       }
    }
 
@@ -356,7 +446,9 @@ void finish(ipxp_conf_t &conf)
    }
 
    for (auto &it : conf.pipelines) {
-      it.storage.plugin->close();
+      for (auto &its : it.storage) {
+         its.plugin->close();
+      }
    }
 
    std::cout << "Input stats:" << std::endl <<
@@ -434,6 +526,56 @@ void finish(ipxp_conf_t &conf)
          std::setw(6) << status << std::endl;
    }
 
+   std::cout << std::endl;
+
+   std::cout << "Storage stats:" << std::endl <<
+      std::setw(3) << "#" <<
+      std::setw(13) << "flows" <<
+      std::setw(13) << "capacity" <<
+      std::setw(13) << "hits" <<
+      std::setw(13) << "created" <<
+      std::setw(13) << "flushed" <<
+      std::setw(13) << "evicted" <<
+      std::setw(13) << "sampled" <<
+      std::setw(13) << "staged" <<
+      std::setw(13) << "ext new" <<
+      std::setw(13) << "ext reused" << std::endl;
+
+   for (idx = 0; idx < static_cast<int>(conf.storage_stats.size()); idx++) {
+      StorageStats stats = conf.storage_stats[idx]->load();
+      std::cout <<
+         std::setw(3) << idx << " " <<
+         std::setw(12) << stats.flows << " " <<
+         std::setw(12) << stats.capacity << " " <<
+         std::setw(12) << stats.hits << " " <<
+         std::setw(12) << stats.created << " " <<
+         std::setw(12) << stats.flushed << " " <<
+         std::setw(12) << stats.exported[FLOW_END_NO_RES] << " " <<
+         std::setw(12) << stats.sampled << " " <<
+         std::setw(12) << stats.staged << " " <<
+         std::setw(12) << stats.ext_allocated << " " <<
+         std::setw(12) << stats.ext_reused << std::endl;
+   }
+
+   for (idx = 0; idx < static_cast<int>(conf.storage_stats.size()); idx++) {
+      StorageStats stats = conf.storage_stats[idx]->load();
+      if (stats.partitions <= 1) {
+         continue;
+      }
+      std::cout << std::endl << "Partition stats of storage " << idx << ":" << std::endl <<
+         std::setw(5) << "part" <<
+         std::setw(13) << "flows" <<
+         std::setw(13) << "capacity" <<
+         std::setw(13) << "evicted" << std::endl;
+      for (uint32_t i = 0; i < stats.partitions && i < STORAGE_PARTITIONS; i++) {
+         std::cout <<
+            std::setw(4) << i << " " <<
+            std::setw(12) << stats.partition_flows[i] << " " <<
+            std::setw(12) << stats.partition_capacity[i] << " " <<
+            std::setw(12) << stats.partition_evictions[i] << std::endl;
+      }
+   }
+
    if (!ok) {
       throw IPXPError("one of the plugins exitted unexpectedly");
    }
@@ -441,42 +583,68 @@ void finish(ipxp_conf_t &conf)
 
 void serve_stat_clients(ipxp_conf_t &conf, struct pollfd pfds[2])
 {
-   uint8_t buffer[100000];
+   uint32_t request;
+   std::vector<uint8_t> buffer;
    size_t written = 0;
-   msg_header_t *hdr = (msg_header_t *) buffer;
    int ret = poll(pfds, 2, 0);
    if (ret <= 0) {
       return;
    }
    if (pfds[1].fd > 0 && pfds[1].revents & POLL_IN) {
-      ret = recv_data(pfds[1].fd, sizeof(uint32_t), buffer);
+      ret = recv_data(pfds[1].fd, sizeof(uint32_t), &request);
       if (ret < 0) {
          // Client disconnected
          close(pfds[1].fd);
          pfds[1].fd = -1;
       } else {
-         if (*((uint32_t *) buffer) != MSG_MAGIC) {
+         if (request == MSG_RESIZE_MAGIC) {
+            // Received storage resize request, reply with stats as usual
+            uint32_t exponent;
+            if (recv_data(pfds[1].fd, sizeof(uint32_t), &exponent)) {
+               return;
+            }
+            for (auto &it : conf.pipelines) {
+               for (auto &its : it.storage) {
+                  if (exponent >= 32 || !its.plugin->resize(1U << exponent)) {
+                     std::cerr << "Unable to resize storage to 2^" << exponent << " records" << std::endl;
+                  }
+               }
+            }
+         } else if (request != MSG_MAGIC) {
             return;
          }
-         // Received stats request from client
+         // Received stats request from client, counts are capped to what the header can describe
+         size_t inputs = std::min<size_t>(conf.input_stats.size(), MSG_MAX_ITEMS);
+         size_t outputs = std::min<size_t>(conf.output_stats.size(), MSG_MAX_ITEMS);
+         size_t storages = std::min<size_t>(conf.storage_stats.size(), MSG_MAX_ITEMS);
+         buffer.resize(sizeof(msg_header_t) + msg_data_size(inputs, outputs, storages));
+
          written += sizeof(msg_header_t);
-         for (auto &it : conf.input_stats) {
-            InputStats stats = it->load();
-            *(InputStats *)(buffer + written) = stats;
+         for (size_t i = 0; i < inputs; i++) {
+            InputStats stats = conf.input_stats[i]->load();
+            memcpy(buffer.data() + written, &stats, sizeof(InputStats));
             written += sizeof(InputStats);
          }
-         for (auto &it : conf.output_stats) {
-            OutputStats stats = it->load();
-            *(OutputStats *)(buffer + written) = stats;
+         for (size_t i = 0; i < outputs; i++) {
+            OutputStats stats = conf.output_stats[i]->load();
+            memcpy(buffer.data() + written, &stats, sizeof(OutputStats));
             written += sizeof(OutputStats);
          }
+         for (size_t i = 0; i < storages; i++) {
+            StorageStats stats = conf.storage_stats[i]->load();
+            memcpy(buffer.data() + written, &stats, sizeof(StorageStats));
+            written += sizeof(StorageStats);
+         }
 
+         msg_header_t *hdr = reinterpret_cast<msg_header_t *>(buffer.data());
          hdr->magic = MSG_MAGIC;
          hdr->size = written - sizeof(msg_header_t);
-         hdr->inputs = conf.input_stats.size();
-         hdr->outputs = conf.output_stats.size();
+         hdr->inputs = inputs;
+         hdr->outputs = outputs;
+         hdr->storages = storages;
+         hdr->reserved = 0;
 
-         send_data(pfds[1].fd, written, buffer);
+         send_data(pfds[1].fd, written, buffer.data());
       }
    }
 
@@ -607,6 +775,16 @@ int run(int argc, char *argv[])
       status = EXIT_FAILURE;
       goto EXIT;
    }
+   if (parser.m_cpus.size() > parser.m_input.size()) {
+      error("CPUs are given for more inputs than specified");
+      status = EXIT_FAILURE;
+      goto EXIT;
+   }
+   if (parser.m_rss < 1) {
+      error("number of storage plugins per input must be at least 1");
+      status = EXIT_FAILURE;
+      goto EXIT;
+   }
    if (parser.m_oqueue < 1) {
       error("output queue size must be at least 1 record");
       status = EXIT_FAILURE;
@@ -615,6 +793,28 @@ int run(int argc, char *argv[])
 
    conf.worker_cnt = parser.m_input.size();
    conf.iqueue_size = parser.m_iqueue;
+   conf.iqueue_blocks = parser.m_iblocks;
+   if (parser.m_rss > 1 && parser.m_iblocks == 0) {
+      conf.iqueue_blocks = DEFAULT_RSS_BLOCKS;
+   }
+   conf.rss_workers = parser.m_rss;
+   conf.merge = parser.m_merge;
+   conf.idle = parser.m_idle;
+   for (auto &it : parser.m_cpus) {
+      std::vector<int> cpus;
+      if (!parse_cpus(it, cpus)) {
+         error("invalid or unavailable CPUs " + it);
+         status = EXIT_FAILURE;
+         goto EXIT;
+      }
+      conf.input_cpus.push_back(cpus);
+   }
+   conf.input_cpus.resize(parser.m_input.size());
+   if (!parser.m_output_cpus.empty() && !parse_cpus(parser.m_output_cpus, conf.output_cpus)) {
+      error("invalid or unavailable CPUs " + parser.m_output_cpus);
+      status = EXIT_FAILURE;
+      goto EXIT;
+   }
    conf.oqueue_size = parser.m_oqueue;
    conf.fps = parser.m_fps;
    conf.pkt_bufsize = parser.m_pkt_bufsize;
@@ -52,6 +52,7 @@ namespace ipxp {
 
 extern const uint32_t DEFAULT_IQUEUE_SIZE;
 extern const uint32_t DEFAULT_OQUEUE_SIZE;
+extern const uint32_t DEFAULT_RSS_BLOCKS;
 extern const uint32_t DEFAULT_FPS;
 
 // global termination variable
@@ -66,6 +67,7 @@ void register_handlers();
 void error(std::string msg);
 void print_help(ipxp_conf_t &conf, const std::string &arg);
 void init_packets(ipxp_conf_t &conf);
+bool parse_cpus(const std::string &str, std::vector<int> &cpus);
 bool process_plugin_args(ipxp_conf_t &conf, IpfixprobeOptParser &parser);
 void main_loop(ipxp_conf_t &conf);
 int run(int argc, char *argv[]);
@@ -79,6 +81,12 @@ public:
    std::string m_pid;
    bool m_daemon;
    uint32_t m_iqueue;
+   uint32_t m_iblocks;
+   uint32_t m_rss;
+   bool m_merge;
+   std::vector<std::string> m_cpus;
+   std::string m_output_cpus;
+   IdleMode m_idle;
    uint32_t m_oqueue;
    uint32_t m_fps;
    uint32_t m_pkt_bufsize;
@@ -89,7 +97,8 @@ public:
 
    IpfixprobeOptParser() : OptionsParser("ipfixprobe", "flow exporter supporting various custom IPFIX elements"),
                            m_pid(""), m_daemon(false),
-                           m_iqueue(DEFAULT_IQUEUE_SIZE), m_oqueue(DEFAULT_OQUEUE_SIZE), m_fps(DEFAULT_FPS),
+                           m_iqueue(DEFAULT_IQUEUE_SIZE), m_iblocks(0), m_rss(1), m_merge(false),
+                           m_idle(IdleMode::ADAPTIVE), m_oqueue(DEFAULT_OQUEUE_SIZE), m_fps(DEFAULT_FPS),
                            m_pkt_bufsize(1600), m_max_pkts(0), m_help(false), m_help_str(""), m_version(false)
    {
       m_delim = ' ';
@@ -120,6 +129,47 @@ public:
                                   std::invalid_argument &e) { return false; }
                           return true;
                       }, OptionFlags::RequiredArgument);
+      register_option("-b", "--iblocks", "NUM", "Parse packets in a separate thread, which buffers up to NUM blocks of iqueue packets for the storage plugin",
+                      [this](const char *arg) {
+                          try { m_iblocks = str2num<decltype(m_iblocks)>(arg); } catch (
+                                  std::invalid_argument &e) { return false; }
+                          return true;
+                      }, OptionFlags::RequiredArgument);
+      register_option("-r", "--rss", "NUM", "Distribute packets of each input by flow to NUM storage plugins with own process plugins, each running in a separate thread",
+                      [this](const char *arg) {
+                          try { m_rss = str2num<decltype(m_rss)>(arg); } catch (
+                                  std::invalid_argument &e) { return false; }
+                          return true;
+                      }, OptionFlags::RequiredArgument);
+      register_option("-M", "--merge", "", "Merge flows exported by storage plugins of an input in a deterministic order, e.g. for offline inputs",
+                      [this](const char *arg) {
+                          m_merge = true;
+                          return true;
+                      }, OptionFlags::NoArgument);
+      register_option("-C", "--cpu", "CPUS", "Pin threads of an input to comma separated CPUs or ranges of CPUs, the n-th option applies to the n-th input. The input thread is pinned to the first CPU, storage threads (-b, -r) to the following ones, threads without own CPU run on any of the CPUs",
+                      [this](const char *arg) {
+                          m_cpus.push_back(arg);
+                          return true;
+                      }, OptionFlags::RequiredArgument);
+      register_option("-O", "--ocpu", "CPUS", "Pin the output thread to comma separated CPUs or ranges of CPUs",
+                      [this](const char *arg) {
+                          m_output_cpus = arg;
+                          return true;
+                      }, OptionFlags::RequiredArgument);
+      register_option("-I", "--idle", "MODE", "What input and storage threads do while waiting for packets: spin, yield or adaptive (default), which spins, yields and then sleeps",
+                      [this](const char *arg) {
+                          std::string mode(arg);
+                          if (mode == "spin") {
+                             m_idle = IdleMode::SPIN;
+                          } else if (mode == "yield") {
+                             m_idle = IdleMode::YIELD;
+                          } else if (mode == "adaptive") {
+                             m_idle = IdleMode::ADAPTIVE;
+                          } else {
+                             return false;
+                          }
+                          return true;
+                      }, OptionFlags::RequiredArgument);
       register_option("-Q", "--oqueue", "SIZE", "Size of queue between storage and output plugins",
                       [this](const char *arg) {
                           try { m_oqueue = str2num<decltype(m_oqueue)>(arg); } catch (
@@ -166,10 +216,16 @@ public:
 
 struct ipxp_conf_t {
    uint32_t iqueue_size;
+   uint32_t iqueue_blocks;
+   uint32_t rss_workers;
+   bool merge;
    uint32_t oqueue_size;
    uint32_t worker_cnt;
    uint32_t fps;
    uint32_t max_pkts;
+   std::vector<std::vector<int>> input_cpus; /**< CPUs of threads of each input, empty when not pinned. */
+   std::vector<int> output_cpus;
+   IdleMode idle;
 
    PluginManager mgr;
    struct Plugins {
@@ -183,8 +239,9 @@ struct ipxp_conf_t {
    std::vector<WorkPipeline> pipelines;
    std::vector<OutputWorker> outputs;
 
-   std::vector<std::atomic<InputStats> *> input_stats;
-   std::vector<std::atomic<OutputStats> *> output_stats;
+   std::vector<SeqlockStats<InputStats> *> input_stats;
+   std::vector<SeqlockStats<OutputStats> *> output_stats;
+   std::vector<SeqlockStats<StorageStats> *> storage_stats;
 
    std::vector<std::shared_future<WorkerResult>> input_fut;
    std::vector<std::future<WorkerResult>> output_fut;  
@@ -198,9 +255,9 @@ struct ipxp_conf_t {
    Packet *pkts;
    uint8_t *pkt_data;
 
-   ipxp_conf_t() : iqueue_size(DEFAULT_IQUEUE_SIZE),
+   ipxp_conf_t() : iqueue_size(DEFAULT_IQUEUE_SIZE), iqueue_blocks(0), rss_workers(1), merge(false),
                    oqueue_size(DEFAULT_OQUEUE_SIZE),
-                   worker_cnt(0), fps(0), max_pkts(0),
+                   worker_cnt(0), fps(0), max_pkts(0), idle(IdleMode::ADAPTIVE),
                    pkt_bufsize(1600), blocks_cnt(0), pkts_cnt(0), pkt_data_cnt(0), blocks(nullptr), pkts(nullptr), pkt_data(nullptr)
    {
    }
@@ -218,12 +275,19 @@ struct ipxp_conf_t {
       }
 
       for (auto &it : pipelines) {
-         delete it.storage.plugin;
+         for (auto &its : it.storage) {
+            delete its.plugin;
+            if (its.queue != nullptr) {
+               ipx_ring_destroy(its.queue);
+            }
+         }
       }
 
       for (auto &it : pipelines) {
-         for (auto &itp : it.storage.plugins) {
-            delete itp;
+         for (auto &its : it.storage) {
+            for (auto &itp : its.plugins) {
+               delete itp;
+            }
          }
       }
 
@@ -244,6 +308,9 @@ struct ipxp_conf_t {
       for (auto &it : output_stats) {
          delete it;
       }
+      for (auto &it : storage_stats) {
+         delete it;
+      }
    }
 };
 
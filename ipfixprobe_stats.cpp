@@ -32,6 +32,7 @@
 #include <signal.h>
 #include <iostream>
 #include <iomanip>
+#include <vector>
 
 #include <ipfixprobe/options.hpp>
 #include <ipfixprobe/utils.hpp>
@@ -50,11 +51,12 @@ void signal_handler(int sig)
 class IpfixStatsParser : public OptionsParser {
 public:
    pid_t m_pid;
+   int m_resize;
    bool m_one;
    bool m_help;
 
    IpfixStatsParser() : OptionsParser("ipfixprobe_stats", "Read statistics from running ipfixprobe exporter"),
-                        m_pid(0), m_one(false), m_help(false)
+                        m_pid(0), m_resize(-1), m_one(false), m_help(false)
    {
       m_delim = ' ';
 
@@ -63,6 +65,12 @@ public:
                   std::invalid_argument &e) { return false; }
             return true;
       }, OptionFlags::RequiredArgument);
+      register_option("-r", "--resize", "EXPONENT", "Resize flow cache of each input to 2^EXPONENT records",
+         [this](const char *arg) {
+            try { m_resize = str2num<decltype(m_resize)>(arg); } catch (
+                  std::invalid_argument &e) { return false; }
+            return m_resize >= 4 && m_resize <= 30;
+      }, OptionFlags::RequiredArgument);
       register_option("-1", "--one", "", "Print stats and exit", [this](const char *arg) {
             m_one = true;
             return true;
@@ -79,15 +87,33 @@ static void error(const std::string &msg)
    std::cerr << "Error: " << msg << std::endl;
 }
 
+/**
+ * \brief Format CPU or NUMA node a thread runs on.
+ */
+static std::string placement(int64_t value)
+{
+   return value < 0 ? "-" : std::to_string(value);
+}
+
+/**
+ * \brief Format CPU time of a thread in nanoseconds per processed packet or flow.
+ */
+static std::string cpu_per(uint64_t cputime, uint64_t cnt)
+{
+   return cnt ? std::to_string(cputime / cnt) : "-";
+}
+
 int main(int argc, char *argv[])
 {
    size_t lines_written = 0;
    int fd = -1;
    int status = EXIT_SUCCESS;
-   uint8_t buffer[100000];
-   msg_header_t *hdr = (msg_header_t *) buffer;
+   uint32_t request[2];
+   std::vector<uint8_t> buffer;
+   msg_header_t hdr;
    std::string path;
    IpfixStatsParser parser;
+   std::vector<uint64_t> last_evicted;
 
 
    signal(SIGTERM, signal_handler);
@@ -113,28 +139,37 @@ int main(int argc, char *argv[])
    }
 
    while (!stop) {
-      *(uint32_t *) buffer = MSG_MAGIC;
+      request[0] = MSG_MAGIC;
+      size_t request_size = sizeof(uint32_t);
+      if (parser.m_resize >= 0) {
+         // Resize is requested only once, together with the first stats request
+         request[0] = MSG_RESIZE_MAGIC;
+         request[1] = parser.m_resize;
+         request_size += sizeof(uint32_t);
+         parser.m_resize = -1;
+      }
       // Send stats data request
-      if (send_data(fd, sizeof(uint32_t), buffer)) {
+      if (send_data(fd, request_size, request)) {
          status = EXIT_FAILURE;
          break;
       }
 
       // Receive message header
-      if (recv_data(fd, sizeof(msg_header_t), buffer)) {
+      if (recv_data(fd, sizeof(msg_header_t), &hdr)) {
          status = EXIT_FAILURE;
          break;
       }
 
       // Check if message header is correct
-      if (hdr->magic != MSG_MAGIC) {
+      if (hdr.magic != MSG_MAGIC || hdr.size != msg_data_size(hdr.inputs, hdr.outputs, hdr.storages)) {
          error("received data are invalid");
          status = EXIT_FAILURE;
          break;
       }
 
       // Receive array of various stats from exporter
-      if (recv_data(fd, hdr->size, (buffer + sizeof(msg_header_t)))) {
+      buffer.resize(hdr.size);
+      if (recv_data(fd, hdr.size, buffer.data())) {
          status = EXIT_FAILURE;
          break;
       }
@@ -151,11 +186,14 @@ int main(int argc, char *argv[])
          std::setw(10) << "parsed" <<
          std::setw(16) << "bytes" <<
          std::setw(10) << "dropped" <<
-         std::setw(10) << "qtime" << std::endl;
+         std::setw(10) << "qtime" <<
+         std::setw(10) << "cpu/pkt" <<
+         std::setw(5) << "cpu" <<
+         std::setw(5) << "node" << std::endl;
 
-      uint8_t *data = buffer + sizeof(msg_header_t);
+      uint8_t *data = buffer.data();
       size_t idx = 0;
-      for (size_t i = 0; i < hdr->inputs; i++) {
+      for (size_t i = 0; i < hdr.inputs; i++) {
          InputStats *stats = (InputStats *) data;
          data += sizeof(InputStats);
          std::cout <<
@@ -164,7 +202,10 @@ int main(int argc, char *argv[])
             std::setw(9) << stats->parsed << " " <<
             std::setw(15) << stats->bytes << " " <<
             std::setw(9) << stats->dropped << " " <<
-            std::setw(9) << stats->qtime << " " << std::endl;
+            std::setw(9) << stats->qtime << " " <<
+            std::setw(9) << cpu_per(stats->cputime, stats->parsed) << " " <<
+            std::setw(4) << placement(stats->cpu) << " " <<
+            std::setw(4) << placement(stats->node) << " " << std::endl;
       }
 
       std::cout << "Output stats:" << std::endl <<
@@ -172,10 +213,13 @@ int main(int argc, char *argv[])
          std::setw(10) << "biflows" <<
          std::setw(10) << "packets" <<
          std::setw(16) << "bytes" <<
-         std::setw(10) << "dropped" << std::endl;
+         std::setw(10) << "dropped" <<
+         std::setw(10) << "cpu/flow" <<
+         std::setw(5) << "cpu" <<
+         std::setw(5) << "node" << std::endl;
 
       idx = 0;
-      for (size_t i = 0; i < hdr->outputs; i++) {
+      for (size_t i = 0; i < hdr.outputs; i++) {
          OutputStats *stats = (OutputStats *) data;
          data += sizeof(OutputStats);
          std::cout <<
@@ -183,14 +227,131 @@ int main(int argc, char *argv[])
             std::setw(9) << stats->biflows << " " <<
             std::setw(9) << stats->packets << " " <<
             std::setw(15) << stats->bytes << " " <<
-            std::setw(9) << stats->dropped << " " << std::endl;
+            std::setw(9) << stats->dropped << " " <<
+            std::setw(9) << cpu_per(stats->cputime, stats->biflows) << " " <<
+            std::setw(4) << placement(stats->cpu) << " " <<
+            std::setw(4) << placement(stats->node) << " " << std::endl;
+      }
+
+      std::cout << "Storage stats:" << std::endl <<
+         std::setw(3) << "#" <<
+         std::setw(10) << "flows" <<
+         std::setw(7) << "load" <<
+         std::setw(12) << "hits" <<
+         std::setw(12) << "created" <<
+         std::setw(10) << "flushed" <<
+         std::setw(10) << "evicted" <<
+         std::setw(10) << "evicted/s" <<
+         std::setw(12) << "sampled" <<
+         std::setw(8) << "1-in-N" <<
+         std::setw(12) << "staged" <<
+         std::setw(12) << "promoted" <<
+         std::setw(12) << "ext new" <<
+         std::setw(12) << "ext reused" <<
+         std::setw(10) << "cpu/flow" <<
+         std::setw(5) << "cpu" <<
+         std::setw(5) << "node" << std::endl;
+
+      StorageStats *storage_stats = (StorageStats *) data;
+      last_evicted.resize(hdr.storages);
+      for (size_t i = 0; i < hdr.storages; i++) {
+         StorageStats *stats = &storage_stats[i];
+         uint64_t evicted = stats->exported[FLOW_END_NO_RES];
+         double load = stats->capacity ? 100.0 * stats->flows / stats->capacity : 0;
+         std::cout <<
+            std::setw(3) << i << " " <<
+            std::setw(9) << stats->flows << " " <<
+            std::setw(5) << std::fixed << std::setprecision(1) << load << "% " <<
+            std::setw(11) << stats->hits << " " <<
+            std::setw(11) << stats->created << " " <<
+            std::setw(9) << stats->flushed << " " <<
+            std::setw(9) << evicted << " " <<
+            std::setw(9) << (lines_written ? evicted - last_evicted[i] : 0) << " " <<
+            std::setw(11) << stats->sampled << " " <<
+            std::setw(7) << stats->sample_rate << " " <<
+            std::setw(11) << stats->staged << " " <<
+            std::setw(11) << stats->promoted << " " <<
+            std::setw(11) << stats->ext_allocated << " " <<
+            std::setw(11) << stats->ext_reused << " " <<
+            std::setw(9) << cpu_per(stats->cputime, stats->created) << " " <<
+            std::setw(4) << placement(stats->cpu) << " " <<
+            std::setw(4) << placement(stats->node) << " " << std::endl;
+         last_evicted[i] = evicted;
+      }
+
+      std::cout << "Export reasons:" << std::endl <<
+         std::setw(3) << "#" <<
+         std::setw(12) << "inactive" <<
+         std::setw(12) << "active" <<
+         std::setw(12) << "eof" <<
+         std::setw(12) << "forced" <<
+         std::setw(12) << "no res" << std::endl;
+
+      for (size_t i = 0; i < hdr.storages; i++) {
+         StorageStats *stats = &storage_stats[i];
+         std::cout <<
+            std::setw(3) << i << " " <<
+            std::setw(11) << stats->exported[FLOW_END_INACTIVE] << " " <<
+            std::setw(11) << stats->exported[FLOW_END_ACTIVE] << " " <<
+            std::setw(11) << stats->exported[FLOW_END_EOF] << " " <<
+            std::setw(11) << stats->exported[FLOW_END_FORCED] << " " <<
+            std::setw(11) << stats->exported[FLOW_END_NO_RES] << " " << std::endl;
+      }
+
+      // Hits by position of the flow in its cache line
+      std::cout << "Probe depth:" << std::endl << std::setw(3) << "#";
+      for (size_t j = 0; j < STORAGE_PROBE_DEPTHS; j++) {
+         std::string label = std::to_string(1 << j);
+         if (j + 1 == STORAGE_PROBE_DEPTHS) {
+            label += "+";
+         } else if (j > 0) {
+            label += "-" + std::to_string((2 << j) - 1);
+         }
+         std::cout << std::setw(10) << label;
+      }
+      std::cout << std::endl;
+
+      for (size_t i = 0; i < hdr.storages; i++) {
+         std::cout << std::setw(3) << i << " ";
+         for (size_t j = 0; j < STORAGE_PROBE_DEPTHS; j++) {
+            std::cout << std::setw(9) << storage_stats[i].probe_depth[j] << " ";
+         }
+         std::cout << std::endl;
+      }
+
+      // Partitions are printed only by caches partitioned by VLAN
+      size_t partition_lines = 0;
+      for (size_t i = 0; i < hdr.storages; i++) {
+         StorageStats *stats = &storage_stats[i];
+         if (stats->partitions <= 1) {
+            continue;
+         }
+         if (!partition_lines) {
+            std::cout << "Partitions:" << std::endl <<
+               std::setw(3) << "#" <<
+               std::setw(5) << "part" <<
+               std::setw(12) << "flows" <<
+               std::setw(7) << "load" <<
+               std::setw(12) << "evicted" << std::endl;
+            partition_lines = 2;
+         }
+         for (size_t j = 0; j < stats->partitions && j < STORAGE_PARTITIONS; j++) {
+            double load = stats->partition_capacity[j] ? 100.0 * stats->partition_flows[j] / stats->partition_capacity[j] : 0;
+            std::cout <<
+               std::setw(3) << i << " " <<
+               std::setw(4) << j << " " <<
+               std::setw(11) << stats->partition_flows[j] << " " <<
+               std::setw(5) << std::fixed << std::setprecision(1) << load << "% " <<
+               std::setw(11) << stats->partition_evictions[j] << " " << std::endl;
+            partition_lines++;
+         }
       }
 
       if (parser.m_one) {
          break;
       }
 
-      lines_written = hdr->inputs + hdr->outputs + 4;
+      lines_written = hdr.inputs + hdr.outputs + 3 * hdr.storages + 10 + partition_lines;
       usleep(1000000);
    }
 EXIT:
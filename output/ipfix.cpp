@@ -132,7 +132,7 @@ const char *basic_tmplt_v6[] = {
 };
 
 IPFIXExporter::IPFIXExporter() :
-   extensions(nullptr), extension_cnt(0),
+   extension_cnt(0),
    templates(nullptr), templatesDataSize(0),
    basic_ifc_num(-1), verbose(false),
    sequenceNum(0), exportedPackets(0),
@@ -203,10 +203,6 @@ void IPFIXExporter::init(const char *params, Plugins &plugins)
    if (extension_cnt > 64) {
       throw PluginError("output plugin operates only with up to 64 running plugins");
    }
-   extensions = new RecordExt*[extension_cnt];
-   for (int i = 0; i < extension_cnt; i++) {
-      extensions[i] = nullptr;
-   }
    for (auto &it : plugins) {
       std::string name = it.first;
       ProcessPlugin *plugin = it.second;
@@ -249,22 +245,11 @@ void IPFIXExporter::close()
       free(packetDataBuffer);
       packetDataBuffer = nullptr;
    }
-   if (extensions != nullptr) {
-      delete [] extensions;
-      extensions = nullptr;
-   }
 }
 
 uint64_t IPFIXExporter::get_template_id(const Record &flow)
 {
-   RecordExt *ext = flow.m_exts;
-   uint64_t tmpltIdx = 0;
-   while (ext != nullptr) {
-      tmpltIdx |= ((uint64_t) 1 << ext->m_ext_id);
-      ext = ext->m_next;
-   }
-
-   return tmpltIdx;
+   return flow.m_ext_mask;
 }
 
 template_t *IPFIXExporter::get_template(const Flow &flow)
@@ -275,20 +260,15 @@ template_t *IPFIXExporter::get_template(const Flow &flow)
    if (tmpltMap[ipTmpltIdx].find(tmpltIdx) == tmpltMap[ipTmpltIdx].end()) {
       std::vector<const char *> all_fields;
 
-      RecordExt *ext = flow.m_exts;
-      while (ext != nullptr) {
+      // IDs outside of the mask (negative or >= 64) are rejected, they would be missing in the template
+      for (RecordExt *ext = flow.m_exts; ext != nullptr; ext = ext->m_next) {
          if (ext->m_ext_id < 0 || ext->m_ext_id >= extension_cnt) {
             throw PluginError("encountered invalid extension id");
          }
-         extensions[ext->m_ext_id] = ext;
-         ext = ext->m_next;
       }
-      for (int i = 0; i < extension_cnt; i++) {
-         if (extensions[i] == nullptr) {
-            continue;
-         }
-         const char **fields = extensions[i]->get_ipfix_tmplt();
-         extensions[i] = nullptr;
+      for (uint64_t mask = tmpltIdx; mask != 0; mask &= mask - 1) {
+         int i = __builtin_ctzll(mask);
+         const char **fields = flow.get_extension(i)->get_ipfix_tmplt();
          if (fields == nullptr) {
             throw PluginError("missing template fields for extension with ID " + std::to_string(i));
          }
@@ -306,26 +286,14 @@ template_t *IPFIXExporter::get_template(const Flow &flow)
    return tmpltMap[ipTmpltIdx][tmpltIdx];
 }
 
-int IPFIXExporter::fill_extensions(RecordExt *ext, uint8_t *buffer, int size)
+int IPFIXExporter::fill_extensions(const Record &flow, uint8_t *buffer, int size)
 {
    int length = 0;
-   int extCnt = 0;
-   while (ext != nullptr) {
-      extensions[ext->m_ext_id] = ext;
-      extCnt++;
-      ext = ext->m_next;
-   }
    // TODO: export multiple extension header of same type
-   for (int i = 0; i < extension_cnt; i++) {
-      if (extensions[i] == nullptr) {
-         continue;
-      }
-      int length_ext = extensions[i]->fill_ipfix(buffer + length, size - length);
-      extensions[i] = nullptr;
+   // Only IDs of present extensions are visited, in the order of IDs as in the template
+   for (uint64_t mask = get_template_id(flow); mask != 0; mask &= mask - 1) {
+      int length_ext = flow.get_extension(__builtin_ctzll(mask))->fill_ipfix(buffer + length, size - length);
       if (length_ext < 0) {
-         for (int j = i; j < extension_cnt; j++) {
-            extensions[j] = nullptr;
-         }
          return -1;
       }
       length += length_ext;
@@ -349,7 +317,7 @@ bool IPFIXExporter::fill_template(const Flow &flow, template_t *tmplt)
          return false;
       }
 
-      int ext_written = fill_extensions(ext, tmplt->buffer + tmplt->bufferSize + length, tmpltMaxBufferSize - tmplt->bufferSize - length);
+      int ext_written = fill_extensions(flow, tmplt->buffer + tmplt->bufferSize + length, tmpltMaxBufferSize - tmplt->bufferSize - length);
       if (ext_written < 0) {
          return false;
       }
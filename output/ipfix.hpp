@@ -236,6 +236,10 @@ public:
    std::string get_name() const { return "ipfix"; }
    int export_flow(const Flow &flow);
 
+protected:
+   int fill_extensions(const Record &flow, uint8_t *buffer, int size);
+   uint64_t get_template_id(const Record &flow);
+
 private:
    /* Templates */
    enum TmpltMapIdx {
@@ -243,7 +247,6 @@ private:
       TMPLT_IDX_V6 = 1,
       TMPLT_MAP_IDX_CNT
    };
-   RecordExt **extensions;
    int extension_cnt;
    std::map<uint64_t, template_t *> tmpltMap[TMPLT_MAP_IDX_CNT];
    template_t *templates; /**< Templates in use by plugin */
@@ -289,9 +292,6 @@ private:
    int connect_to_collector();
    int reconnect();
    int fill_basic_flow(const Flow &flow, template_t *tmplt);
-   int fill_extensions(RecordExt *ext, uint8_t *buffer, int size);
-
-   uint64_t get_template_id(const Record &flow);
    template_t *get_template(const Flow &flow);
    bool fill_template(const Flow &flow, template_t *tmplt);
    void flush();
@@ -27,6 +27,9 @@
  */
 
 #include <dlfcn.h>
+#include <new>
+
+#include <ipfixprobe/flowifc.hpp>
 
 #include "pluginmgr.hpp"
 
@@ -54,6 +57,82 @@ int get_extension_cnt()
    return ipxp_ext_cnt;
 }
 
+static const size_t EXT_POOL_GRANULARITY = 16; /**< Extension sizes are rounded up to a multiple of this. */
+static const size_t EXT_POOL_CLASSES = 256; /**< Extensions bigger than the last size class are not kept. */
+static const uint32_t EXT_POOL_MAX_FREE = 4096; /**< Maximal number of freed extensions of a size class kept by a thread. */
+
+/**
+ * \brief Freed extensions of a thread, sorted by their size. Flows are created and erased by the
+ * same storage thread, so an extension of each plugin is usually reused for the next flow.
+ */
+struct ExtensionPool {
+   struct FreeExt {
+      FreeExt *m_next;
+   };
+
+   FreeExt *m_free[EXT_POOL_CLASSES];
+   uint32_t m_count[EXT_POOL_CLASSES];
+   ExtensionAllocStats m_stats;
+   bool m_closed; /**< Thread is exiting, freed extensions are not kept anymore. */
+
+   ExtensionPool() : m_free(), m_count(), m_stats(), m_closed(false)
+   {
+   }
+
+   ~ExtensionPool()
+   {
+      m_closed = true;
+      for (size_t i = 0; i < EXT_POOL_CLASSES; i++) {
+         while (m_free[i] != nullptr) {
+            FreeExt *ext = m_free[i];
+            m_free[i] = ext->m_next;
+            ::operator delete(ext);
+         }
+      }
+   }
+};
+
+static thread_local ExtensionPool ext_pool;
+
+void *alloc_extension(size_t size)
+{
+   size_t idx = (size - 1) / EXT_POOL_GRANULARITY;
+   if (idx < EXT_POOL_CLASSES && ext_pool.m_free[idx] != nullptr) {
+      ExtensionPool::FreeExt *ext = ext_pool.m_free[idx];
+      ext_pool.m_free[idx] = ext->m_next;
+      ext_pool.m_count[idx]--;
+      ext_pool.m_stats.reused++;
+      return ext;
+   }
+   ext_pool.m_stats.allocated++;
+   if (idx < EXT_POOL_CLASSES) {
+      // Whole size class is allocated, so the memory can be reused by any extension of the class
+      return ::operator new((idx + 1) * EXT_POOL_GRANULARITY);
+   }
+   return ::operator new(size);
+}
+
+void free_extension(void *ptr, size_t size)
+{
+   size_t idx = (size - 1) / EXT_POOL_GRANULARITY;
+   if (idx >= EXT_POOL_CLASSES || ext_pool.m_closed || ext_pool.m_count[idx] >= EXT_POOL_MAX_FREE) {
+      ::operator delete(ptr);
+      return;
+   }
+   ExtensionPool::FreeExt *ext = static_cast<ExtensionPool::FreeExt *>(ptr);
+   ext->m_next = ext_pool.m_free[idx];
+   ext_pool.m_free[idx] = ext;
+   ext_pool.m_count[idx]++;
+}
+
+/**
+ * \brief Get counters of extension allocations done by the calling thread.
+ */
+ExtensionAllocStats get_extension_alloc_stats()
+{
+   return ext_pool.m_stats;
+}
+
 PluginManager::PluginManager() : m_last_rec(nullptr)
 {
    register_loaded_plugins();
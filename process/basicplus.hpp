@@ -115,6 +115,42 @@ struct RecordExtBASICPLUS : public RecordExt {
    }
    #endif // ifdef WITH_NEMEA
 
+   virtual int save(uint8_t *buffer, int size) const
+   {
+      const int LEN = sizeof(ip_ttl) + sizeof(ip_flg) + sizeof(tcp_win) + sizeof(tcp_opt) + sizeof(tcp_mss) +
+         sizeof(tcp_syn_size) + sizeof(dst_filled);
+
+      if (size < LEN) {
+         return -1;
+      }
+      buffer = save_field(buffer, ip_ttl);
+      buffer = save_field(buffer, ip_flg);
+      buffer = save_field(buffer, tcp_win);
+      buffer = save_field(buffer, tcp_opt);
+      buffer = save_field(buffer, tcp_mss);
+      buffer = save_field(buffer, tcp_syn_size);
+      buffer = save_field(buffer, dst_filled);
+      return LEN;
+   }
+
+   virtual bool load(const uint8_t *buffer, int size)
+   {
+      const int LEN = sizeof(ip_ttl) + sizeof(ip_flg) + sizeof(tcp_win) + sizeof(tcp_opt) + sizeof(tcp_mss) +
+         sizeof(tcp_syn_size) + sizeof(dst_filled);
+
+      if (size != LEN) {
+         return false;
+      }
+      buffer = load_field(buffer, ip_ttl);
+      buffer = load_field(buffer, ip_flg);
+      buffer = load_field(buffer, tcp_win);
+      buffer = load_field(buffer, tcp_opt);
+      buffer = load_field(buffer, tcp_mss);
+      buffer = load_field(buffer, tcp_syn_size);
+      buffer = load_field(buffer, dst_filled);
+      return true;
+   }
+
    virtual int fill_ipfix(uint8_t *buffer, int size)
    {
       if (size < 34) {
@@ -212,6 +212,7 @@ print_todo() {
    echo "Optional work:"
    echo "1) Add pcap traffic sample for ${PLUGIN} plugin to pcaps directory"
    echo "2) Add test for ${PLUGIN} to tests directory"
+   echo "3) Implement get_interest function to declare used functions, protocols and ports, so the plugin is not called for other packets"
    echo
    echo "NOTE: If you didn't modify pre_create, post_create, pre_update, post_update, pre_export functions, please remove them from ${PLUGIN}.cpp and ${PLUGIN}.hpp"
 }
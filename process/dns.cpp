@@ -100,6 +100,14 @@ ProcessPlugin *DNSPlugin::copy()
    return new DNSPlugin(*this);
 }
 
+ProcessInterest DNSPlugin::get_interest() const
+{
+   ProcessInterest interest;
+   interest.hooks = PROCESS_HOOK_POST_CREATE | PROCESS_HOOK_POST_UPDATE;
+   interest.ports = {53};
+   return interest;
+}
+
 int DNSPlugin::post_create(Flow &rec, const Packet &pkt)
 {
    if (pkt.dst_port == 53 || pkt.src_port == 53) {
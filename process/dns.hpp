@@ -187,6 +187,7 @@ public:
    std::string get_name() const { return "dns"; }
    RecordExt *get_ext() const { return new RecordExtDNS(); }
    ProcessPlugin *copy();
+   ProcessInterest get_interest() const;
 
    int post_create(Flow &rec, const Packet &pkt);
    int post_update(Flow &rec, const Packet &pkt);
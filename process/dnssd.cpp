@@ -113,6 +113,14 @@ ProcessPlugin *DNSSDPlugin::copy()
    return new DNSSDPlugin(*this);
 }
 
+ProcessInterest DNSSDPlugin::get_interest() const
+{
+   ProcessInterest interest;
+   interest.hooks = PROCESS_HOOK_POST_CREATE | PROCESS_HOOK_POST_UPDATE;
+   interest.ports = {5353};
+   return interest;
+}
+
 int DNSSDPlugin::post_create(Flow &rec, const Packet &pkt)
 {
    if (pkt.dst_port == 5353 || pkt.src_port == 5353) {
@@ -258,6 +258,7 @@ public:
    std::string get_name() const { return "dnssd"; }
    RecordExt *get_ext() const { return new RecordExtDNSSD(); }
    ProcessPlugin *copy();
+   ProcessInterest get_interest() const;
 
    int post_create(Flow &rec, const Packet &pkt);
    int post_update(Flow &rec, const Packet &pkt);
@@ -63,6 +63,14 @@ ProcessPlugin *ICMPPlugin::copy()
    return new ICMPPlugin(*this);
 }
 
+ProcessInterest ICMPPlugin::get_interest() const
+{
+   ProcessInterest interest;
+   interest.hooks = PROCESS_HOOK_POST_CREATE;
+   interest.protocols = {IPPROTO_ICMP, IPPROTO_ICMPV6};
+   return interest;
+}
+
 int ICMPPlugin::post_create(Flow &rec, const Packet &pkt)
 {
    if (pkt.ip_proto == IPPROTO_ICMP ||
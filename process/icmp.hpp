@@ -92,6 +92,28 @@ struct RecordExtICMP : public RecordExt {
    }
 #endif
 
+   virtual int save(uint8_t *buffer, int size) const
+   {
+      const int LEN = sizeof(type_code);
+
+      if (size < LEN) {
+         return -1;
+      }
+      buffer = save_field(buffer, type_code);
+      return LEN;
+   }
+
+   virtual bool load(const uint8_t *buffer, int size)
+   {
+      const int LEN = sizeof(type_code);
+
+      if (size != LEN) {
+         return false;
+      }
+      buffer = load_field(buffer, type_code);
+      return true;
+   }
+
    virtual int fill_ipfix(uint8_t *buffer, int size)
    {
       const int LEN = 2;
@@ -137,6 +159,7 @@ public:
    std::string get_name() const { return "icmp"; }
    RecordExt *get_ext() const { return new RecordExtICMP(); }
    ProcessPlugin *copy();
+   ProcessInterest get_interest() const;
 
    int post_create(Flow &rec, const Packet &pkt);
 };
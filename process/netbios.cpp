@@ -67,6 +67,14 @@ ProcessPlugin *NETBIOSPlugin::copy()
    return new NETBIOSPlugin(*this);
 }
 
+ProcessInterest NETBIOSPlugin::get_interest() const
+{
+   ProcessInterest interest;
+   interest.hooks = PROCESS_HOOK_POST_CREATE | PROCESS_HOOK_POST_UPDATE;
+   interest.ports = {137};
+   return interest;
+}
+
 int NETBIOSPlugin::post_create(Flow &rec, const Packet &pkt) {
     if (pkt.dst_port == 137 || pkt.src_port == 137) {
         return add_netbios_ext(rec, pkt);
@@ -124,6 +124,7 @@ public:
     std::string get_name() const { return "netbios"; }
     RecordExt *get_ext() const { return new RecordExtNETBIOS(); }
     ProcessPlugin *copy();
+    ProcessInterest get_interest() const;
 
     int post_create(Flow &rec, const Packet &pkt);
     int post_update(Flow &rec, const Packet &pkt);
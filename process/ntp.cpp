@@ -79,6 +79,14 @@ ProcessPlugin *NTPPlugin::copy()
    return new NTPPlugin(*this);
 }
 
+ProcessInterest NTPPlugin::get_interest() const
+{
+   ProcessInterest interest;
+   interest.hooks = PROCESS_HOOK_POST_CREATE;
+   interest.ports = {123};
+   return interest;
+}
+
 /**
  *\brief Called after a new flow record is created.
  *\param [in,out] rec Reference to flow record.
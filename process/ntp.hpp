@@ -244,6 +244,7 @@ public:
    std::string get_name() const { return "ntp"; }
    RecordExt *get_ext() const { return new RecordExtNTP(); }
    ProcessPlugin *copy();
+   ProcessInterest get_interest() const;
 
    int post_create(Flow &rec, const Packet &pkt);
    void finish(bool print_stats);
@@ -107,6 +107,14 @@ ProcessPlugin *PassiveDNSPlugin::copy()
    return new PassiveDNSPlugin(*this);
 }
 
+ProcessInterest PassiveDNSPlugin::get_interest() const
+{
+   ProcessInterest interest;
+   interest.hooks = PROCESS_HOOK_POST_CREATE | PROCESS_HOOK_POST_UPDATE;
+   interest.ports = {53};
+   return interest;
+}
+
 int PassiveDNSPlugin::post_create(Flow &rec, const Packet &pkt)
 {
    if (pkt.src_port == 53) {
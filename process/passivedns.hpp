@@ -168,6 +168,7 @@ public:
    std::string get_name() const { return "passivedns"; }
    RecordExt *get_ext() const { return new RecordExtPassiveDNS(); }
    ProcessPlugin *copy();
+   ProcessInterest get_interest() const;
    int post_create(Flow &rec, const Packet &pkt);
    int post_update(Flow &rec, const Packet &pkt);
    void finish(bool print_stats);
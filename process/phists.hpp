@@ -119,6 +119,32 @@ struct RecordExtPHISTS : public RecordExt {
    }
    #endif // ifdef WITH_NEMEA
 
+   virtual int save(uint8_t *buffer, int size) const
+   {
+      const int LEN = sizeof(size_hist) + sizeof(ipt_hist) + sizeof(last_ts);
+
+      if (size < LEN) {
+         return -1;
+      }
+      buffer = save_field(buffer, size_hist);
+      buffer = save_field(buffer, ipt_hist);
+      buffer = save_field(buffer, last_ts);
+      return LEN;
+   }
+
+   virtual bool load(const uint8_t *buffer, int size)
+   {
+      const int LEN = sizeof(size_hist) + sizeof(ipt_hist) + sizeof(last_ts);
+
+      if (size != LEN) {
+         return false;
+      }
+      buffer = load_field(buffer, size_hist);
+      buffer = load_field(buffer, ipt_hist);
+      buffer = load_field(buffer, last_ts);
+      return true;
+   }
+
    virtual int fill_ipfix(uint8_t *buffer, int size)
    {
       int32_t bufferPtr;
@@ -195,13 +221,13 @@ public:
 
    int post_create(Flow &rec, const Packet &pkt);
    int post_update(Flow &rec, const Packet &pkt);
+   void pre_export(Flow &rec);
 
 private:
    bool use_zeros;
 
    void update_record(RecordExtPHISTS *phists_data, const Packet &pkt);
    void update_hist(RecordExtPHISTS *phists_data, uint32_t value, uint32_t *histogram);
-   void pre_export(Flow &rec);
    uint64_t calculate_ipt(RecordExtPHISTS *phists_data, const struct timeval tv, uint8_t direction);
 
    static const uint32_t log2_lookup32[32];
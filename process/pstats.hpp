@@ -133,6 +133,46 @@ struct RecordExtPSTATS : public RecordExt {
    }
    #endif // ifdef WITH_NEMEA
 
+   virtual int save(uint8_t *buffer, int size) const
+   {
+      const int LEN = sizeof(pkt_sizes) + sizeof(pkt_tcp_flgs) + sizeof(pkt_timestamps) + sizeof(pkt_dirs) +
+         sizeof(pkt_count) + sizeof(tcp_seq) + sizeof(tcp_ack) + sizeof(tcp_len) + sizeof(tcp_flg);
+
+      if (size < LEN) {
+         return -1;
+      }
+      buffer = save_field(buffer, pkt_sizes);
+      buffer = save_field(buffer, pkt_tcp_flgs);
+      buffer = save_field(buffer, pkt_timestamps);
+      buffer = save_field(buffer, pkt_dirs);
+      buffer = save_field(buffer, pkt_count);
+      buffer = save_field(buffer, tcp_seq);
+      buffer = save_field(buffer, tcp_ack);
+      buffer = save_field(buffer, tcp_len);
+      buffer = save_field(buffer, tcp_flg);
+      return LEN;
+   }
+
+   virtual bool load(const uint8_t *buffer, int size)
+   {
+      const int LEN = sizeof(pkt_sizes) + sizeof(pkt_tcp_flgs) + sizeof(pkt_timestamps) + sizeof(pkt_dirs) +
+         sizeof(pkt_count) + sizeof(tcp_seq) + sizeof(tcp_ack) + sizeof(tcp_len) + sizeof(tcp_flg);
+
+      if (size != LEN) {
+         return false;
+      }
+      buffer = load_field(buffer, pkt_sizes);
+      buffer = load_field(buffer, pkt_tcp_flgs);
+      buffer = load_field(buffer, pkt_timestamps);
+      buffer = load_field(buffer, pkt_dirs);
+      buffer = load_field(buffer, pkt_count);
+      buffer = load_field(buffer, tcp_seq);
+      buffer = load_field(buffer, tcp_ack);
+      buffer = load_field(buffer, tcp_len);
+      buffer = load_field(buffer, tcp_flg);
+      return true;
+   }
+
    virtual int fill_ipfix(uint8_t *buffer, int size)
    {
       int32_t bufferPtr;
@@ -66,6 +66,14 @@ ProcessPlugin *SMTPPlugin::copy()
    return new SMTPPlugin(*this);
 }
 
+ProcessInterest SMTPPlugin::get_interest() const
+{
+   ProcessInterest interest;
+   interest.hooks = PROCESS_HOOK_POST_CREATE | PROCESS_HOOK_PRE_UPDATE;
+   interest.ports = {25};
+   return interest;
+}
+
 int SMTPPlugin::post_create(Flow &rec, const Packet &pkt)
 {
    if (pkt.src_port == 25 || pkt.dst_port == 25) {
@@ -240,6 +240,7 @@ public:
    std::string get_name() const { return "smtp"; }
    RecordExt *get_ext() const { return new RecordExtSMTP(); }
    ProcessPlugin *copy();
+   ProcessInterest get_interest() const;
 
    int post_create(Flow &rec, const Packet &pkt);
    int pre_update(Flow &rec, Packet &pkt);
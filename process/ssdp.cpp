@@ -90,6 +90,14 @@ ProcessPlugin *SSDPPlugin::copy()
    return new SSDPPlugin(*this);
 }
 
+ProcessInterest SSDPPlugin::get_interest() const
+{
+   ProcessInterest interest;
+   interest.hooks = PROCESS_HOOK_POST_CREATE | PROCESS_HOOK_PRE_UPDATE;
+   interest.ports = {1900};
+   return interest;
+}
+
 int SSDPPlugin::post_create(Flow &rec, const Packet &pkt)
 {
    if (pkt.dst_port == 1900) {
@@ -180,6 +180,7 @@ public:
    std::string get_name() const { return "ssdp"; }
    RecordExt *get_ext() const { return new RecordExtSSDP(); }
    ProcessPlugin *copy();
+   ProcessInterest get_interest() const;
 
    int post_create(Flow &rec, const Packet &pkt);
    int pre_update(Flow &rec, Packet &pkt);
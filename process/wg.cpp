@@ -68,6 +68,14 @@ ProcessPlugin *WGPlugin::copy()
    return new WGPlugin(*this);
 }
 
+ProcessInterest WGPlugin::get_interest() const
+{
+   ProcessInterest interest;
+   interest.hooks = PROCESS_HOOK_POST_CREATE | PROCESS_HOOK_PRE_UPDATE;
+   interest.protocols = {IPPROTO_UDP};
+   return interest;
+}
+
 int WGPlugin::post_create(Flow &rec, const Packet &pkt)
 {
    if (pkt.ip_proto == IPPROTO_UDP) {
@@ -154,6 +154,7 @@ public:
    std::string get_name() const { return "wg"; }
    RecordExt *get_ext() const { return new RecordExtWG(); }
    ProcessPlugin *copy();
+   ProcessInterest get_interest() const;
 
    int post_create(Flow &rec, const Packet &pkt);
    int pre_update(Flow &rec, Packet &pkt);
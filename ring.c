@@ -28,6 +28,7 @@
 #include <stdlib.h> // aligned_malloc
 //#include <unistd.h>
 #include <pthread.h>
+#include <string.h>
 #include <time.h>
 
 #include <ipfixprobe/ring.h>
@@ -91,7 +92,7 @@ struct ring_reader {
      */
     uint32_t div_block;
 
-    /** Previously read messages - only 0 or 1 */
+    /** Previously read messages - 0 or 1 after ipx_ring_pop(), up to the batch size after ipx_ring_pop_bulk() */
     uint32_t last;
 };
 
@@ -339,12 +340,13 @@ ipx_ring_begin(ipx_ring_t *ring)
 /**
  * \brief Commit modifications of memory
  * \param[in] ring Ring buffer
+ * \param[in] cnt  Number of written messages, they must not cross the end of the buffer
  */
 static inline void
-ipx_ring_commit(ipx_ring_t *ring)
+ipx_ring_commit_cnt(ipx_ring_t *ring, uint32_t cnt)
 {
-    register uint32_t new_idx = 1;
-    ring->writer.data_idx++;
+    register uint32_t new_idx = cnt;
+    ring->writer.data_idx += cnt;
 
     if (ring->writer.size == ring->writer.data_idx) {
         // End of the ring buffer has been reached -> skip to the beginning
@@ -365,6 +367,16 @@ ipx_ring_commit(ipx_ring_t *ring)
     }
 }
 
+/**
+ * \brief Commit modifications of memory
+ * \param[in] ring Ring buffer
+ */
+static inline void
+ipx_ring_commit(ipx_ring_t *ring)
+{
+    ipx_ring_commit_cnt(ring, 1);
+}
+
 void
 ipx_ring_push(ipx_ring_t *ring, ipx_msg_t *msg)
 {
@@ -383,9 +395,71 @@ ipx_ring_push(ipx_ring_t *ring, ipx_msg_t *msg)
     }
 }
 
+void
+ipx_ring_push_bulk(ipx_ring_t *ring, ipx_msg_t **msgs, uint32_t cnt)
+{
+    ipx_msg_t **msg_space;
+    uint32_t free_cnt;
+    uint32_t part;
 
-ipx_msg_t *
-ipx_ring_pop(ipx_ring_t *ring)
+    if (ring->mw_mode) {
+        pthread_spin_lock(&ring->writer_lock);
+    }
+
+    while (cnt > 0) {
+        // Wait for at least one empty field, then fill all known empty fields up to the end of the buffer
+        msg_space = ipx_ring_begin(ring);
+        free_cnt = ring->writer.exchange_idx - ring->writer.write_idx;
+        part = ring->writer.size - ring->writer.data_idx;
+        if (part > free_cnt) {
+            part = free_cnt;
+        }
+        if (part > cnt) {
+            part = cnt;
+        }
+
+        memcpy(msg_space, msgs, part * sizeof(*msgs));
+        ipx_ring_commit_cnt(ring, part);
+        msgs += part;
+        cnt -= part;
+    }
+
+    if (ring->mw_mode) {
+        pthread_spin_unlock(&ring->writer_lock);
+    }
+}
+
+void
+ipx_ring_flush(ipx_ring_t *ring)
+{
+    if (ring->mw_mode) {
+        pthread_spin_lock(&ring->writer_lock);
+    }
+
+    uint32_t idx = __sync_fetch_and_add(&ring->writer.write_idx, 0);
+    if (idx != ring->writer.write_commit_idx) {
+        pthread_mutex_lock(&ring->sync.mutex);
+        ring->sync.read_idx = idx;
+        ring->writer.exchange_idx = ring->sync.write_idx;
+        ring->writer.write_commit_idx = idx;
+        pthread_cond_signal(&ring->sync.cond_reader);
+        pthread_mutex_unlock(&ring->sync.mutex);
+    }
+
+    if (ring->mw_mode) {
+        pthread_spin_unlock(&ring->writer_lock);
+    }
+}
+
+/**
+ * \brief Release previously read messages and get the number of messages ready for the reader
+ *
+ * \note The function waits for a writer at most for a timeout when no message is ready.
+ * \param[in] ring Ring buffer
+ * \return Number of messages the reader owns (0 after timeout)
+ */
+static inline uint32_t
+ipx_ring_ready(ipx_ring_t *ring)
 {
     // Consider previous memory block as processed
     ring->reader.data_idx += ring->reader.last;
@@ -397,9 +471,6 @@ ipx_ring_pop(ipx_ring_t *ring)
         ring->reader.data_idx = 0;
     }
 
-    // Prepare the next pointer to read
-    ipx_msg_t **msg = &ring->data[ring->reader.data_idx];
-
     // Sync positions with writers, if necessary
     if (ring->reader.read_idx - ring->reader.read_commit_idx >= ring->reader.div_block) {
         pthread_mutex_lock(&ring->sync.mutex);
@@ -412,39 +483,64 @@ ipx_ring_pop(ipx_ring_t *ring)
 
     if (ring->reader.exchange_idx - ring->reader.read_idx > 0) {
         // Ok, the reader owns this part of the buffer
-        // TODO: prefetch
-        ring->reader.last = 1;
-        return *msg; // Now, we can dereference the pointer
+        return ring->reader.exchange_idx - ring->reader.read_idx;
     }
 
-    while (1) {
-        // The reader has reached the end of the filled memory -> try to sync
-        pthread_mutex_lock(&ring->sync.mutex);
-        pthread_cond_signal(&ring->sync.cond_writer);
-        // Wait until a writer sends a signal or a timeout expires
-        ring_cond_timedwait(&ring->sync.cond_reader, &ring->sync.mutex, 10);
-        ring->reader.exchange_idx = ring->sync.read_idx;
+    // The reader has reached the end of the filled memory -> try to sync
+    pthread_mutex_lock(&ring->sync.mutex);
+    ring->reader.exchange_idx = ring->sync.read_idx;
+    if (ring->reader.exchange_idx - ring->reader.read_idx > 0) {
+        // A writer has synced (e.g. flushed) since the last check, its signal could be missed
         pthread_mutex_unlock(&ring->sync.mutex);
+        return ring->reader.exchange_idx - ring->reader.read_idx;
+    }
+    pthread_cond_signal(&ring->sync.cond_writer);
+    // Wait until a writer sends a signal or a timeout expires
+    ring_cond_timedwait(&ring->sync.cond_reader, &ring->sync.mutex, 10);
+    ring->reader.exchange_idx = ring->sync.read_idx;
+    pthread_mutex_unlock(&ring->sync.mutex);
 
-        if (ring->reader.exchange_idx - ring->reader.read_idx > 0) {
-            // TODO: prefetch
-            ring->reader.last = 1;
-            return *msg; // Now, we can dereference the pointer
-        }
+    if (ring->reader.exchange_idx - ring->reader.read_idx > 0) {
+        return ring->reader.exchange_idx - ring->reader.read_idx;
+    }
 
-        // Writer still didn't perform sync -> try to steal all committed messages from writer
-        pthread_mutex_lock(&ring->sync.mutex);
-        ring->sync.read_idx = ring->reader.exchange_idx = __sync_fetch_and_add(&ring->writer.write_idx, 0);
-        pthread_mutex_unlock(&ring->sync.mutex);
+    // Writer still didn't perform sync -> try to steal all committed messages from writer
+    pthread_mutex_lock(&ring->sync.mutex);
+    ring->sync.read_idx = ring->reader.exchange_idx = __sync_fetch_and_add(&ring->writer.write_idx, 0);
+    pthread_mutex_unlock(&ring->sync.mutex);
 
-        if (ring->reader.exchange_idx - ring->reader.read_idx > 0) {
-            // TODO: prefetch
-            ring->reader.last = 1;
-            return *msg; // Now, we can dereference the pointer
-        }
-        break;
+    return ring->reader.exchange_idx - ring->reader.read_idx;
+}
+
+ipx_msg_t *
+ipx_ring_pop(ipx_ring_t *ring)
+{
+    if (ipx_ring_ready(ring) == 0) {
+        return NULL;
     }
-    return NULL;
+
+    // TODO: prefetch
+    ring->reader.last = 1;
+    return ring->data[ring->reader.data_idx]; // Now, we can dereference the pointer
+}
+
+uint32_t
+ipx_ring_pop_bulk(ipx_ring_t *ring, ipx_msg_t **msgs, uint32_t max)
+{
+    uint32_t cnt = ipx_ring_ready(ring);
+    uint32_t part = ring->reader.size - ring->reader.data_idx;
+
+    // Messages are copied up to the end of the buffer, the rest is left for the next call
+    if (cnt > part) {
+        cnt = part;
+    }
+    if (cnt > max) {
+        cnt = max;
+    }
+
+    memcpy(msgs, &ring->data[ring->reader.data_idx], cnt * sizeof(*msgs));
+    ring->reader.last = cnt;
+    return cnt;
 }
 
 void
@@ -33,6 +33,16 @@
 #define SERVICE_WAIT_MAX_TRY 8  ///< A maximal count of repeated timeouts per each service recv() and send() function call.
 
 #define MSG_MAGIC 0xBEEFFEEB
+#define MSG_RESIZE_MAGIC 0xBEEFFEEC ///< Stats request preceded by a storage resize, followed by uint32_t exponent.
+#define MSG_MAX_ITEMS UINT16_MAX ///< Maximal number of stats of each kind in a message, further plugins are not reported.
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <type_traits>
+
+#include <ipfixprobe/storage.hpp>
 
 namespace ipxp
 {
@@ -43,6 +53,9 @@ struct InputStats {
    uint64_t bytes;
    uint64_t qtime;
    uint64_t dropped;
+   int64_t cpu; /**< CPU the input thread runs on, -1 when unknown. */
+   int64_t node; /**< NUMA node of the CPU, -1 when unknown. */
+   uint64_t cputime; /**< CPU time of the input thread in nanoseconds. */
 };
 
 struct OutputStats {
@@ -50,18 +63,104 @@ struct OutputStats {
    uint64_t bytes;
    uint64_t packets;
    uint64_t dropped;
+   int64_t cpu; /**< CPU the output thread runs on, -1 when unknown. */
+   int64_t node; /**< NUMA node of the CPU, -1 when unknown. */
+   uint64_t cputime; /**< CPU time of the output thread in nanoseconds. */
+};
+
+/**
+ * \brief Stats of a worker thread published to other threads without locks.
+ * The worker thread is the only writer, it bumps the sequence number around each store. Readers retry copies
+ * which overlapped a store, so they always get stats of a single store while the writer never waits.
+ */
+template<typename Stats>
+class SeqlockStats
+{
+public:
+   SeqlockStats() : m_seq(0)
+   {
+      store(Stats());
+   }
+
+   SeqlockStats(const SeqlockStats &) = delete;
+   SeqlockStats &operator=(const SeqlockStats &) = delete;
+
+   /**
+    * \brief Publish stats, called only by the worker thread.
+    */
+   void store(const Stats &stats)
+   {
+      uint64_t words[WORDS];
+      uint64_t seq = m_seq.load(std::memory_order_relaxed);
+
+      memcpy(words, &stats, sizeof(Stats));
+      m_seq.store(seq + 1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+      for (size_t i = 0; i < WORDS; i++) {
+         m_words[i].store(words[i], std::memory_order_relaxed);
+      }
+      m_seq.store(seq + 2, std::memory_order_release);
+   }
+
+   /**
+    * \brief Get the last published stats, called by any thread.
+    */
+   Stats load() const
+   {
+      uint64_t words[WORDS];
+      uint64_t begin;
+      uint64_t end;
+      Stats stats;
+
+      while (1) {
+         begin = m_seq.load(std::memory_order_acquire);
+         if (begin & 1) {
+            // Writer is in the middle of a store
+            std::this_thread::yield();
+            continue;
+         }
+         for (size_t i = 0; i < WORDS; i++) {
+            words[i] = m_words[i].load(std::memory_order_relaxed);
+         }
+         std::atomic_thread_fence(std::memory_order_acquire);
+         end = m_seq.load(std::memory_order_relaxed);
+         if (begin == end) {
+            break;
+         }
+      }
+      memcpy(&stats, words, sizeof(Stats));
+      return stats;
+   }
+
+private:
+   static_assert(sizeof(Stats) % sizeof(uint64_t) == 0, "stats must consist of 64-bit counters");
+   static_assert(std::is_trivially_copyable<Stats>::value, "stats must be trivially copyable");
+   static const size_t WORDS = sizeof(Stats) / sizeof(uint64_t);
+
+   std::atomic<uint64_t> m_seq;
+   std::atomic<uint64_t> m_words[WORDS];
 };
 
 typedef struct msg_header_s
 {
    uint32_t magic;
-   uint16_t size;
+   uint32_t size;
    uint16_t inputs;
    uint16_t outputs;
+   uint16_t storages;
+   uint16_t reserved;
 
    // followed by arrays of plugin stats
 } msg_header_t;
 
+/**
+ * \brief Get size of the stats following a message header.
+ */
+inline size_t msg_data_size(size_t inputs, size_t outputs, size_t storages)
+{
+   return inputs * sizeof(InputStats) + outputs * sizeof(OutputStats) + storages * sizeof(StorageStats);
+}
+
 int connect_to_exporter(const char *path);
 int create_stats_sock(const char *path);
 int recv_data(int sd, uint32_t size, void *data);
@@ -30,37 +30,152 @@
  *
  */
 
+#include <algorithm>
 #include <cstdlib>
 #include <iostream>
 #include <cstring>
+#include <mutex>
+#include <new>
+#include <string>
 #include <sys/time.h>
+#include <unistd.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include <ipfixprobe/ring.h>
 #include "cache.hpp"
+#include "snapshot.hpp"
 #include "xxhash.h"
 
 namespace ipxp {
 
+/*
+ * Each slot of the flow table has a 16 bit tag derived from the flow hash. Tags are stored
+ * contiguously per line, so one line is searched with a single vector compare and only the
+ * records with matching tag are dereferenced. Compare functions return 2 mask bits per tag.
+ */
+#if defined(__AVX2__)
+static const uint32_t TAG_CHUNK = 16;
+
+static inline uint32_t match_tags(const uint16_t *tags, uint16_t tag)
+{
+   __m256i cmp = _mm256_cmpeq_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(tags)), _mm256_set1_epi16(tag));
+   return static_cast<uint32_t>(_mm256_movemask_epi8(cmp));
+}
+#elif defined(__SSE2__)
+static const uint32_t TAG_CHUNK = 8;
+
+static inline uint32_t match_tags(const uint16_t *tags, uint16_t tag)
+{
+   __m128i cmp = _mm_cmpeq_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(tags)), _mm_set1_epi16(tag));
+   return static_cast<uint32_t>(_mm_movemask_epi8(cmp));
+}
+#else
+static const uint32_t TAG_CHUNK = 8;
+
+static inline uint32_t match_tags(const uint16_t *tags, uint16_t tag)
+{
+   uint32_t mask = 0;
+   for (uint32_t i = 0; i < TAG_CHUNK; i++) {
+      if (tags[i] == tag) {
+         mask |= 3U << (2 * i);
+      }
+   }
+   return mask;
+}
+#endif
+
+static inline uint16_t flow_tag(uint64_t hash)
+{
+   uint16_t tag = hash >> 48;
+   return tag ? tag : 1;
+}
+
 __attribute__((constructor)) static void register_this_plugin()
 {
    static PluginRecord rec = PluginRecord("cache", [](){return new NHTFlowCache();});
    register_plugin(&rec);
 }
 
-FlowRecord::FlowRecord()
+void FlowRecord::erase()
 {
-   erase();
-};
+   memset(this, 0, sizeof(*this));
+}
 
-FlowRecord::~FlowRecord()
+void FlowRecord::reuse()
+{
+   m_time_first = m_time_last.tv_sec;
+   m_src_packets = 0;
+   m_dst_packets = 0;
+   m_src_bytes = 0;
+   m_dst_bytes = 0;
+   m_src_tcp_flags = 0;
+   m_dst_tcp_flags = 0;
+}
+
+inline __attribute__((always_inline)) bool FlowRecord::is_empty() const
+{
+   return m_hash == 0;
+}
+
+inline __attribute__((always_inline)) bool FlowRecord::belongs(uint64_t hash) const
+{
+   return hash == m_hash;
+}
+
+inline __attribute__((always_inline)) uint64_t FlowRecord::get_hash() const
+{
+   return m_hash;
+}
+
+void FlowRecord::create(const Packet &pkt, uint64_t hash, bool swapped)
+{
+   m_hash = hash;
+   m_swapped = swapped;
+
+   m_time_first = pkt.ts.tv_sec;
+   m_time_last = pkt.ts;
+
+   m_src_packets = 1;
+   m_dst_packets = 0;
+   m_src_bytes = pkt.ip_len;
+   m_dst_bytes = 0;
+   m_src_tcp_flags = pkt.ip_proto == IPPROTO_TCP ? pkt.tcp_flags : 0;
+   m_dst_tcp_flags = 0;
+}
+
+void FlowRecord::update(const Packet &pkt, bool src)
+{
+   m_time_last = pkt.ts;
+   if (src) {
+      m_src_packets++;
+      m_src_bytes += pkt.ip_len;
+
+      if (pkt.ip_proto == IPPROTO_TCP) {
+         m_src_tcp_flags |= pkt.tcp_flags;
+      }
+   } else {
+      m_dst_packets++;
+      m_dst_bytes += pkt.ip_len;
+
+      if (pkt.ip_proto == IPPROTO_TCP) {
+         m_dst_tcp_flags |= pkt.tcp_flags;
+      }
+   }
+}
+
+ColdFlowRecord::ColdFlowRecord()
 {
    erase();
-};
+}
 
-void FlowRecord::erase()
+void ColdFlowRecord::erase()
 {
    m_flow.remove_extensions();
-   m_hash = 0;
 
    memset(&m_flow.time_first, 0, sizeof(m_flow.time_first));
    memset(&m_flow.time_last, 0, sizeof(m_flow.time_last));
@@ -77,36 +192,10 @@ void FlowRecord::erase()
    m_flow.src_tcp_flags = 0;
    m_flow.dst_tcp_flags = 0;
 }
-void FlowRecord::reuse()
-{
-   m_flow.remove_extensions();
-   m_flow.time_first = m_flow.time_last;
-   m_flow.src_packets = 0;
-   m_flow.dst_packets = 0;
-   m_flow.src_bytes = 0;
-   m_flow.dst_bytes = 0;
-   m_flow.src_tcp_flags = 0;
-   m_flow.dst_tcp_flags = 0;
-}
-
-inline __attribute__((always_inline)) bool FlowRecord::is_empty() const
-{
-   return m_hash == 0;
-}
-
-inline __attribute__((always_inline)) bool FlowRecord::belongs(uint64_t hash) const
-{
-   return hash == m_hash;
-}
 
-void FlowRecord::create(const Packet &pkt, uint64_t hash)
+void ColdFlowRecord::create(const Packet &pkt)
 {
-   m_flow.src_packets = 1;
-
-   m_hash = hash;
-
    m_flow.time_first = pkt.ts;
-   m_flow.time_last = pkt.ts;
 
    memcpy(m_flow.src_mac, pkt.src_mac, 6);
    memcpy(m_flow.dst_mac, pkt.dst_mac, 6);
@@ -116,332 +205,1449 @@ void FlowRecord::create(const Packet &pkt, uint64_t hash)
       m_flow.ip_proto = pkt.ip_proto;
       m_flow.src_ip.v4 = pkt.src_ip.v4;
       m_flow.dst_ip.v4 = pkt.dst_ip.v4;
-      m_flow.src_bytes = pkt.ip_len;
    } else if (pkt.ip_version == IP::v6) {
       m_flow.ip_version = pkt.ip_version;
       m_flow.ip_proto = pkt.ip_proto;
       memcpy(m_flow.src_ip.v6, pkt.src_ip.v6, 16);
       memcpy(m_flow.dst_ip.v6, pkt.dst_ip.v6, 16);
-      m_flow.src_bytes = pkt.ip_len;
    }
 
-   if (pkt.ip_proto == IPPROTO_TCP) {
-      m_flow.src_port = pkt.src_port;
-      m_flow.dst_port = pkt.dst_port;
-      m_flow.src_tcp_flags = pkt.tcp_flags;
-   } else if (pkt.ip_proto == IPPROTO_UDP) {
-      m_flow.src_port = pkt.src_port;
-      m_flow.dst_port = pkt.dst_port;
-   } else if (pkt.ip_proto == IPPROTO_ICMP ||
+   if (pkt.ip_proto == IPPROTO_TCP ||
+      pkt.ip_proto == IPPROTO_UDP ||
+      pkt.ip_proto == IPPROTO_ICMP ||
       pkt.ip_proto == IPPROTO_ICMPV6) {
       m_flow.src_port = pkt.src_port;
       m_flow.dst_port = pkt.dst_port;
    }
 }
 
-void FlowRecord::update(const Packet &pkt, bool src)
+/**
+ * \brief Copy counters and last packet time from the hot part of the record.
+ */
+void ColdFlowRecord::sync(const FlowRecord &flow)
+{
+   m_flow.time_last = flow.m_time_last;
+   m_flow.src_bytes = flow.m_src_bytes;
+   m_flow.dst_bytes = flow.m_dst_bytes;
+   m_flow.src_packets = flow.m_src_packets;
+   m_flow.dst_packets = flow.m_dst_packets;
+   m_flow.src_tcp_flags = flow.m_src_tcp_flags;
+   m_flow.dst_tcp_flags = flow.m_dst_tcp_flags;
+}
+
+
+/**
+ * \brief Shards of the shared cache, attached by caches of all inputs.
+ */
+struct SharedFlowShards {
+   std::mutex m_lock; /**< Guards attaching, detaching and allocation of the shards. */
+   FlowShard *m_shards;
+   uint32_t m_count;
+   uint32_t m_users; /**< Number of attached caches. */
+   uint32_t m_running; /**< Number of attached caches which did not finish yet. */
+   bool m_restored; /**< Snapshot was already loaded into the shards. */
+
+   SharedFlowShards() : m_shards(nullptr), m_count(0), m_users(0), m_running(0), m_restored(false)
+   {
+   }
+};
+
+static SharedFlowShards shared_shards;
+
+static uint32_t private_snapshots = 0; /**< Number of private caches with snapshot, caches are initialized by a single thread. */
+
+static const size_t SNAPSHOT_EXT_BUFFER_SIZE = 65536; /**< Maximal size of saved extensions of a flow. */
+
+FlowTable::FlowTable() :
+   m_size(0), m_qsize(0), m_spare(0), m_line_mask(0), m_flow_table(nullptr), m_flow_records(nullptr),
+   m_flow_data(nullptr), m_flow_tags(nullptr), m_flow_meta(nullptr), m_line_meta(nullptr), m_returns(nullptr), m_constructed(0)
+{
+}
+
+FlowTable::~FlowTable()
+{
+   release();
+}
+
+/**
+ * \brief Allocate memory of the table, records have to be constructed before use.
+ * \param [in] size Number of records.
+ * \param [in] line_size Number of records in a line.
+ * \param [in] qsize Number of records for export, export waits for the output when all of them are exported.
+ * \param [in] hugepage_size Size of hugepages backing the memory or 0.
+ * \param [in] numa_node Node to bind the memory to or NUMA_NODE_ANY.
+ * \param [in] prefault Fault in the memory.
+ * \param [in] bind_required Fail when the memory cannot be bound to the node.
+ */
+void FlowTable::allocate(uint32_t size, uint32_t line_size, uint32_t qsize, size_t hugepage_size, int numa_node, bool prefault, bool bind_required)
+{
+   size_t cnt = static_cast<size_t>(size) + qsize;
+   m_size = size;
+   m_qsize = qsize;
+   m_spare = qsize;
+   m_line_mask = (size - 1) & ~(line_size - 1);
+   m_flow_table = static_cast<FlowRecord **>(m_table_mem.allocate(cnt * sizeof(FlowRecord *), hugepage_size, numa_node, prefault));
+   void *records = m_records_mem.allocate(cnt * sizeof(FlowRecord), hugepage_size, numa_node, prefault);
+   void *data = m_data_mem.allocate(cnt * sizeof(ColdFlowRecord), hugepage_size, numa_node, prefault);
+   // Padded, so that the last line can be compared by whole chunks
+   m_flow_tags = static_cast<uint16_t *>(m_tags_mem.allocate((size + TAG_CHUNK) * sizeof(uint16_t), hugepage_size, numa_node, prefault));
+   m_flow_meta = static_cast<uint8_t *>(m_meta_mem.allocate(size * sizeof(uint8_t), hugepage_size, numa_node, prefault));
+   m_line_meta = static_cast<FlowLineMeta *>(m_lines_mem.allocate(size / line_size * sizeof(FlowLineMeta), hugepage_size, numa_node, prefault));
+   if (m_flow_table == nullptr || records == nullptr || data == nullptr || m_flow_tags == nullptr ||
+      m_flow_meta == nullptr || m_line_meta == nullptr) {
+      release();
+      throw PluginError("not enough memory for flow cache allocation");
+   }
+   if (bind_required &&
+      (m_table_mem.bind_failed() || m_records_mem.bind_failed() || m_data_mem.bind_failed() || m_tags_mem.bind_failed() ||
+      m_meta_mem.bind_failed() || m_lines_mem.bind_failed())) {
+      release();
+      throw PluginError("unable to bind flow cache memory to NUMA node " + std::to_string(numa_node));
+   }
+
+   // Hot records and policy state are valid when zeroed, which mapped memory already is
+   m_flow_records = static_cast<FlowRecord *>(records);
+   m_flow_data = static_cast<ColdFlowRecord *>(data);
+   m_returns = new FlowReturnQueue(qsize);
+}
+
+/**
+ * \brief Construct next records of an allocated table.
+ * \param [in] count Maximal number of records to construct.
+ * \return True when all records are constructed.
+ */
+bool FlowTable::construct(size_t count)
+{
+   size_t end = std::min(m_constructed + count, static_cast<size_t>(m_size) + m_qsize);
+   for (; m_constructed < end; m_constructed++) {
+      new (m_flow_data + m_constructed) ColdFlowRecord();
+      m_flow_data[m_constructed].m_flow.return_queue = m_returns;
+      m_flow_table[m_constructed] = m_flow_records + m_constructed;
+   }
+   return is_constructed();
+}
+
+/**
+ * \brief Destroy last constructed records.
+ * \param [in] count Maximal number of records to destroy.
+ * \return True when no constructed record is left.
+ */
+bool FlowTable::destroy(size_t count)
+{
+   for (; m_constructed > 0 && count > 0; count--) {
+      m_constructed--;
+      m_flow_data[m_constructed].~ColdFlowRecord();
+   }
+   return m_constructed == 0;
+}
+
+void FlowTable::release()
+{
+   m_timers.clear();
+   if (m_flow_data != nullptr) {
+      destroy(m_constructed);
+      m_flow_data = nullptr;
+   }
+   m_flow_records = nullptr;
+   m_flow_table = nullptr;
+   m_flow_tags = nullptr;
+   m_flow_meta = nullptr;
+   m_line_meta = nullptr;
+   m_records_mem.release();
+   m_data_mem.release();
+   m_table_mem.release();
+   m_tags_mem.release();
+   m_meta_mem.release();
+   m_lines_mem.release();
+   delete m_returns;
+   m_returns = nullptr;
+}
+
+/**
+ * \brief Take back records returned by the output and get a spare record for an exported flow.
+ * \return Index of the spare record in m_flow_table, the exported record is swapped with it.
+ */
+uint32_t FlowTable::get_spare()
+{
+   Flow *flow;
+   while ((flow = m_spare ? m_returns->pop() : m_returns->wait()) != nullptr) {
+      // Records are returned as their exported part, index of the record is given by its position in the cold records
+      size_t index = (reinterpret_cast<char *>(flow) - reinterpret_cast<char *>(&m_flow_data->m_flow)) / sizeof(ColdFlowRecord);
+      m_flow_table[m_size + m_spare++] = m_flow_records + index;
+   }
+   return m_size + --m_spare;
+}
+
+/**
+ * \brief Check whether all exported records were returned by the output.
+ */
+bool FlowTable::is_returned()
+{
+   Flow *flow;
+   while ((flow = m_returns->pop()) != nullptr) {
+      m_spare++;
+   }
+   return m_spare == m_qsize;
+}
+
+FlowShard::FlowShard() :
+   m_table(nullptr), m_next(nullptr), m_retired(nullptr), m_staging(nullptr), m_cursor(0),
+   m_window_start(0), m_window_evictions(0), m_flows(0), m_capacity(0), m_requested_size(0),
+   m_evictions(0), m_min_size(0), m_max_size(0)
+{
+}
+
+FlowShard::~FlowShard()
+{
+   delete m_table;
+   delete m_next;
+   delete m_retired;
+   delete m_staging;
+}
+
+NHTFlowCache::NHTFlowCache() :
+   m_cache_size(0), m_line_size(0), m_qsize(0), m_active(0), m_inactive(0),
+   m_split_biflow(false), m_keylen(0), m_key_swapped(false), m_key(), m_tag_mask(0), m_hugepage_size(0),
+   m_numa_node(NUMA_NODE_ANY), m_prefault(false), m_resize_evictions(0), m_min_shard_size(0), m_max_shard_size(0),
+   m_shared(false), m_running(false), m_shards(nullptr), m_shard_cnt(0), m_shard_mask(0), m_hash_shards(0),
+   m_partition_cnt(0), m_shard(nullptr), m_table(nullptr), m_sweep_time(0), m_policy(nullptr), m_export_cnt(0)
+{
+}
+
+NHTFlowCache::~NHTFlowCache()
+{
+   close();
+}
+
+void NHTFlowCache::init(const char *params)
+{
+   CacheOptParser parser;
+   try {
+      parser.parse(params);
+   } catch (ParserError &e) {
+      throw PluginError(e.what());
+   }
+
+   m_cache_size = parser.m_cache_size;
+   m_line_size = parser.m_line_size;
+   m_active = parser.m_active;
+   m_inactive = parser.m_inactive;
+   m_shared = parser.m_shared;
+   uint32_t shard_cnt = m_shared ? parser.m_shards : 1;
+   m_tag_mask = m_line_size < TAG_CHUNK ? (1U << (2 * m_line_size)) - 1 : ~0U;
+
+   if (m_export_queue == nullptr) {
+      throw PluginError("output queue must be set before init");
+   }
+
+   if (m_line_size > m_cache_size) {
+      throw PluginError("flow cache line size must be greater or equal to cache size");
+   }
+   if (m_cache_size == 0) {
+      throw PluginError("flow cache won't properly work with 0 records");
+   }
+   if (m_line_size > m_cache_size / shard_cnt) {
+      throw PluginError("each flow cache shard must hold at least one line, use fewer shards");
+   }
+
+   // Partition 0 holds flows of VLANs without own partition
+   m_hash_shards = shard_cnt;
+   m_partition_cnt = parser.m_partitions.size() + 1;
+   m_shard_cnt = m_partition_cnt * m_hash_shards;
+   if (m_shard_cnt > MAX_FLOW_CACHE_SHARDS) {
+      throw PluginError("too many flow cache shards of all partitions, use fewer shards");
+   }
+   m_shard_mask = m_shard_cnt - 1;
+   for (uint32_t i = 0; i < 32; i++) {
+      m_shard_mask |= m_shard_mask >> i;
+   }
+   m_partition_sizes.assign(1, m_cache_size / shard_cnt);
+   m_vlan_partition.assign(VLAN_COUNT, 0);
+   for (size_t i = 0; i < parser.m_partitions.size(); i++) {
+      const CachePartition &partition = parser.m_partitions[i];
+      if (m_line_size > partition.m_size / shard_cnt) {
+         throw PluginError("each flow cache partition shard must hold at least one line, use bigger partitions");
+      }
+      m_partition_sizes.push_back(partition.m_size / shard_cnt);
+      for (size_t j = 0; j < partition.m_vlans.size(); j++) {
+         if (m_vlan_partition[partition.m_vlans[j]] != 0) {
+            throw PluginError("VLAN " + std::to_string(partition.m_vlans[j]) + " is in multiple flow cache partitions");
+         }
+         m_vlan_partition[partition.m_vlans[j]] = i + 1;
+      }
+   }
+
+   m_split_biflow = parser.m_split_biflow;
+   m_hugepage_size = parser.m_hugepage_size;
+   m_numa_node = parser.m_numa_node;
+   m_prefault = parser.m_prefault;
+   m_resize_evictions = parser.m_resize_evictions;
+   if (parser.m_export_records) {
+      m_qsize = parser.m_export_records;
+   }
+   // Shards split one budget of records waiting for export instead of each allocating the whole output queue
+   m_qsize = std::max(m_qsize / m_shard_cnt, std::min(m_qsize, MIN_SHARD_EXPORT_RECORDS));
+   m_min_shard_size = m_cache_size / shard_cnt;
+   m_staging_size = parser.m_staging_size ? std::max(parser.m_staging_size / shard_cnt, STAGING_LINE_SIZE) : 0;
+   if (parser.m_max_size) {
+      m_max_shard_size = std::max(parser.m_max_size / shard_cnt, m_min_shard_size);
+   } else {
+      m_max_shard_size = static_cast<uint32_t>(std::min<uint64_t>(static_cast<uint64_t>(m_cache_size) * 4, 1U << 30) / shard_cnt);
+   }
+
+   m_policy = ReplacementPolicy::create(parser.m_policy, m_line_size);
+   m_snapshot_path = parser.m_snapshot;
+   if (!m_snapshot_path.empty() && !m_shared) {
+      uint32_t idx = private_snapshots++;
+      if (idx) {
+         m_snapshot_path += "." + std::to_string(idx);
+      }
+   }
+
+   if (m_shared) {
+      attach_shared(parser);
+   } else {
+      m_shards = new FlowShard[m_shard_cnt];
+      if (m_numa_node != NUMA_NODE_AUTO) {
+         allocate_tables(m_numa_node);
+      }
+   }
+
+   m_sampler.configure(parser.m_sample_rate, parser.m_flow_sample_rate, parser.m_adaptive_rate);
+
+   m_stats = StorageStats();
+}
+
+/**
+ * \brief Attach cache to the shared shards, the first cache creates them.
+ */
+void NHTFlowCache::attach_shared(const CacheOptParser &parser)
+{
+   std::lock_guard<std::mutex> guard(shared_shards.m_lock);
+   if (shared_shards.m_users == 0) {
+      shared_shards.m_shards = new FlowShard[m_shard_cnt];
+      shared_shards.m_count = m_shard_cnt;
+   } else if (shared_shards.m_count != m_shard_cnt) {
+      throw PluginError("caches sharing flows must have the same shards and partitions");
+   }
+   shared_shards.m_users++;
+   shared_shards.m_running++;
+   m_shards = shared_shards.m_shards;
+   m_running = true;
+
+   if (m_numa_node != NUMA_NODE_AUTO) {
+      allocate_tables(m_numa_node);
+   }
+}
+
+void NHTFlowCache::close()
+{
+   delete m_policy;
+   m_policy = nullptr;
+   if (m_shards == nullptr) {
+      return;
+   }
+   if (m_shared) {
+      std::lock_guard<std::mutex> guard(shared_shards.m_lock);
+      if (m_running) {
+         m_running = false;
+         shared_shards.m_running--;
+      }
+      if (--shared_shards.m_users == 0) {
+         delete[] shared_shards.m_shards;
+         shared_shards.m_shards = nullptr;
+         shared_shards.m_restored = false;
+      }
+   } else {
+      delete[] m_shards;
+   }
+   m_shards = nullptr;
+   m_shard = nullptr;
+   m_table = nullptr;
+}
+
+void NHTFlowCache::set_queue(ipx_ring_t *queue)
+{
+   m_export_queue = queue;
+   m_qsize = ipx_ring_size(queue);
+}
+
+void NHTFlowCache::thread_init()
+{
+#ifdef WITH_STATIC_PLUGINS
+   std::vector<ProcessPlugin *> plugins;
+   for (uint32_t i = 0; i < get_plugin_cnt(); i++) {
+      plugins.push_back(get_plugin(i));
+   }
+   m_static_plugins.bind(plugins);
+#endif
+
+   // Allocated from the thread which processes packets, so pages are local to it.
+   // Shared tables are allocated by the first thread.
+   // Snapshot is loaded before any packet, in shared mode by the first thread, which holds the lock meanwhile.
+   if (m_shared) {
+      std::lock_guard<std::mutex> guard(shared_shards.m_lock);
+      allocate_tables(HugeMemory::current_numa_node());
+      if (!m_snapshot_path.empty() && !shared_shards.m_restored) {
+         shared_shards.m_restored = true;
+         load_snapshot();
+      }
+   } else {
+      allocate_tables(HugeMemory::current_numa_node());
+      if (!m_snapshot_path.empty()) {
+         load_snapshot();
+      }
+   }
+}
+
+/**
+ * \brief Allocate and construct tables of shards which do not have any yet.
+ * \param [in] numa_node Node to bind the memory to or NUMA_NODE_ANY.
+ */
+void NHTFlowCache::allocate_tables(int numa_node)
+{
+   for (uint32_t i = 0; i < m_shard_cnt; i++) {
+      FlowShard &shard = m_shards[i];
+      if (shard.m_table == nullptr) {
+         // Only the default partition grows, other partitions are kept at their quota
+         uint32_t size = m_partition_sizes[i / m_hash_shards];
+         FlowTable *table = new FlowTable();
+         try {
+            // Every table needs its own spare records, a table reuses them after exporting its share of the export records
+            table->allocate(size, m_line_size, m_qsize, m_hugepage_size, numa_node, m_prefault, m_numa_node != NUMA_NODE_AUTO);
+         } catch (PluginError &e) {
+            delete table;
+            throw;
+         }
+         table->construct(size + static_cast<size_t>(m_qsize));
+         shard.m_table = table;
+         shard.m_min_size = size;
+         shard.m_max_size = i < m_hash_shards ? m_max_shard_size : size;
+         shard.m_capacity.store(size, std::memory_order_relaxed);
+      }
+      if (m_staging_size && shard.m_staging == nullptr) {
+         shard.m_staging = new StagingTable(m_staging_size, m_qsize);
+      }
+   }
+}
+
+/**
+ * \brief Request resize of the cache, the resize is done by threads processing packets.
+ * \param [in] size New number of records, power of two.
+ * \return False when the size is not valid.
+ */
+bool NHTFlowCache::resize(uint32_t size)
+{
+   uint32_t shard_size = size / m_hash_shards;
+   if (m_shards == nullptr || size == 0 || (size & (size - 1)) || size > (1U << 30) || shard_size < m_line_size) {
+      return false;
+   }
+   for (uint32_t i = 0; i < m_hash_shards; i++) {
+      m_shards[i].m_requested_size.store(shard_size, std::memory_order_relaxed);
+   }
+   return true;
+}
+
+/**
+ * \brief Do a bounded amount of work on resize of the current shard.
+ *
+ * Records of a new table are constructed in steps, then a line of the old table is moved
+ * to the new table per step. The old table is destroyed in steps after it is replaced and
+ * its exported records are not in the export queue anymore.
+ */
+void NHTFlowCache::resize_step(time_t now)
+{
+   FlowShard *shard = m_shard;
+   if (shard->m_retired != nullptr) {
+      if (shard->m_retired->is_returned() && shard->m_retired->destroy(RESIZE_STEP_RECORDS)) {
+         delete shard->m_retired;
+         shard->m_retired = nullptr;
+      }
+      return;
+   }
+
+   if (shard->m_next == nullptr) {
+      uint32_t size = get_resize_size(now);
+      if (size == 0) {
+         return;
+      }
+      FlowTable *table = new FlowTable();
+      try {
+         // Memory is not prefaulted, so the packet is not delayed by faulting in the whole table
+         table->allocate(size, m_line_size, m_qsize, m_hugepage_size,
+            m_numa_node == NUMA_NODE_AUTO ? HugeMemory::current_numa_node() : m_numa_node, false, m_numa_node != NUMA_NODE_AUTO);
+      } catch (PluginError &e) {
+         // Cache keeps its size when the new table cannot be allocated
+         delete table;
+         return;
+      }
+      table->m_timers.clear(shard->m_table->m_timers.get_time());
+      shard->m_next = table;
+      shard->m_cursor = 0;
+   } else if (!shard->m_next->is_constructed()) {
+      shard->m_next->construct(RESIZE_STEP_RECORDS);
+   } else {
+      migrate_line();
+   }
+}
+
+/**
+ * \brief Get requested table size of the current shard or size given by evictions.
+ * \return New table size or 0 when the table should not be resized.
+ */
+uint32_t NHTFlowCache::get_resize_size(time_t now)
+{
+   FlowShard *shard = m_shard;
+   uint32_t size = shard->m_table->m_size;
+   if (shard->m_requested_size.load(std::memory_order_relaxed)) {
+      uint32_t requested = shard->m_requested_size.exchange(0, std::memory_order_relaxed);
+      if (requested && requested != size) {
+         return requested;
+      }
+   }
+
+   if (m_resize_evictions == 0) {
+      return 0;
+   }
+   if (shard->m_window_start == 0 || now < shard->m_window_start) {
+      shard->m_window_start = now;
+   }
+   if (now - shard->m_window_start < RESIZE_INTERVAL) {
+      return 0;
+   }
+   uint64_t evictions = shard->m_window_evictions;
+   shard->m_window_start = now;
+   shard->m_window_evictions = 0;
+
+   if (evictions > static_cast<uint64_t>(m_resize_evictions) * RESIZE_INTERVAL / m_hash_shards && size < shard->m_max_size) {
+      return size * 2;
+   }
+   if (evictions == 0 && shard->m_flows.load(std::memory_order_relaxed) < size / 4 && size > shard->m_min_size) {
+      return size / 2;
+   }
+   return 0;
+}
+
+/**
+ * \brief Move flows of the next line of the current shard table to the resized table.
+ *
+ * Flows keep their order in the line and enter the replacement policy of the resized table as
+ * new flows. Lines of a shrunk table can receive flows from two lines, flows which do not fit are evicted.
+ */
+void NHTFlowCache::migrate_line()
+{
+   FlowShard *shard = m_shard;
+   FlowTable *from = shard->m_table;
+   FlowTable *to = shard->m_next;
+   uint32_t next_line = shard->m_cursor + m_line_size;
+
+   for (uint32_t i = shard->m_cursor; i < next_line; i++) {
+      FlowRecord *flow = from->m_flow_table[i];
+      if (flow->is_empty()) {
+         continue;
+      }
+
+      uint64_t hash = flow->get_hash();
+      uint32_t line_index = hash & to->m_line_mask;
+      m_table = to;
+      uint32_t flow_index = find_flow(line_index, 0, 0);
+      m_table = from;
+      if (flow_index == line_index + m_line_size) {
+         call_pre_export(get_plugin_flow(flow));
+         export_flow(i, FLOW_END_NO_RES);
+         continue;
+      }
+
+      // Migrated flow gets the policy state of a new flow in its line of the resized table
+      flow_index = m_policy->insert(*to, line_index, flow_index, from->m_flow_tags[i], false);
+      FlowRecord *moved = to->m_flow_table[flow_index];
+      ColdFlowRecord *data = from->get_cold(flow);
+      ColdFlowRecord *moved_data = to->get_cold(moved);
+      from->m_timers.cancel(data);
+      *moved = *flow;
+      *moved_data = *data;
+      moved_data->m_flow.return_queue = to->m_returns;
+      data->m_flow.release_extensions();
+      to->m_timers.schedule(moved_data, data->m_timer_expire);
+      to->m_flow_tags[flow_index] = from->m_flow_tags[i];
+
+      flow->erase();
+      data->erase();
+      from->m_flow_tags[i] = 0;
+      from->m_flow_meta[i] = 0;
+   }
+
+   shard->m_cursor = next_line;
+   if (shard->m_cursor == from->m_size) {
+      shard->m_table = to;
+      shard->m_next = nullptr;
+      shard->m_cursor = 0;
+      shard->m_retired = from;
+      shard->m_capacity.store(to->m_size, std::memory_order_relaxed);
+   }
+}
+
+/**
+ * \brief Get shard of a flow, bits of the hash above the line index and below the tag are used.
+ */
+inline FlowShard *NHTFlowCache::get_shard(uint64_t hashval) const
+{
+   return m_shards + ((hashval >> 32) & m_shard_mask);
+}
+
+/**
+ * \brief Select shard in the partition of a packet, index of the shard replaces the hash bits which select it.
+ *
+ * Bits of the original hash which are replaced select the shard of a partition, so they do not distinguish flows of a shard anyway.
+ */
+inline uint64_t NHTFlowCache::partition_hash(const Packet &pkt, uint64_t hashval) const
+{
+   uint64_t partition = pkt.vlan_id < VLAN_COUNT ? m_vlan_partition[pkt.vlan_id] : 0;
+   uint64_t shard = partition * m_hash_shards + ((hashval >> 32) & (m_hash_shards - 1));
+   return (hashval & ~(static_cast<uint64_t>(m_shard_mask) << 32)) | (shard << 32);
+}
+
+/**
+ * \brief Get flow data of a record for plugin hooks, counters are synced only when there are plugins.
+ */
+inline Flow &NHTFlowCache::get_plugin_flow(FlowRecord *flow)
+{
+   ColdFlowRecord *data = m_table->get_cold(flow);
+   if (has_plugins()) {
+      data->sync(*flow);
+   }
+   return data->m_flow;
+}
+
+/*
+ * Plugin hooks go through the static pipeline when the cache was built with one matching the added plugins.
+ */
+inline int NHTFlowCache::call_pre_create(Packet &pkt)
+{
+#ifdef WITH_STATIC_PLUGINS
+   if (m_static_plugins.bound()) {
+      return m_static_plugins.pre_create(pkt);
+   }
+#endif
+   return plugins_pre_create(pkt);
+}
+
+inline int NHTFlowCache::call_post_create(Flow &rec, const Packet &pkt)
+{
+#ifdef WITH_STATIC_PLUGINS
+   if (m_static_plugins.bound()) {
+      return m_static_plugins.post_create(rec, pkt);
+   }
+#endif
+   return plugins_post_create(rec, pkt);
+}
+
+inline int NHTFlowCache::call_pre_update(Flow &rec, Packet &pkt)
+{
+#ifdef WITH_STATIC_PLUGINS
+   if (m_static_plugins.bound()) {
+      return m_static_plugins.pre_update(rec, pkt);
+   }
+#endif
+   return plugins_pre_update(rec, pkt);
+}
+
+inline int NHTFlowCache::call_post_update(Flow &rec, const Packet &pkt)
+{
+#ifdef WITH_STATIC_PLUGINS
+   if (m_static_plugins.bound()) {
+      return m_static_plugins.post_update(rec, pkt);
+   }
+#endif
+   return plugins_post_update(rec, pkt);
+}
+
+inline void NHTFlowCache::call_pre_export(Flow &rec)
+{
+#ifdef WITH_STATIC_PLUGINS
+   if (m_static_plugins.bound()) {
+      m_static_plugins.pre_export(rec);
+      return;
+   }
+#endif
+   plugins_pre_export(rec);
+}
+
+/**
+ * \brief Queue exported flow, flows are pushed to the output queue in batches.
+ * Shared shards are locked by other inputs, so their flows are pushed at once, as a batch
+ * of another input could hold records this input waits for.
+ */
+inline void NHTFlowCache::push_export(Flow &flow)
+{
+   m_export_batch[m_export_cnt++] = &flow;
+   if (m_export_cnt == EXPORT_BATCH || m_shared) {
+      flush_export();
+   }
+}
+
+/**
+ * \brief Push queued exported flows to the output queue, called before the cache returns to the worker.
+ */
+void NHTFlowCache::flush_export()
+{
+   if (m_export_cnt != 0) {
+      ipx_ring_push_bulk(m_export_queue, reinterpret_cast<ipx_msg_t **>(m_export_batch), m_export_cnt);
+      m_export_cnt = 0;
+   }
+}
+
+/**
+ * \brief Hand all exported flows to the output, called before the cache waits for records returned by the output.
+ */
+void NHTFlowCache::sync_export()
+{
+   flush_export();
+   ipx_ring_flush(m_export_queue);
+}
+
+/**
+ * \brief Get spare record of the current table.
+ */
+inline uint32_t NHTFlowCache::get_spare()
+{
+   if (m_table->m_spare == 0) {
+      sync_export();
+   }
+   return m_table->get_spare();
+}
+
+void NHTFlowCache::export_flow(size_t index, uint8_t reason)
+{
+   // Spare record is taken first, so the exported record cannot be returned before it leaves the table
+   uint32_t spare = get_spare();
+   FlowRecord *flow = m_table->m_flow_table[index];
+   ColdFlowRecord *data = m_table->get_cold(flow);
+   m_table->m_timers.cancel(data);
+   data->sync(*flow);
+   data->m_flow.end_reason = reason;
+   if (m_sampler.is_enabled()) {
+      add_sampling(*flow, data->m_flow);
+   }
+   push_export(data->m_flow);
+   m_stats.exported[reason]++;
+   m_shard->m_flows.store(m_shard->m_flows.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+   if (reason == FLOW_END_NO_RES) {
+      m_shard->m_window_evictions++;
+      m_shard->m_evictions.store(m_shard->m_evictions.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+   }
+
+   std::swap(m_table->m_flow_table[index], m_table->m_flow_table[spare]);
+   flow = m_table->m_flow_table[index];
+   flow->erase();
+   m_table->get_cold(flow)->erase();
+   m_table->m_flow_tags[index] = 0;
+   m_table->m_flow_meta[index] = 0;
+}
+
+/**
+ * \brief Report sampling rates of the packets counted in an exported flow.
+ */
+void NHTFlowCache::add_sampling(const FlowRecord &flow, Flow &data)
+{
+   data.add_extension(new RecordExtSAMPLING(m_sampler.get_packet_rate(flow.m_sample_level), m_sampler.get_flow_rate()));
+}
+
+/**
+ * \brief Get empty record for a new flow in a line of the current table, a flow is evicted from a full line.
+ * \param [in] line_index Index of the first record of the line.
+ * \param [in] tag Tag of the new flow.
+ * \return Index of the empty record.
+ */
+uint32_t NHTFlowCache::get_free_flow(uint32_t line_index, uint16_t tag)
+{
+   uint32_t flow_index = find_flow(line_index, 0, 0);
+   bool found = flow_index != line_index + m_line_size;
+   if (!found) {
+      /* If free place was not found (flow line is full), find
+       * record which will be replaced by new record. */
+      flow_index = m_policy->victim(*m_table, line_index);
+
+      // Export flow
+      call_pre_export(get_plugin_flow(m_table->m_flow_table[flow_index]));
+      export_flow(flow_index, FLOW_END_NO_RES);
+   }
+   return m_policy->insert(*m_table, line_index, flow_index, tag, !found);
+}
+
+/**
+ * \brief Create flow of a packet in an empty record of the current table.
+ */
+void NHTFlowCache::create_flow(uint32_t flow_index, Packet &pkt, uint64_t hashval, bool swapped, uint16_t tag)
+{
+   FlowRecord *flow = m_table->m_flow_table[flow_index];
+   flow->create(pkt, hashval, swapped);
+   flow->m_sample_level = m_sampler.get_level();
+   m_table->get_cold(flow)->create(pkt);
+   m_table->m_flow_tags[flow_index] = tag;
+   m_shard->m_flows.store(m_shard->m_flows.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+   m_stats.created++;
+   schedule_flow(flow);
+   int ret = call_post_create(get_plugin_flow(flow), pkt);
+
+   if (ret & FLOW_FLUSH) {
+      export_flow(flow_index, FLOW_END_FORCED);
+      m_stats.flushed++;
+   }
+}
+
+/**
+ * \brief Keep a new flow in the staging table of the current shard, the oldest staged flow of a full line is exported.
+ */
+void NHTFlowCache::stage_flow(Packet &pkt, uint64_t hashval, bool swapped)
+{
+   StagedFlow *staged = m_shard->m_staging->get_slot(hashval);
+   if (staged->m_hash != 0) {
+      export_staged(*staged, FLOW_END_NO_RES);
+   }
+   staged->stage(pkt, hashval, swapped);
+   m_shard->m_staging->added();
+   m_stats.staged++;
+}
+
+/**
+ * \brief Move staged flow into the current table, plugins see its staged packet as the first one.
+ */
+void NHTFlowCache::promote_flow(StagedFlow &staged, uint64_t hashval)
 {
-   m_flow.time_last = pkt.ts;
-   if (src) {
-      m_flow.src_packets++;
-      m_flow.src_bytes += pkt.ip_len;
+   Packet first;
+   staged.restore(first);
+   bool swapped = staged.m_swapped;
+   m_shard->m_staging->remove(staged);
+   m_stats.promoted++;
+
+   uint16_t tag = flow_tag(hashval);
+   uint32_t flow_index = get_free_flow(hashval & m_table->m_line_mask, tag);
+   create_flow(flow_index, first, hashval, swapped, tag);
+}
 
-      if (pkt.ip_proto == IPPROTO_TCP) {
-         m_flow.src_tcp_flags |= pkt.tcp_flags;
-      }
-   } else {
-      m_flow.dst_packets++;
-      m_flow.dst_bytes += pkt.ip_len;
+/**
+ * \brief Export staged flow of the current shard without passing it to plugins.
+ */
+void NHTFlowCache::export_staged(StagedFlow &staged, uint8_t reason)
+{
+   if (!m_shard->m_staging->has_spare()) {
+      sync_export();
+   }
+   Flow &flow = m_shard->m_staging->get_export();
+   flow.remove_extensions();
+   staged.fill(flow);
+   flow.end_reason = reason;
+   m_shard->m_staging->remove(staged);
+   if (m_sampler.is_enabled()) {
+      flow.add_extension(new RecordExtSAMPLING(m_sampler.get_packet_rate(), m_sampler.get_flow_rate()));
+   }
+   push_export(flow);
+   m_stats.exported[reason]++;
+}
 
-      if (pkt.ip_proto == IPPROTO_TCP) {
-         m_flow.dst_tcp_flags |= pkt.tcp_flags;
+/**
+ * \brief Export staged flows of the current shard after the inactive timeout, the table is searched once a second.
+ */
+void NHTFlowCache::expire_staging(time_t ts)
+{
+   StagingTable *staging = m_shard->m_staging;
+   if (!staging->need_sweep(ts)) {
+      return;
+   }
+   for (uint32_t i = 0; i < staging->get_size(); i++) {
+      StagedFlow &staged = staging->get_flow(i);
+      if (staged.m_hash != 0 && ts - staged.m_ts.tv_sec >= m_inactive) {
+         export_staged(staged, (staged.m_tcp_flags & (0x01 | 0x04)) ? FLOW_END_EOF : FLOW_END_INACTIVE);
       }
    }
 }
 
-
-NHTFlowCache::NHTFlowCache() :
-   m_cache_size(0), m_line_size(0), m_line_mask(0), m_line_new_idx(0),
-   m_qsize(0), m_qidx(0), m_timeout_idx(0), m_active(0), m_inactive(0),
-   m_split_biflow(false), m_keylen(0), m_key(), m_key_inv(), m_flow_table(nullptr), m_flow_records(nullptr)
+/**
+ * \brief Export all staged flows of the current shard.
+ */
+void NHTFlowCache::flush_staging()
 {
+   StagingTable *staging = m_shard->m_staging;
+   for (uint32_t i = 0; i < staging->get_size(); i++) {
+      StagedFlow &staged = staging->get_flow(i);
+      if (staged.m_hash != 0) {
+         export_staged(staged, FLOW_END_FORCED);
+      }
+   }
 }
 
-NHTFlowCache::~NHTFlowCache()
+/**
+ * \brief Find record with given tag and hash in a flow line.
+ * \param [in] line_index Index of the first record of the line.
+ * \param [in] tag Tag of the record, 0 searches for an empty record.
+ * \param [in] hash Hash of the record, 0 searches for an empty record.
+ * \return Index of the record or index of the next line when not found.
+ */
+uint32_t NHTFlowCache::find_flow(uint32_t line_index, uint16_t tag, uint64_t hash) const
 {
-   close();
+   uint32_t next_line = line_index + m_line_size;
+   for (uint32_t chunk = line_index; chunk < next_line; chunk += TAG_CHUNK) {
+      uint32_t mask = match_tags(m_table->m_flow_tags + chunk, tag) & m_tag_mask;
+      while (mask) {
+         uint32_t bit = __builtin_ctz(mask);
+         uint32_t flow_index = chunk + bit / 2;
+         if (m_table->m_flow_table[flow_index]->belongs(hash)) {
+            return flow_index;
+         }
+         mask &= ~(3U << bit);
+      }
+   }
+   return next_line;
 }
 
-void NHTFlowCache::init(const char *params)
+void NHTFlowCache::finish()
 {
-   CacheOptParser parser;
-   try {
-      parser.parse(params);
-   } catch (ParserError &e) {
-      throw PluginError(e.what());
+   if (m_shared) {
+      std::lock_guard<std::mutex> guard(shared_shards.m_lock);
+      m_running = false;
+      if (--shared_shards.m_running != 0) {
+         // Flows of other inputs may still be updated, the last finishing cache exports them
+         return;
+      }
    }
 
-   m_cache_size = parser.m_cache_size;
-   m_line_size = parser.m_line_size;
-   m_active = parser.m_active;
-   m_inactive = parser.m_inactive;
-   m_qidx = 0;
-   m_timeout_idx = 0;
-   m_line_mask = (m_cache_size - 1) & ~(m_line_size - 1);
-   m_line_new_idx = m_line_size / 2;
+   if (!m_snapshot_path.empty()) {
+      save_snapshot();
+   }
+   for (uint32_t i = 0; i < m_shard_cnt; i++) {
+      m_shard = &m_shards[i];
+      std::lock_guard<std::mutex> guard(m_shard->m_lock);
+      flush_shard();
+   }
+   flush_export();
+}
 
-   if (m_export_queue == nullptr) {
-      throw PluginError("output queue must be set before init");
+/**
+ * \brief Export all flows of the current shard.
+ */
+void NHTFlowCache::flush_shard()
+{
+   if (m_shard->m_table == nullptr) {
+      return;
    }
+   m_table = m_shard->m_table;
+   flush_table();
+   if (m_shard->m_next != nullptr && m_shard->m_next->is_constructed()) {
+      m_table = m_shard->m_next;
+      flush_table();
+   }
+   if (m_shard->m_staging != nullptr) {
+      flush_staging();
+   }
+}
 
-   if (m_line_size > m_cache_size) {
-      throw PluginError("flow cache line size must be greater or equal to cache size");
+/**
+ * \brief Export all flows of the current table.
+ */
+void NHTFlowCache::flush_table()
+{
+   for (uint32_t i = 0; i < m_table->m_size; i++) {
+      if (!m_table->m_flow_table[i]->is_empty()) {
+         call_pre_export(get_plugin_flow(m_table->m_flow_table[i]));
+         export_flow(i, FLOW_END_FORCED);
+      }
    }
-   if (m_cache_size == 0) {
-      throw PluginError("flow cache won't properly work with 0 records");
+}
+
+/**
+ * \brief Save flows of all shards into the snapshot, saved flows are removed without export.
+ *
+ * Flows are removed only after the whole snapshot is written, so all of them are exported
+ * as usual when the snapshot cannot be written.
+ */
+void NHTFlowCache::save_snapshot()
+{
+   std::vector<SnapshotExtName> ext_names;
+   for (uint32_t i = 0; i < get_plugin_cnt(); i++) {
+      RecordExt *ext = get_plugin(i)->get_ext();
+      if (ext == nullptr) {
+         continue;
+      }
+      SnapshotExtName name;
+      memset(&name, 0, sizeof(name));
+      name.m_ext_id = ext->m_ext_id;
+      strncpy(name.m_name, get_plugin(i)->get_name().c_str(), sizeof(name.m_name) - 1);
+      ext_names.push_back(name);
+      delete ext;
    }
 
+   std::vector<bool> saved;
+   std::vector<uint8_t> buffer(SNAPSHOT_EXT_BUFFER_SIZE);
    try {
-      m_flow_table = new FlowRecord*[m_cache_size + m_qsize];
-      m_flow_records = new FlowRecord[m_cache_size + m_qsize];
-      for (decltype(m_cache_size + m_qsize) i = 0; i < m_cache_size + m_qsize; i++) {
-         m_flow_table[i] = m_flow_records + i;
+      SnapshotWriter writer;
+      writer.open(m_snapshot_path, m_split_biflow, ext_names);
+      for (uint32_t i = 0; i < m_shard_cnt; i++) {
+         m_shard = &m_shards[i];
+         std::lock_guard<std::mutex> guard(m_shard->m_lock);
+         FlowTable *tables[2] = {m_shard->m_table, m_shard->m_next};
+         for (uint32_t t = 0; t < 2; t++) {
+            if (tables[t] == nullptr || !tables[t]->is_constructed()) {
+               continue;
+            }
+            m_table = tables[t];
+            for (uint32_t j = 0; j < m_table->m_size; j++) {
+               if (!m_table->m_flow_table[j]->is_empty()) {
+                  saved.push_back(save_flow(writer, j, buffer));
+               }
+            }
+         }
       }
-   } catch (std::bad_alloc &e) {
-      throw PluginError("not enough memory for flow cache allocation");
+      writer.close();
+   } catch (PluginError &e) {
+      std::cerr << "ipfixprobe: flows are exported instead: " << e.what() << std::endl;
+      return;
    }
 
-   m_split_biflow = parser.m_split_biflow;
-
-#ifdef FLOW_CACHE_STATS
-   m_empty = 0;
-   m_not_empty = 0;
-   m_hits = 0;
-   m_expired = 0;
-   m_flushed = 0;
-   m_lookups = 0;
-   m_lookups2 = 0;
-#endif /* FLOW_CACHE_STATS */
+   // Tables are visited in the same order, so saved flows are at the same positions
+   size_t pos = 0;
+   for (uint32_t i = 0; i < m_shard_cnt; i++) {
+      m_shard = &m_shards[i];
+      std::lock_guard<std::mutex> guard(m_shard->m_lock);
+      FlowTable *tables[2] = {m_shard->m_table, m_shard->m_next};
+      for (uint32_t t = 0; t < 2; t++) {
+         if (tables[t] == nullptr || !tables[t]->is_constructed()) {
+            continue;
+         }
+         m_table = tables[t];
+         for (uint32_t j = 0; j < m_table->m_size; j++) {
+            if (!m_table->m_flow_table[j]->is_empty() && saved[pos++]) {
+               drop_flow(j);
+            }
+         }
+      }
+   }
 }
 
-void NHTFlowCache::close()
+/**
+ * \brief Write flow of the current table with its extensions into the snapshot.
+ * \return False when some extension cannot be saved, such flow is exported instead.
+ */
+bool NHTFlowCache::save_flow(SnapshotWriter &writer, size_t index, std::vector<uint8_t> &buffer)
 {
-   if (m_flow_records != nullptr) {
-      delete [] m_flow_records;
-      m_flow_records = nullptr;
-   }
-   if (m_flow_table != nullptr) {
-      delete [] m_flow_table;
-      m_flow_table = nullptr;
+   FlowRecord *flow = m_table->m_flow_table[index];
+   Flow &data = m_table->get_cold(flow)->m_flow;
+   uint32_t size = 0;
+   uint16_t cnt = 0;
+
+   for (RecordExt *ext = data.m_exts; ext != nullptr; ext = ext->m_next) {
+      if (buffer.size() - size < sizeof(SnapshotExt)) {
+         return false;
+      }
+      int len = ext->save(buffer.data() + size + sizeof(SnapshotExt), buffer.size() - size - sizeof(SnapshotExt));
+      if (len < 0) {
+         return false;
+      }
+      SnapshotExt hdr;
+      hdr.m_ext_id = ext->m_ext_id;
+      hdr.m_size = len;
+      memcpy(buffer.data() + size, &hdr, sizeof(hdr));
+      size += sizeof(SnapshotExt) + len;
+      cnt++;
    }
+
+   writer.write(*flow, data, buffer.data(), cnt, size);
+   return true;
 }
 
-void NHTFlowCache::set_queue(ipx_ring_t *queue)
+/**
+ * \brief Remove flow of the current table without export.
+ */
+void NHTFlowCache::drop_flow(size_t index)
 {
-   m_export_queue = queue;
-   m_qsize = ipx_ring_size(queue);
+   FlowRecord *flow = m_table->m_flow_table[index];
+   ColdFlowRecord *data = m_table->get_cold(flow);
+   m_table->m_timers.cancel(data);
+   flow->erase();
+   data->erase();
+   m_table->m_flow_tags[index] = 0;
+   m_table->m_flow_meta[index] = 0;
+   m_shard->m_flows.store(m_shard->m_flows.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
 }
 
-void NHTFlowCache::export_flow(size_t index)
+/**
+ * \brief Restore flows saved by a previous run, the snapshot is removed afterwards.
+ *
+ * Unusable snapshot is ignored, so the cache starts empty.
+ */
+void NHTFlowCache::load_snapshot()
 {
-   ipx_ring_push(m_export_queue, &m_flow_table[index]->m_flow);
-   std::swap(m_flow_table[index], m_flow_table[m_cache_size + m_qidx]);
-   m_flow_table[index]->erase();
-   m_qidx = (m_qidx + 1) % m_qsize;
+   SnapshotReader reader;
+   try {
+      if (!reader.open(m_snapshot_path, m_split_biflow)) {
+         return;
+      }
+   } catch (PluginError &e) {
+      std::cerr << "ipfixprobe: ignoring flow cache snapshot: " << e.what() << std::endl;
+      return;
+   }
+
+   // Extension identifiers may differ from the previous run, plugins are matched by their names
+   std::vector<std::pair<int32_t, ProcessPlugin *>> plugins;
+   const SnapshotExtName *names = reader.get_ext_names();
+   for (uint8_t i = 0; i < reader.get_ext_cnt(); i++) {
+      std::string name(names[i].m_name, strnlen(names[i].m_name, sizeof(names[i].m_name)));
+      for (uint32_t j = 0; j < get_plugin_cnt(); j++) {
+         if (get_plugin(j)->get_name() == name) {
+            plugins.push_back(std::make_pair(names[i].m_ext_id, get_plugin(j)));
+            break;
+         }
+      }
+   }
+
+   const SnapshotFlow *rec;
+   while ((rec = reader.next()) != nullptr) {
+      restore_flow(*rec, plugins);
+   }
+   reader.close();
+   unlink(m_snapshot_path.c_str());
 }
 
-void NHTFlowCache::finish()
+/**
+ * \brief Insert a flow from the snapshot, lines which are full evict flows as for a new packet.
+ * \param [in] rec Saved flow followed by its extensions.
+ * \param [in] plugins Saved extension identifiers and plugins restoring them.
+ */
+void NHTFlowCache::restore_flow(const SnapshotFlow &rec, const std::vector<std::pair<int32_t, ProcessPlugin *>> &plugins)
 {
-   for (decltype(m_cache_size) i = 0; i < m_cache_size; i++) {
-      if (!m_flow_table[i]->is_empty()) {
-         plugins_pre_export(m_flow_table[i]->m_flow);
-         m_flow_table[i]->m_flow.end_reason = FLOW_END_FORCED;
-         export_flow(i);
-#ifdef FLOW_CACHE_STATS
-         m_expired++;
-#endif /* FLOW_CACHE_STATS */
+   FlowRecord saved;
+   memcpy(&saved, rec.m_record, sizeof(saved));
+   uint64_t hashval = saved.get_hash();
+   // Flows of shards which do not exist anymore are dropped
+   if (hashval == 0 || ((hashval >> 32) & m_shard_mask) >= m_shard_cnt) {
+      return;
+   }
+
+   m_shard = get_shard(hashval);
+   m_table = m_shard->m_table;
+   uint16_t tag = flow_tag(hashval);
+   uint32_t line_index = hashval & m_table->m_line_mask;
+   uint32_t next_line = line_index + m_line_size;
+   if (find_flow(line_index, tag, hashval) != next_line) {
+      return;
+   }
+
+   uint32_t flow_index = get_free_flow(line_index, tag);
+   FlowRecord *flow = m_table->m_flow_table[flow_index];
+   memcpy(flow, &saved, sizeof(saved));
+   ColdFlowRecord *data = m_table->get_cold(flow);
+   data->m_flow.time_first = rec.m_time_first;
+   memcpy(data->m_flow.src_mac, rec.m_src_mac, sizeof(rec.m_src_mac));
+   memcpy(data->m_flow.dst_mac, rec.m_dst_mac, sizeof(rec.m_dst_mac));
+   data->m_flow.src_ip = rec.m_src_ip;
+   data->m_flow.dst_ip = rec.m_dst_ip;
+   data->m_flow.src_port = rec.m_src_port;
+   data->m_flow.dst_port = rec.m_dst_port;
+   data->m_flow.ip_version = rec.m_ip_version;
+   data->m_flow.ip_proto = rec.m_ip_proto;
+   data->sync(*flow);
+
+   const uint8_t *ext_data = reinterpret_cast<const uint8_t *>(&rec + 1);
+   const uint8_t *ext_end = ext_data + rec.m_ext_size;
+   for (uint16_t i = 0; i < rec.m_ext_cnt && static_cast<size_t>(ext_end - ext_data) >= sizeof(SnapshotExt); i++) {
+      SnapshotExt hdr;
+      memcpy(&hdr, ext_data, sizeof(hdr));
+      ext_data += sizeof(hdr);
+      if (static_cast<size_t>(ext_end - ext_data) < hdr.m_size) {
+         break;
+      }
+      for (size_t j = 0; j < plugins.size(); j++) {
+         if (plugins[j].first != hdr.m_ext_id) {
+            continue;
+         }
+         RecordExt *ext = plugins[j].second->get_ext();
+         if (ext != nullptr && ext->load(ext_data, hdr.m_size)) {
+            data->m_flow.add_extension(ext);
+         } else {
+            delete ext;
+         }
+         break;
       }
+      ext_data += hdr.m_size;
    }
+
+   m_table->m_flow_tags[flow_index] = tag;
+   m_shard->m_flows.store(m_shard->m_flows.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+   schedule_flow(flow);
 }
 
 void NHTFlowCache::flush(Packet &pkt, size_t flow_index, int ret, bool source_flow)
 {
-#ifdef FLOW_CACHE_STATS
-   m_flushed++;
-#endif /* FLOW_CACHE_STATS */
+   m_stats.flushed++;
 
    if (ret == FLOW_FLUSH_WITH_REINSERT) {
-      FlowRecord *flow = m_flow_table[flow_index];
-      flow->m_flow.end_reason = FLOW_END_FORCED;
-      ipx_ring_push(m_export_queue, &flow->m_flow);
+      uint32_t spare = get_spare();
+      FlowRecord *flow = m_table->m_flow_table[flow_index];
+      ColdFlowRecord *data = m_table->get_cold(flow);
+      m_table->m_timers.cancel(data);
+      data->sync(*flow);
+      data->m_flow.end_reason = FLOW_END_FORCED;
+      if (m_sampler.is_enabled()) {
+         add_sampling(*flow, data->m_flow);
+      }
+      push_export(data->m_flow);
+      m_stats.exported[FLOW_END_FORCED]++;
 
-      std::swap(m_flow_table[flow_index], m_flow_table[m_cache_size + m_qidx]);
+      std::swap(m_table->m_flow_table[flow_index], m_table->m_flow_table[spare]);
 
-      flow = m_flow_table[flow_index];
-      flow->m_flow.remove_extensions();
-      *flow = *m_flow_table[m_cache_size + m_qidx];
-      m_qidx = (m_qidx + 1) % m_qsize;
+      FlowRecord *exported = m_table->m_flow_table[spare];
+      flow = m_table->m_flow_table[flow_index];
+      data = m_table->get_cold(flow);
+      data->m_flow.remove_extensions();
+      *flow = *exported;
+      *data = *m_table->get_cold(exported);
 
-      flow->m_flow.m_exts = nullptr;
+      data->m_flow.release_extensions();
       flow->reuse(); // Clean counters, set time first to last
+      flow->m_sample_level = m_sampler.get_level();
+      data->m_flow.time_first = flow->m_time_last;
       flow->update(pkt, source_flow); // Set new counters from packet
+      schedule_flow(flow);
 
-      ret = plugins_post_create(flow->m_flow, pkt);
+      ret = call_post_create(get_plugin_flow(flow), pkt);
       if (ret & FLOW_FLUSH) {
          flush(pkt, flow_index, ret, source_flow);
       }
    } else {
-      m_flow_table[flow_index]->m_flow.end_reason = FLOW_END_FORCED;
-      export_flow(flow_index);
+      export_flow(flow_index, FLOW_END_FORCED);
    }
 }
 
 int NHTFlowCache::put_pkt(Packet &pkt)
 {
-   int ret = plugins_pre_create(pkt);
+   if (m_sampler.is_enabled()) {
+      m_sampler.update(pkt.ts.tv_sec);
+      if (!m_sampler.select_packet()) {
+         m_stats.sampled++;
+         return 0;
+      }
+   }
+
+   call_pre_create(pkt);
 
    if (!create_hash_key(pkt)) { // saves key value and key length into attributes NHTFlowCache::key and NHTFlowCache::m_keylen
       return 0;
    }
 
-   uint64_t hashval = XXH64(m_key, m_keylen, 0); /* Calculates hash value from key created before. */
+   /* Calculates hash value from key created before. Biflow keys are direction independent,
+    * so both directions of a flow are found in the same line by a single lookup. */
+   uint64_t hashval = XXH64(m_key, m_keylen, 0);
+   if (m_sampler.is_enabled() && !m_sampler.select_flow(hashval)) {
+      m_stats.sampled++;
+      return 0;
+   }
+   if (m_partition_cnt > 1) {
+      hashval = partition_hash(pkt, hashval);
+   }
+
+   int ret = put_table_pkt(pkt, hashval, m_key_swapped);
+   flush_export();
+   return ret;
+}
 
-   FlowRecord *flow; /* Pointer to flow we will be working with. */
-   bool found = false;
-   bool source_flow = true;
-   uint32_t line_index = hashval & m_line_mask; /* Get index of flow line. */
-   uint32_t flow_index = 0;
-   uint32_t next_line = line_index + m_line_size;
+/**
+ * \brief Put block of packets into the cache.
+ *
+ * Keys of all packets are hashed first and their flow lines and records are prefetched,
+ * so memory accesses of different packets overlap. Packets are then processed in order.
+ * Tables of shared shards can be replaced by other inputs meanwhile, so they are not prefetched.
+ * Packets skipped by sampling are neither passed to plugins nor hashed.
+ */
+int NHTFlowCache::put_pkts(PacketBlock &block)
+{
+   if (m_block_hashes.size() < block.cnt) {
+      m_block_hashes.resize(block.cnt);
+   }
 
-   /* Find existing flow record in flow cache. */
-   for (flow_index = line_index; flow_index < next_line; flow_index++) {
-      if (m_flow_table[flow_index]->belongs(hashval)) {
-         found = true;
-         break;
-      }
+   bool sampling = m_sampler.is_enabled();
+   if (sampling && block.cnt) {
+      m_sampler.update(block.pkts[0].ts.tv_sec);
    }
 
-   /* Find inversed flow. */
-   if (!found && !m_split_biflow) {
-      uint64_t hashval_inv = XXH64(m_key_inv, m_keylen, 0);
-      uint64_t line_index_inv = hashval_inv & m_line_mask;
-      uint64_t next_line_inv = line_index_inv + m_line_size;
-      for (flow_index = line_index_inv; flow_index < next_line_inv; flow_index++) {
-         if (m_flow_table[flow_index]->belongs(hashval_inv)) {
-            found = true;
-            source_flow = false;
-            hashval = hashval_inv;
-            line_index = line_index_inv;
-            break;
+   for (size_t i = 0; i < block.cnt; i++) {
+      Packet &pkt = block.pkts[i];
+      PacketHash &hash = m_block_hashes[i];
+      if (sampling && !m_sampler.select_packet()) {
+         hash.m_hash = 0;
+         m_stats.sampled++;
+         continue;
+      }
+      call_pre_create(pkt);
+      if (create_hash_key(pkt)) {
+         hash.m_hash = XXH64(m_key, m_keylen, 0);
+         hash.m_swapped = m_key_swapped;
+         if (sampling && !m_sampler.select_flow(hash.m_hash)) {
+            hash.m_hash = 0;
+            m_stats.sampled++;
+            continue;
+         }
+         if (m_partition_cnt > 1) {
+            hash.m_hash = partition_hash(pkt, hash.m_hash);
          }
+         if (!m_shared) {
+            prefetch_line(hash.m_hash);
+         }
+      } else {
+         hash.m_hash = 0;
+      }
+   }
+   for (size_t i = 0; i < block.cnt && !m_shared; i++) {
+      if (m_block_hashes[i].m_hash) {
+         prefetch_flow(m_block_hashes[i].m_hash);
+      }
+   }
+   for (size_t i = 0; i < block.cnt; i++) {
+      if (m_block_hashes[i].m_hash) {
+         put_table_pkt(block.pkts[i], m_block_hashes[i].m_hash, m_block_hashes[i].m_swapped);
       }
    }
+   flush_export();
+   return 0;
+}
 
-   if (found) {
-      /* Existing flow record was found, put flow record at the first index of flow line. */
-#ifdef FLOW_CACHE_STATS
-      m_lookups += (flow_index - line_index + 1);
-      m_lookups2 += (flow_index - line_index + 1) * (flow_index - line_index + 1);
-#endif /* FLOW_CACHE_STATS */
+/**
+ * \brief Prefetch tags and record pointers of a flow line.
+ */
+void NHTFlowCache::prefetch_line(uint64_t hashval) const
+{
+   const FlowTable *table = get_shard(hashval)->get_table(hashval);
+   uint32_t line_index = hashval & table->m_line_mask;
+   __builtin_prefetch(table->m_flow_tags + line_index);
+   __builtin_prefetch(table->m_flow_table + line_index);
+}
 
-      flow = m_flow_table[flow_index];
-      for (decltype(flow_index) j = flow_index; j > line_index; j--) {
-         m_flow_table[j] = m_flow_table[j - 1];
+/**
+ * \brief Prefetch the first record of a flow line with matching tag, line must be already prefetched.
+ */
+void NHTFlowCache::prefetch_flow(uint64_t hashval) const
+{
+   const FlowTable *table = get_shard(hashval)->get_table(hashval);
+   uint32_t line_index = hashval & table->m_line_mask;
+   uint32_t mask = match_tags(table->m_flow_tags + line_index, flow_tag(hashval)) & m_tag_mask;
+   if (mask) {
+      __builtin_prefetch(table->m_flow_table[line_index + __builtin_ctz(mask) / 2], 1);
+   }
+}
+
+/**
+ * \brief Put packet with already computed flow hash into its shard, shared shard is locked meanwhile.
+ */
+int NHTFlowCache::put_table_pkt(Packet &pkt, uint64_t hashval, bool swapped)
+{
+   // Timers of shards and partitions which receive no packets advance with the packet time too
+   if (pkt.ts.tv_sec != m_sweep_time) {
+      m_sweep_time = pkt.ts.tv_sec;
+      expire_shards(pkt.ts.tv_sec, false);
+   }
+
+   m_shard = get_shard(hashval);
+   if (!m_shared) {
+      resize_step(pkt.ts.tv_sec);
+      if (m_shard->m_staging != nullptr) {
+         expire_staging(pkt.ts.tv_sec);
       }
+      m_table = m_shard->get_table(hashval);
+      return put_hashed_pkt(pkt, hashval, swapped);
+   }
+   std::lock_guard<std::mutex> guard(m_shard->m_lock);
+   resize_step(pkt.ts.tv_sec);
+   if (m_shard->m_staging != nullptr) {
+      expire_staging(pkt.ts.tv_sec);
+   }
+   m_table = m_shard->get_table(hashval);
+   return put_hashed_pkt(pkt, hashval, swapped);
+}
+
+/**
+ * \brief Put packet with already computed flow hash into the cache.
+ * \param [in] pkt Input parsed packet.
+ * \param [in] hashval Hash of the flow key.
+ * \param [in] swapped Flow key was created with swapped packet endpoints.
+ */
+int NHTFlowCache::put_hashed_pkt(Packet &pkt, uint64_t hashval, bool swapped)
+{
+   int ret;
+   FlowRecord *flow; /* Pointer to flow we will be working with. */
+   bool found = false;
+   bool source_flow = true;
+   uint16_t tag = flow_tag(hashval);
+   uint32_t line_index = hashval & m_table->m_line_mask; /* Get index of flow line. */
+   uint32_t next_line = line_index + m_line_size;
+
+   /* Find existing flow record in flow cache. */
+   uint32_t flow_index = find_flow(line_index, tag, hashval);
+   found = flow_index != next_line;
 
-      m_flow_table[line_index] = flow;
-      flow_index = line_index;
-#ifdef FLOW_CACHE_STATS
-      m_hits++;
-#endif /* FLOW_CACHE_STATS */
+   if (found) {
+      /* Existing flow record was found, put flow record at the first index of flow line. */
+      m_stats.hits++;
+      m_stats.probe_depth[std::min<uint32_t>(31 - __builtin_clz(flow_index - line_index + 1), STORAGE_PROBE_DEPTHS - 1)]++;
+
+      /* Packet direction is given by the key order of the packet which created the flow. */
+      source_flow = m_table->m_flow_table[flow_index]->m_swapped == swapped;
+      flow_index = m_policy->hit(*m_table, line_index, flow_index);
    } else {
-      /* Existing flow record was not found. Find free place in flow line. */
-      for (flow_index = line_index; flow_index < next_line; flow_index++) {
-         if (m_flow_table[flow_index]->is_empty()) {
-            found = true;
-            break;
+      if (m_shard->m_staging != nullptr) {
+         StagedFlow *staged = m_shard->m_staging->find(hashval);
+         if (staged != nullptr) {
+            // Second packet proves the flow, the packet is processed as an update of the promoted flow
+            promote_flow(*staged, hashval);
+            return put_hashed_pkt(pkt, hashval, swapped);
          }
-      }
-      if (!found) {
-         /* If free place was not found (flow line is full), find
-          * record which will be replaced by new record. */
-         flow_index = next_line - 1;
-
-         // Export flow
-         plugins_pre_export(m_flow_table[flow_index]->m_flow);
-         m_flow_table[flow_index]->m_flow.end_reason = FLOW_END_NO_RES;
-         export_flow(flow_index);
-
-#ifdef FLOW_CACHE_STATS
-         m_expired++;
-#endif /* FLOW_CACHE_STATS */
-         uint32_t flow_new_index = line_index + m_line_new_idx;
-         flow = m_flow_table[flow_index];
-         for (decltype(flow_index) j = flow_index; j > flow_new_index; j--) {
-            m_flow_table[j] = m_flow_table[j - 1];
+         if (pkt.payload_len_wire == 0) {
+            // Flows of the table expire even when nearly all packets are staged, e.g. during a SYN flood
+            stage_flow(pkt, hashval, swapped);
+            expire_table(pkt.ts.tv_sec);
+            return 0;
          }
-         flow_index = flow_new_index;
-         m_flow_table[flow_new_index] = flow;
-#ifdef FLOW_CACHE_STATS
-         m_not_empty++;
-      } else {
-         m_empty++;
-#endif /* FLOW_CACHE_STATS */
       }
+      /* Existing flow record was not found. Find free place in flow line. */
+      flow_index = get_free_flow(line_index, tag);
    }
 
    pkt.source_pkt = source_flow;
-   flow = m_flow_table[flow_index];
+   flow = m_table->m_flow_table[flow_index];
 
-   uint8_t flw_flags = source_flow ? flow->m_flow.src_tcp_flags : flow->m_flow.dst_tcp_flags;
+   uint8_t flw_flags = source_flow ? flow->m_src_tcp_flags : flow->m_dst_tcp_flags;
    if ((pkt.tcp_flags & 0x02) && (flw_flags & (0x01 | 0x04))) {
       // Flows with FIN or RST TCP flags are exported when new SYN packet arrives
-      m_flow_table[flow_index]->m_flow.end_reason = FLOW_END_EOF;
-      export_flow(flow_index);
-      put_pkt(pkt);
+      export_flow(flow_index, FLOW_END_EOF);
+      put_hashed_pkt(pkt, hashval, swapped);
       return 0;
    }
 
    if (flow->is_empty()) {
-      flow->create(pkt, hashval);
-      ret = plugins_post_create(flow->m_flow, pkt);
-
-      if (ret & FLOW_FLUSH) {
-         export_flow(flow_index);
-#ifdef FLOW_CACHE_STATS
-         m_flushed++;
-#endif /* FLOW_CACHE_STATS */
-      }
+      create_flow(flow_index, pkt, hashval, swapped, tag);
    } else {
       /* Check if flow record is expired (inactive timeout). */
-      if (pkt.ts.tv_sec - flow->m_flow.time_last.tv_sec >= m_inactive) {
-         m_flow_table[flow_index]->m_flow.end_reason = get_export_reason(flow->m_flow);
-         plugins_pre_export(flow->m_flow);
-         export_flow(flow_index);
-   #ifdef FLOW_CACHE_STATS
-         m_expired++;
-   #endif /* FLOW_CACHE_STATS */
-         return put_pkt(pkt);
+      if (pkt.ts.tv_sec - flow->m_time_last.tv_sec >= m_inactive) {
+         call_pre_export(get_plugin_flow(flow));
+         export_flow(flow_index, get_export_reason(*flow));
+         return put_hashed_pkt(pkt, hashval, swapped);
       }
 
       /* Check if flow record is expired (active timeout). */
-      if (pkt.ts.tv_sec - flow->m_flow.time_first.tv_sec >= m_active) {
-         m_flow_table[flow_index]->m_flow.end_reason = FLOW_END_ACTIVE;
-         plugins_pre_export(flow->m_flow);
-         export_flow(flow_index);
-#ifdef FLOW_CACHE_STATS
-         m_expired++;
-#endif /* FLOW_CACHE_STATS */
-         return put_pkt(pkt);
+      if (pkt.ts.tv_sec - flow->m_time_first >= m_active) {
+         call_pre_export(get_plugin_flow(flow));
+         export_flow(flow_index, FLOW_END_ACTIVE);
+         return put_hashed_pkt(pkt, hashval, swapped);
       }
 
-      ret = plugins_pre_update(flow->m_flow, pkt);
+      ret = call_pre_update(get_plugin_flow(flow), pkt);
       if (ret & FLOW_FLUSH) {
          flush(pkt, flow_index, ret, source_flow);
          return 0;
       } else {
          flow->update(pkt, source_flow);
-         ret = plugins_post_update(flow->m_flow, pkt);
+         if (flow->m_sample_level < m_sampler.get_level()) {
+            flow->m_sample_level = m_sampler.get_level();
+         }
+         ret = call_post_update(get_plugin_flow(flow), pkt);
 
          if (ret & FLOW_FLUSH) {
             flush(pkt, flow_index, ret, source_flow);
@@ -450,13 +1656,13 @@ int NHTFlowCache::put_pkt(Packet &pkt)
       }
    }
 
-   export_expired(pkt.ts.tv_sec);
+   expire_table(pkt.ts.tv_sec);
    return 0;
 }
 
-uint8_t NHTFlowCache::get_export_reason(Flow &flow)
+uint8_t NHTFlowCache::get_export_reason(const FlowRecord &flow)
 {
-   if ((flow.src_tcp_flags | flow.dst_tcp_flags) & (0x01 | 0x04)) {
+   if ((flow.m_src_tcp_flags | flow.m_dst_tcp_flags) & (0x01 | 0x04)) {
       // When FIN or RST is set, TCP connection ended naturally
       return FLOW_END_EOF;
    } else {
@@ -464,65 +1670,188 @@ uint8_t NHTFlowCache::get_export_reason(Flow &flow)
    }
 }
 
+/**
+ * \brief Schedule expiration timer of a record at its earliest possible timeout.
+ *
+ * Timers are not moved when a record is updated, the real deadline is checked when the timer fires.
+ */
+void NHTFlowCache::schedule_flow(FlowRecord *flow)
+{
+   m_table->m_timers.schedule(m_table->get_cold(flow), flow->m_time_last.tv_sec + std::min(m_active, m_inactive));
+}
+
+void NHTFlowCache::expire_flow(FlowRecord *flow, time_t ts)
+{
+   time_t inactive_deadline = flow->m_time_last.tv_sec + m_inactive;
+   time_t active_deadline = flow->m_time_first + m_active;
+   uint8_t reason;
+
+   if (ts >= inactive_deadline) {
+      reason = get_export_reason(*flow);
+   } else if (ts >= active_deadline) {
+      reason = FLOW_END_ACTIVE;
+   } else {
+      m_table->m_timers.schedule(m_table->get_cold(flow), std::min(inactive_deadline, active_deadline));
+      return;
+   }
+
+   uint64_t hash = flow->get_hash();
+   uint32_t flow_index = find_flow(hash & m_table->m_line_mask, flow_tag(hash), hash);
+   call_pre_export(get_plugin_flow(flow));
+   export_flow(flow_index, reason);
+}
+
 void NHTFlowCache::export_expired(time_t ts)
 {
-   for (decltype(m_timeout_idx) i = m_timeout_idx; i < m_timeout_idx + m_line_new_idx; i++) {
-      if (!m_flow_table[i]->is_empty() && ts - m_flow_table[i]->m_flow.time_last.tv_sec >= m_inactive) {
-         m_flow_table[i]->m_flow.end_reason = get_export_reason(m_flow_table[i]->m_flow);
-         plugins_pre_export(m_flow_table[i]->m_flow);
-         export_flow(i);
-#ifdef FLOW_CACHE_STATS
-         m_expired++;
-#endif /* FLOW_CACHE_STATS */
+   expire_shards(ts, true);
+   if (!m_shared) {
+      flush_export();
+   }
+}
+
+/**
+ * \brief Export expired flows of all shards, not only of those which receive packets.
+ * \param [in] ts Current time.
+ * \param [in] idle Input is idle, so resize of the shards is continued meanwhile.
+ */
+void NHTFlowCache::expire_shards(time_t ts, bool idle)
+{
+   if (!m_shared) {
+      for (uint32_t i = 0; i < m_shard_cnt; i++) {
+         m_shard = &m_shards[i];
+         expire_shard(ts, idle);
+      }
+      return;
+   }
+   for (uint32_t i = 0; i < m_shard_cnt; i++) {
+      // Shards used by other inputs are skipped, they are expired by their packets
+      std::unique_lock<std::mutex> guard(m_shards[i].m_lock, std::try_to_lock);
+      if (guard.owns_lock()) {
+         m_shard = &m_shards[i];
+         expire_shard(ts, idle);
       }
    }
+}
+
+/**
+ * \brief Export expired flows of the current shard.
+ */
+void NHTFlowCache::expire_shard(time_t ts, bool idle)
+{
+   if (m_shard->m_table == nullptr) {
+      return;
+   }
+   for (uint32_t i = 0; idle && i < RESIZE_IDLE_STEPS; i++) {
+      resize_step(ts);
+   }
+   if (m_shard->m_staging != nullptr) {
+      expire_staging(ts);
+   }
+   m_table = m_shard->m_table;
+   expire_table(ts);
+   if (m_shard->m_next != nullptr) {
+      m_table = m_shard->m_next;
+      expire_table(ts);
+   }
+}
+
+/**
+ * \brief Export expired flows of the current table.
+ */
+void NHTFlowCache::expire_table(time_t ts)
+{
+   m_table->m_timers.advance(ts, [this, ts](TimerNode *node) {
+      expire_flow(m_table->get_hot(static_cast<ColdFlowRecord *>(node)), ts);
+   });
+}
 
-   m_timeout_idx = (m_timeout_idx + m_line_new_idx) & (m_cache_size - 1);
+void NHTFlowCache::set_input_drops(uint64_t dropped)
+{
+   m_sampler.set_input_drops(dropped);
+}
+
+/**
+ * \brief Get counters of the cache, shared caches report flows of all the shared shards.
+ */
+StorageStats NHTFlowCache::get_stats() const
+{
+   StorageStats stats = m_stats;
+   ExtensionAllocStats ext_stats = get_extension_alloc_stats();
+   stats.sample_rate = m_sampler.get_packet_rate();
+   stats.ext_allocated = ext_stats.allocated;
+   stats.ext_reused = ext_stats.reused;
+   stats.flows = 0;
+   stats.capacity = 0;
+   if (m_shards != nullptr) {
+      for (uint32_t i = 0; i < m_shard_cnt; i++) {
+         stats.flows += m_shards[i].m_flows.load(std::memory_order_relaxed);
+         stats.capacity += m_shards[i].m_capacity.load(std::memory_order_relaxed);
+      }
+   }
+   stats.partitions = m_partition_cnt;
+   for (uint32_t i = 0; i < m_partition_cnt && i < STORAGE_PARTITIONS; i++) {
+      stats.partition_flows[i] = 0;
+      stats.partition_capacity[i] = 0;
+      stats.partition_evictions[i] = 0;
+      for (uint32_t j = i * m_hash_shards; m_shards != nullptr && j < (i + 1) * m_hash_shards; j++) {
+         stats.partition_flows[i] += m_shards[j].m_flows.load(std::memory_order_relaxed);
+         stats.partition_capacity[i] += m_shards[j].m_capacity.load(std::memory_order_relaxed);
+         stats.partition_evictions[i] += m_shards[j].m_evictions.load(std::memory_order_relaxed);
+      }
+   }
+   return stats;
 }
 
 bool NHTFlowCache::create_hash_key(Packet &pkt)
 {
    if (pkt.ip_version == IP::v4) {
       struct flow_key_v4_t *key_v4 = reinterpret_cast<struct flow_key_v4_t *>(m_key);
-      struct flow_key_v4_t *key_v4_inv = reinterpret_cast<struct flow_key_v4_t *>(m_key_inv);
+
+      /* Biflow key is stored with the lower endpoint as a source. */
+      m_key_swapped = !m_split_biflow &&
+         (pkt.src_ip.v4 > pkt.dst_ip.v4 || (pkt.src_ip.v4 == pkt.dst_ip.v4 && pkt.src_port > pkt.dst_port));
 
       key_v4->proto = pkt.ip_proto;
       key_v4->ip_version = IP::v4;
-      key_v4->src_port = pkt.src_port;
-      key_v4->dst_port = pkt.dst_port;
-      key_v4->src_ip = pkt.src_ip.v4;
-      key_v4->dst_ip = pkt.dst_ip.v4;
       key_v4->vlan_id = pkt.vlan_id;
-
-      key_v4_inv->proto = pkt.ip_proto;
-      key_v4_inv->ip_version = IP::v4;
-      key_v4_inv->src_port = pkt.dst_port;
-      key_v4_inv->dst_port = pkt.src_port;
-      key_v4_inv->src_ip = pkt.dst_ip.v4;
-      key_v4_inv->dst_ip = pkt.src_ip.v4;
-      key_v4_inv->vlan_id = pkt.vlan_id;
+      if (m_key_swapped) {
+         key_v4->src_port = pkt.dst_port;
+         key_v4->dst_port = pkt.src_port;
+         key_v4->src_ip = pkt.dst_ip.v4;
+         key_v4->dst_ip = pkt.src_ip.v4;
+      } else {
+         key_v4->src_port = pkt.src_port;
+         key_v4->dst_port = pkt.dst_port;
+         key_v4->src_ip = pkt.src_ip.v4;
+         key_v4->dst_ip = pkt.dst_ip.v4;
+      }
 
       m_keylen = sizeof(flow_key_v4_t);
       return true;
    } else if (pkt.ip_version == IP::v6) {
       struct flow_key_v6_t *key_v6 = reinterpret_cast<struct flow_key_v6_t *>(m_key);
-      struct flow_key_v6_t *key_v6_inv = reinterpret_cast<struct flow_key_v6_t *>(m_key_inv);
+
+      if (m_split_biflow) {
+         m_key_swapped = false;
+      } else {
+         int cmp = memcmp(pkt.src_ip.v6, pkt.dst_ip.v6, sizeof(pkt.src_ip.v6));
+         m_key_swapped = cmp > 0 || (cmp == 0 && pkt.src_port > pkt.dst_port);
+      }
 
       key_v6->proto = pkt.ip_proto;
       key_v6->ip_version = IP::v6;
-      key_v6->src_port = pkt.src_port;
-      key_v6->dst_port = pkt.dst_port;
-      memcpy(key_v6->src_ip, pkt.src_ip.v6, sizeof(pkt.src_ip.v6));
-      memcpy(key_v6->dst_ip, pkt.dst_ip.v6, sizeof(pkt.dst_ip.v6));
       key_v6->vlan_id = pkt.vlan_id;
-
-      key_v6_inv->proto = pkt.ip_proto;
-      key_v6_inv->ip_version = IP::v6;
-      key_v6_inv->src_port = pkt.dst_port;
-      key_v6_inv->dst_port = pkt.src_port;
-      memcpy(key_v6_inv->src_ip, pkt.dst_ip.v6, sizeof(pkt.dst_ip.v6));
-      memcpy(key_v6_inv->dst_ip, pkt.src_ip.v6, sizeof(pkt.src_ip.v6));
-      key_v6_inv->vlan_id = pkt.vlan_id;
+      if (m_key_swapped) {
+         key_v6->src_port = pkt.dst_port;
+         key_v6->dst_port = pkt.src_port;
+         memcpy(key_v6->src_ip, pkt.dst_ip.v6, sizeof(pkt.dst_ip.v6));
+         memcpy(key_v6->dst_ip, pkt.src_ip.v6, sizeof(pkt.src_ip.v6));
+      } else {
+         key_v6->src_port = pkt.src_port;
+         key_v6->dst_port = pkt.dst_port;
+         memcpy(key_v6->src_ip, pkt.src_ip.v6, sizeof(pkt.src_ip.v6));
+         memcpy(key_v6->dst_ip, pkt.dst_ip.v6, sizeof(pkt.dst_ip.v6));
+      }
 
       m_keylen = sizeof(flow_key_v6_t);
       return true;
@@ -531,19 +1860,4 @@ bool NHTFlowCache::create_hash_key(Packet &pkt)
    return false;
 }
 
-#ifdef FLOW_CACHE_STATS
-void NHTFlowCache::print_report()
-{
-   float tmp = float(m_lookups) / m_hits;
-
-   cout << "Hits: " << m_hits << endl;
-   cout << "Empty: " << m_empty << endl;
-   cout << "Not empty: " << m_not_empty << endl;
-   cout << "Expired: " << m_expired << endl;
-   cout << "Flushed: " << m_flushed << endl;
-   cout << "Average Lookup:  " << tmp << endl;
-   cout << "Variance Lookup: " << float(m_lookups2) / m_hits - tmp * tmp << endl;
-}
-#endif /* FLOW_CACHE_STATS */
-
 }
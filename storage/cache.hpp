@@ -32,13 +32,27 @@
 #ifndef IPXP_STORAGE_CACHE_HPP
 #define IPXP_STORAGE_CACHE_HPP
 
+#include <algorithm>
+#include <atomic>
+#include <mutex>
 #include <string>
+#include <vector>
 
 #include <ipfixprobe/storage.hpp>
 #include <ipfixprobe/options.hpp>
 #include <ipfixprobe/flowifc.hpp>
 #include <ipfixprobe/utils.hpp>
 
+#include "timerwheel.hpp"
+#include "hugemem.hpp"
+#include "policy.hpp"
+#include "sampling.hpp"
+#include "staging.hpp"
+
+#ifdef WITH_STATIC_PLUGINS
+#include "storage/static-plugins.hpp"
+#endif
+
 namespace ipxp {
 
 struct __attribute__((packed)) flow_key_v4_t {
@@ -75,6 +89,18 @@ static const uint32_t DEFAULT_FLOW_LINE_SIZE = IPXP_FLOW_LINE_SIZE;
 static const uint32_t DEFAULT_FLOW_LINE_SIZE = 4; // 16 records per line
 #endif /* IPXP_FLOW_LINE_SIZE */
 
+static const uint32_t DEFAULT_FLOW_CACHE_SHARDS = 4; // 16 shards of a shared cache
+static const uint32_t MAX_FLOW_CACHE_SHARDS = 1 << 16; /**< Shard index is stored in 16 bits of the flow hash. */
+static const uint32_t VLAN_COUNT = 4096;
+
+static const uint32_t RESIZE_INTERVAL = 10; /**< Seconds over which evictions are counted for automatic resize. */
+static const uint32_t RESIZE_STEP_RECORDS = 32; /**< Records constructed or destroyed per packet during resize. */
+static const uint32_t RESIZE_IDLE_STEPS = 64; /**< Resize steps done when input is idle. */
+static const uint32_t EXPORT_BATCH = 64; /**< Exported flows pushed to the output queue at once. */
+static const uint32_t MIN_SHARD_EXPORT_RECORDS = 256; /**< Records of a shard table for export when the budget is split among many shards. */
+
+static const int NUMA_NODE_AUTO = -2; /**< Bind flow table to NUMA node of the storage thread. */
+
 static const uint32_t DEFAULT_INACTIVE_TIMEOUT = 30;
 static const uint32_t DEFAULT_ACTIVE_TIMEOUT = 300;
 
@@ -85,6 +111,14 @@ static_assert(bitcount<decltype(DEFAULT_FLOW_LINE_SIZE)>(-1) > DEFAULT_FLOW_LINE
 static_assert(DEFAULT_FLOW_LINE_SIZE >= 1, "Flow cache line size must be at least 1!");
 static_assert(DEFAULT_FLOW_CACHE_SIZE >= DEFAULT_FLOW_LINE_SIZE, "Flow cache size must be at least cache line size!");
 
+/**
+ * \brief Part of the cache reserved for flows of given VLANs.
+ */
+struct CachePartition {
+   std::vector<uint16_t> m_vlans;
+   uint32_t m_size;
+};
+
 class CacheOptParser : public OptionsParser
 {
 public:
@@ -93,10 +127,29 @@ public:
    uint32_t m_active;
    uint32_t m_inactive;
    bool m_split_biflow;
+   size_t m_hugepage_size;
+   int m_numa_node;
+   bool m_prefault;
+   bool m_shared;
+   uint32_t m_shards;
+   uint32_t m_resize_evictions;
+   uint32_t m_max_size;
+   std::string m_policy;
+   std::string m_snapshot;
+   uint32_t m_sample_rate;
+   uint32_t m_flow_sample_rate;
+   uint32_t m_adaptive_rate;
+   uint32_t m_staging_size;
+   std::vector<CachePartition> m_partitions;
+   uint32_t m_export_records;
 
    CacheOptParser() : OptionsParser("cache", "Storage plugin implemented as a hash table"),
       m_cache_size(1 << DEFAULT_FLOW_CACHE_SIZE), m_line_size(1 << DEFAULT_FLOW_LINE_SIZE),
-      m_active(DEFAULT_ACTIVE_TIMEOUT), m_inactive(DEFAULT_INACTIVE_TIMEOUT), m_split_biflow(false)
+      m_active(DEFAULT_ACTIVE_TIMEOUT), m_inactive(DEFAULT_INACTIVE_TIMEOUT), m_split_biflow(false),
+      m_hugepage_size(0), m_numa_node(NUMA_NODE_ANY), m_prefault(false), m_shared(false),
+      m_shards(1 << DEFAULT_FLOW_CACHE_SHARDS), m_resize_evictions(0), m_max_size(0), m_policy("lru"), m_snapshot(""),
+      m_sample_rate(1), m_flow_sample_rate(1), m_adaptive_rate(0), m_staging_size(0),
+      m_export_records(0)
    {
       register_option("s", "size", "EXPONENT", "Cache size exponent to the power of two",
          [this](const char *arg){try {unsigned exp = str2num<decltype(exp)>(arg);
@@ -121,28 +174,286 @@ public:
          OptionFlags::RequiredArgument);
       register_option("S", "split", "", "Split biflows into uniflows",
          [this](const char *arg){ m_split_biflow = true; return true;}, OptionFlags::NoArgument);
+      register_option("H", "hugepages", "SIZE", "Back flow table with hugepages of given size (2M or 1G), transparent hugepages are used when they are not available",
+         [this](const char *arg){std::string size = arg;
+               if (size == "2M" || size == "2m") {
+                  m_hugepage_size = static_cast<size_t>(1) << 21;
+               } else if (size == "1G" || size == "1g") {
+                  m_hugepage_size = static_cast<size_t>(1) << 30;
+               } else {
+                  throw PluginError("Hugepage size must be 2M or 1G");
+               }
+               return true;},
+         OptionFlags::RequiredArgument);
+      register_option("n", "numa", "NODE", "Bind flow table to NUMA node, auto selects node of the thread processing packets",
+         [this](const char *arg){if (std::string(arg) == "auto") {
+                  m_numa_node = NUMA_NODE_AUTO;
+                  return true;
+               }
+               try {m_numa_node = str2num<decltype(m_numa_node)>(arg);
+               if (m_numa_node < 0) {
+                  throw PluginError("NUMA node must not be negative");
+               }
+            } catch(std::invalid_argument &e) {return false;} return true;},
+         OptionFlags::RequiredArgument);
+      register_option("P", "prefault", "", "Fault in flow table memory before processing packets",
+         [this](const char *arg){ m_prefault = true; return true;}, OptionFlags::NoArgument);
+      register_option("c", "shared", "", "Share one cache by all inputs, so biflows are paired across links",
+         [this](const char *arg){ m_shared = true; return true;}, OptionFlags::NoArgument);
+      register_option("k", "shards", "EXPONENT", "Number of independently locked parts of the shared cache, exponent to the power of two",
+         [this](const char *arg){try {unsigned exp = str2num<decltype(exp)>(arg);
+               if (exp > 16) {
+                  throw PluginError("Number of flow cache shards must be between 0 and 16");
+               }
+               m_shards = static_cast<uint32_t>(1) << exp;
+            } catch(std::invalid_argument &e) {return false;} return true;},
+         OptionFlags::RequiredArgument);
+      register_option("R", "resize", "RATE", "Grow the cache online when more than RATE flows per second are evicted, shrink it back when it is mostly empty",
+         [this](const char *arg){try {m_resize_evictions = str2num<decltype(m_resize_evictions)>(arg);} catch(std::invalid_argument &e) {return false;} return true;},
+         OptionFlags::RequiredArgument);
+      register_option("M", "max-size", "EXPONENT", "Maximal cache size exponent for online resize, 4 times the cache size by default",
+         [this](const char *arg){try {unsigned exp = str2num<decltype(exp)>(arg);
+               if (exp < 4 || exp > 30) {
+                  throw PluginError("Flow cache size must be between 4 and 30");
+               }
+               m_max_size = static_cast<uint32_t>(1) << exp;
+            } catch(std::invalid_argument &e) {return false;} return true;},
+         OptionFlags::RequiredArgument);
+      register_option("p", "policy", "NAME", "Replacement policy of cache lines: lru (default), clock or s3fifo",
+         [this](const char *arg){m_policy = arg;
+               if (m_policy != "lru" && m_policy != "clock" && m_policy != "s3fifo") {
+                  throw PluginError("Replacement policy must be lru, clock or s3fifo");
+               }
+               return true;},
+         OptionFlags::RequiredArgument);
+      register_option("w", "snapshot", "FILE", "Save flows into FILE instead of exporting them when the cache finishes and restore them on start, caches of further inputs use FILE.1, FILE.2 and so on",
+         [this](const char *arg){m_snapshot = arg; return true;}, OptionFlags::RequiredArgument);
+      register_option("r", "sample", "RATE", "Process 1 out of RATE packets, the rest is skipped before the cache lookup",
+         [this](const char *arg){try {m_sample_rate = str2num<decltype(m_sample_rate)>(arg);
+               if (m_sample_rate == 0) {
+                  throw PluginError("Packet sampling rate must be at least 1");
+               }
+            } catch(std::invalid_argument &e) {return false;} return true;},
+         OptionFlags::RequiredArgument);
+      register_option("f", "flow-sample", "RATE", "Process packets of 1 out of RATE flows selected by the flow hash",
+         [this](const char *arg){try {m_flow_sample_rate = str2num<decltype(m_flow_sample_rate)>(arg);
+               if (m_flow_sample_rate == 0) {
+                  throw PluginError("Flow sampling rate must be at least 1");
+               }
+            } catch(std::invalid_argument &e) {return false;} return true;},
+         OptionFlags::RequiredArgument);
+      register_option("A", "adaptive", "RATE", "Double the packet sampling rate each second in which the input drops packets, up to 1 out of RATE packets",
+         [this](const char *arg){try {m_adaptive_rate = str2num<decltype(m_adaptive_rate)>(arg);} catch(std::invalid_argument &e) {return false;} return true;},
+         OptionFlags::RequiredArgument);
+      register_option("g", "staging", "EXPONENT", "Keep flows with a single packet without payload in a staging table of given size exponent until their second packet arrives",
+         [this](const char *arg){try {unsigned exp = str2num<decltype(exp)>(arg);
+               if (exp < 4 || exp > 24) {
+                  throw PluginError("Staging table size must be between 4 and 24");
+               }
+               m_staging_size = static_cast<uint32_t>(1) << exp;
+            } catch(std::invalid_argument &e) {return false;} return true;},
+         OptionFlags::RequiredArgument);
+      register_option("V", "partition", "VLANS:EXPONENT", "Keep flows of comma separated VLANs in a separate part of the cache with given size exponent, so they are not evicted by flows of other VLANs, may be repeated",
+         [this](const char *arg){std::string str = arg;
+               size_t colon = str.find(':');
+               if (colon == std::string::npos) {
+                  return false;
+               }
+               if (m_partitions.size() + 1 >= STORAGE_PARTITIONS) {
+                  throw PluginError("Too many flow cache partitions");
+               }
+               CachePartition partition;
+               try {unsigned exp = str2num<decltype(exp)>(str.substr(colon + 1));
+                  if (exp < 4 || exp > 30) {
+                     throw PluginError("Flow cache partition size must be between 4 and 30");
+                  }
+                  partition.m_size = static_cast<uint32_t>(1) << exp;
+                  size_t begin = 0;
+                  while (begin < colon) {
+                     size_t end = std::min(str.find(',', begin), colon);
+                     unsigned vlan = str2num<decltype(vlan)>(str.substr(begin, end - begin));
+                     if (vlan >= VLAN_COUNT) {
+                        throw PluginError("VLAN must be between 0 and 4095");
+                     }
+                     partition.m_vlans.push_back(vlan);
+                     begin = end + 1;
+                  }
+               } catch(std::invalid_argument &e) {return false;}
+               if (partition.m_vlans.empty()) {
+                  return false;
+               }
+               m_partitions.push_back(partition);
+               return true;},
+         OptionFlags::RequiredArgument);
+      register_option("e", "export-records", "NUM", "Number of records which can wait for export, split among shards and partitions of the cache, a shard waits for the output when all of its records are exported, defaults to the output queue size",
+         [this](const char *arg){try {m_export_records = str2num<decltype(m_export_records)>(arg);
+               if (m_export_records == 0) {
+                  throw PluginError("Number of export records must be at least 1");
+               }
+            } catch(std::invalid_argument &e) {return false;} return true;},
+         OptionFlags::RequiredArgument);
    }
 };
 
-class FlowRecord
+/**
+ * \brief Hot part of a flow record, everything accessed by packets of an already existing flow.
+ *
+ * Record is trivially copyable and fits a single cache line. Export data and extensions
+ * of the flow are stored in ColdFlowRecord and are synced from this record only when
+ * they are passed to plugins or exported.
+ */
+class __attribute__((aligned(64))) FlowRecord
 {
    uint64_t m_hash;
 
 public:
-   Flow m_flow;
-
-   FlowRecord();
-   ~FlowRecord();
+   struct timeval m_time_last;
+   time_t m_time_first; /**< Seconds of the first packet, used for the active timeout. */
+   uint64_t m_src_bytes;
+   uint64_t m_dst_bytes;
+   uint32_t m_src_packets;
+   uint32_t m_dst_packets;
+   uint8_t m_src_tcp_flags;
+   uint8_t m_dst_tcp_flags;
+   bool m_swapped; /**< Key of the packet which created the flow was swapped to the canonical order. */
+   uint8_t m_sample_level; /**< Highest adaptive sampling level of packets of the flow. */
 
    void erase();
    void reuse();
 
    inline bool is_empty() const;
    inline bool belongs(uint64_t pkt_hash) const;
-   void create(const Packet &pkt, uint64_t pkt_hash);
+   inline uint64_t get_hash() const;
+   void create(const Packet &pkt, uint64_t pkt_hash, bool swapped);
    void update(const Packet &pkt, bool src);
 };
 
+static_assert(sizeof(FlowRecord) == 64, "Hot flow record must fit a single cache line!");
+
+/**
+ * \brief Cold part of a flow record, flow data exported to output plugins together with extensions.
+ */
+struct ColdFlowRecord : public TimerNode {
+   Flow m_flow;
+
+   ColdFlowRecord();
+
+   void erase();
+   void create(const Packet &pkt);
+   void sync(const FlowRecord &flow);
+};
+
+/**
+ * \brief Lookup key of a packet computed ahead of its processing.
+ */
+struct PacketHash {
+   uint64_t m_hash; /**< Flow hash, 0 when the packet has no flow key. */
+   bool m_swapped;
+};
+
+/**
+ * \brief Flow table with its records, spare records for export and expiration timers.
+ *
+ * Records are constructed separately from the allocation, so a table can be prepared
+ * and destroyed in small steps while packets are processed. Exported record is swapped
+ * with a spare record and becomes spare again when the output returns it.
+ */
+class FlowTable
+{
+public:
+   uint32_t m_size;
+   uint32_t m_qsize;
+   uint32_t m_spare; /**< Number of spare records, they are at the start of the spare part of m_flow_table. */
+   uint32_t m_line_mask;
+   FlowRecord **m_flow_table; /**< m_size records followed by m_qsize records for export, spare or exported. */
+   FlowRecord *m_flow_records;
+   ColdFlowRecord *m_flow_data; /**< Cold parts of m_flow_records with the same index. */
+   uint16_t *m_flow_tags; /**< Short hash tags of records in m_flow_table, 0 marks an empty record. */
+   uint8_t *m_flow_meta; /**< Replacement policy state of records in m_flow_table. */
+   FlowLineMeta *m_line_meta; /**< Replacement policy state of lines. */
+   TimerWheel m_timers; /**< Expiration timers of records in m_flow_table, linked through ColdFlowRecord. */
+   FlowReturnQueue *m_returns; /**< Exported records returned by the output. */
+
+   FlowTable();
+   ~FlowTable();
+   FlowTable(const FlowTable &) = delete;
+   FlowTable &operator=(const FlowTable &) = delete;
+
+   void allocate(uint32_t size, uint32_t line_size, uint32_t qsize, size_t hugepage_size, int numa_node, bool prefault, bool bind_required);
+   bool construct(size_t count);
+   bool destroy(size_t count);
+   void release();
+   uint32_t get_spare();
+   bool is_returned();
+
+   bool is_constructed() const
+   {
+      return m_flow_records != nullptr && m_constructed == static_cast<size_t>(m_size) + m_qsize;
+   }
+
+   ColdFlowRecord *get_cold(const FlowRecord *flow) const
+   {
+      return m_flow_data + (flow - m_flow_records);
+   }
+
+   FlowRecord *get_hot(const ColdFlowRecord *data) const
+   {
+      return m_flow_records + (data - m_flow_data);
+   }
+
+private:
+   size_t m_constructed; /**< Number of constructed records. */
+   HugeMemory m_table_mem;
+   HugeMemory m_records_mem;
+   HugeMemory m_data_mem;
+   HugeMemory m_tags_mem;
+   HugeMemory m_meta_mem;
+   HugeMemory m_lines_mem;
+};
+
+/**
+ * \brief Part of the cache selected by the flow hash.
+ *
+ * A cache has a single shard, a shared cache is split into several of them, each used only
+ * while its lock is held. Table of a shard is resized by moving its lines one by one
+ * into the next table, lines below m_cursor are already moved.
+ */
+struct FlowShard {
+   std::mutex m_lock;
+   FlowTable *m_table;
+   FlowTable *m_next; /**< Table being prepared or filled by resize, nullptr otherwise. */
+   FlowTable *m_retired; /**< Replaced table, destroyed when all its exported records are returned. */
+   StagingTable *m_staging; /**< Flows waiting for their second packet, nullptr when staging is disabled. */
+   uint32_t m_cursor;
+   time_t m_window_start; /**< Start of the interval in which m_window_evictions are counted. */
+   uint32_t m_window_evictions;
+   std::atomic<uint32_t> m_flows; /**< Number of flows, written only with the shard locked. */
+   std::atomic<uint32_t> m_capacity;
+   std::atomic<uint32_t> m_requested_size; /**< Table size requested by NHTFlowCache::resize(), 0 when none. */
+   std::atomic<uint64_t> m_evictions; /**< Number of evicted flows, written only with the shard locked. */
+   uint32_t m_min_size; /**< Automatic resize limits of the table. */
+   uint32_t m_max_size;
+
+   FlowShard();
+   ~FlowShard();
+   FlowShard(const FlowShard &) = delete;
+   FlowShard &operator=(const FlowShard &) = delete;
+
+   /**
+    * \brief Get table which holds the flow with given hash.
+    */
+   FlowTable *get_table(uint64_t hashval) const
+   {
+      if (m_next != nullptr && (hashval & m_table->m_line_mask) < m_cursor) {
+         return m_next;
+      }
+      return m_table;
+   }
+};
+
+class SnapshotWriter;
+struct SnapshotFlow;
+
 class NHTFlowCache : public StoragePlugin
 {
 public:
@@ -151,47 +462,106 @@ public:
    void init(const char *params);
    void close();
    void set_queue(ipx_ring_t *queue);
+   void thread_init();
    OptionsParser *get_parser() const { return new CacheOptParser(); }
    std::string get_name() const { return "cache"; }
 
    int put_pkt(Packet &pkt);
+   int put_pkts(PacketBlock &block);
    void export_expired(time_t ts);
+   StorageStats get_stats() const;
+   bool resize(uint32_t size);
+   void set_input_drops(uint64_t dropped);
 
 private:
    uint32_t m_cache_size;
    uint32_t m_line_size;
-   uint32_t m_line_mask;
-   uint32_t m_line_new_idx;
    uint32_t m_qsize;
-   uint32_t m_qidx;
-   uint32_t m_timeout_idx;
-#ifdef FLOW_CACHE_STATS
-   uint64_t m_empty;
-   uint64_t m_not_empty;
-   uint64_t m_hits;
-   uint64_t m_expired;
-   uint64_t m_flushed;
-   uint64_t m_lookups;
-   uint64_t m_lookups2;
-#endif /* FLOW_CACHE_STATS */
+   StorageStats m_stats;
    uint32_t m_active;
    uint32_t m_inactive;
    bool m_split_biflow;
    uint8_t m_keylen;
+   bool m_key_swapped;
    char m_key[MAX_KEY_LENGTH];
-   char m_key_inv[MAX_KEY_LENGTH];
-   FlowRecord **m_flow_table;
-   FlowRecord *m_flow_records;
+   uint32_t m_tag_mask;
+   size_t m_hugepage_size;
+   int m_numa_node;
+   bool m_prefault;
+   uint32_t m_resize_evictions;
+   uint32_t m_min_shard_size; /**< Automatic resize limits of a shard table of the default partition. */
+   uint32_t m_max_shard_size;
+   bool m_shared; /**< Shards are shared with caches of other inputs. */
+   bool m_running; /**< Cache is attached to the shared shards and did not finish yet. */
+   FlowShard *m_shards; /**< Shards of all partitions, selected by the flow hash. */
+   uint32_t m_shard_cnt;
+   uint32_t m_shard_mask; /**< Mask of the shard index stored in the flow hash. */
+   uint32_t m_hash_shards; /**< Number of shards of a partition. */
+   uint32_t m_partition_cnt;
+   std::vector<uint32_t> m_partition_sizes; /**< Shard table size of each partition. */
+   std::vector<uint8_t> m_vlan_partition; /**< Partition of each VLAN. */
+   FlowShard *m_shard; /**< Shard of the flow being processed. */
+   FlowTable *m_table; /**< Table of the flow being processed. */
+   time_t m_sweep_time; /**< Second of packet time in which all shards were checked for expired flows. */
+   ReplacementPolicy *m_policy;
+   std::string m_snapshot_path; /**< Snapshot of the flows, empty when disabled. */
+   uint32_t m_staging_size; /**< Size of the staging table of a shard, 0 when disabled. */
+   FlowSampler m_sampler;
+   std::vector<PacketHash> m_block_hashes;
+   Flow *m_export_batch[EXPORT_BATCH]; /**< Exported flows not pushed to the output queue yet. */
+   uint32_t m_export_cnt;
+#ifdef WITH_STATIC_PLUGINS
+   StaticPlugins m_static_plugins; /**< Plugins compiled into the cache, used when they match the added plugins. */
+#endif
+
+   uint32_t find_flow(uint32_t line_index, uint16_t tag, uint64_t hash) const;
+   void attach_shared(const CacheOptParser &parser);
+   void allocate_tables(int numa_node);
+   void resize_step(time_t now);
+   uint32_t get_resize_size(time_t now);
+   void migrate_line();
 
+   inline FlowShard *get_shard(uint64_t hashval) const;
+   inline uint64_t partition_hash(const Packet &pkt, uint64_t hashval) const;
+   int put_table_pkt(Packet &pkt, uint64_t hashval, bool swapped);
+   int put_hashed_pkt(Packet &pkt, uint64_t hashval, bool swapped);
+   void prefetch_line(uint64_t hashval) const;
+   void prefetch_flow(uint64_t hashval) const;
    void flush(Packet &pkt, size_t flow_index, int ret, bool source_flow);
    bool create_hash_key(Packet &pkt);
-   void export_flow(size_t index);
-   static uint8_t get_export_reason(Flow &flow);
+   uint32_t get_free_flow(uint32_t line_index, uint16_t tag);
+   void create_flow(uint32_t flow_index, Packet &pkt, uint64_t hashval, bool swapped, uint16_t tag);
+   void stage_flow(Packet &pkt, uint64_t hashval, bool swapped);
+   void promote_flow(StagedFlow &staged, uint64_t hashval);
+   void export_staged(StagedFlow &staged, uint8_t reason);
+   void expire_staging(time_t ts);
+   void flush_staging();
+   void export_flow(size_t index, uint8_t reason);
+   inline void push_export(Flow &flow);
+   void flush_export();
+   void sync_export();
+   inline uint32_t get_spare();
+   void add_sampling(const FlowRecord &flow, Flow &data);
+   inline Flow &get_plugin_flow(FlowRecord *flow);
+   inline int call_pre_create(Packet &pkt);
+   inline int call_post_create(Flow &rec, const Packet &pkt);
+   inline int call_pre_update(Flow &rec, Packet &pkt);
+   inline int call_post_update(Flow &rec, const Packet &pkt);
+   inline void call_pre_export(Flow &rec);
+   void schedule_flow(FlowRecord *flow);
+   void expire_flow(FlowRecord *flow, time_t ts);
+   void expire_shards(time_t ts, bool idle);
+   void expire_shard(time_t ts, bool idle);
+   void expire_table(time_t ts);
+   void flush_shard();
+   void flush_table();
+   void save_snapshot();
+   bool save_flow(SnapshotWriter &writer, size_t index, std::vector<uint8_t> &buffer);
+   void drop_flow(size_t index);
+   void load_snapshot();
+   void restore_flow(const SnapshotFlow &rec, const std::vector<std::pair<int32_t, ProcessPlugin *>> &plugins);
+   static uint8_t get_export_reason(const FlowRecord &flow);
    void finish();
-
-#ifdef FLOW_CACHE_STATS
-   void print_report();
-#endif /* FLOW_CACHE_STATS */
 };
 
 }
@@ -0,0 +1,150 @@
+/**
+ * \file hugemem.cpp
+ * \brief Memory for large tables backed by hugepages and bound to a NUMA node
+ * \date 2026
+ */
+/*
+ * Copyright (C) 2026 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *
+ *
+ */
+
+#include <cstdint>
+#include <vector>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "hugemem.hpp"
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MPOL_BIND
+#define MPOL_BIND 2
+#endif
+
+namespace ipxp {
+
+HugeMemory::HugeMemory() : m_addr(nullptr), m_size(0), m_page_size(0), m_bind_failed(false)
+{
+}
+
+HugeMemory::~HugeMemory()
+{
+   release();
+}
+
+void *HugeMemory::allocate(size_t size, size_t hugepage_size, int numa_node, bool prefault)
+{
+   release();
+   if (size == 0) {
+      return nullptr;
+   }
+
+   m_addr = map(size, hugepage_size);
+   if (m_addr == nullptr) {
+      return nullptr;
+   }
+   // Memory policy must be set before the pages are faulted in
+   m_bind_failed = numa_node != NUMA_NODE_ANY && !bind(numa_node);
+   if (prefault) {
+      populate();
+   }
+   return m_addr;
+}
+
+void HugeMemory::release()
+{
+   if (m_addr != nullptr) {
+      munmap(m_addr, m_size);
+      m_addr = nullptr;
+      m_size = 0;
+      m_page_size = 0;
+   }
+   m_bind_failed = false;
+}
+
+void *HugeMemory::map(size_t size, size_t hugepage_size)
+{
+   void *addr;
+#ifdef MAP_HUGETLB
+   if (hugepage_size && size >= hugepage_size) {
+      size_t hp_size = (size + hugepage_size - 1) & ~(hugepage_size - 1);
+      int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (__builtin_ctzl(hugepage_size) << MAP_HUGE_SHIFT);
+      addr = mmap(nullptr, hp_size, PROT_READ | PROT_WRITE, flags, -1, 0);
+      if (addr != MAP_FAILED) {
+         m_size = hp_size;
+         m_page_size = hugepage_size;
+         return addr;
+      }
+   }
+#endif
+
+   size_t page_size = sysconf(_SC_PAGESIZE);
+   m_size = (size + page_size - 1) & ~(page_size - 1);
+   addr = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+   if (addr == MAP_FAILED) {
+      m_size = 0;
+      return nullptr;
+   }
+   m_page_size = page_size;
+#ifdef MADV_HUGEPAGE
+   if (hugepage_size && madvise(addr, m_size, MADV_HUGEPAGE) == 0) {
+      m_page_size = 0;
+   }
+#endif
+   return addr;
+}
+
+bool HugeMemory::bind(int numa_node)
+{
+#ifdef SYS_mbind
+   const size_t bits = 8 * sizeof(unsigned long);
+   std::vector<unsigned long> mask(numa_node / bits + 1, 0);
+   mask[numa_node / bits] = 1UL << (numa_node % bits);
+   // Kernel expects number of mask bits plus one
+   return syscall(SYS_mbind, m_addr, m_size, MPOL_BIND, mask.data(), mask.size() * bits + 1, 0) == 0;
+#else
+   return false;
+#endif
+}
+
+void HugeMemory::populate()
+{
+   size_t step = m_page_size ? m_page_size : sysconf(_SC_PAGESIZE);
+   volatile uint8_t *ptr = static_cast<uint8_t *>(m_addr);
+   for (size_t offset = 0; offset < m_size; offset += step) {
+      ptr[offset] = 0;
+   }
+}
+
+int HugeMemory::current_numa_node()
+{
+#ifdef SYS_getcpu
+   unsigned cpu;
+   unsigned node;
+   if (syscall(SYS_getcpu, &cpu, &node, nullptr) == 0) {
+      return node;
+   }
+#endif
+   return NUMA_NODE_ANY;
+}
+
+}
@@ -0,0 +1,90 @@
+/**
+ * \file hugemem.hpp
+ * \brief Memory for large tables backed by hugepages and bound to a NUMA node
+ * \date 2026
+ */
+/*
+ * Copyright (C) 2026 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *
+ *
+ */
+#ifndef IPXP_STORAGE_HUGEMEM_HPP
+#define IPXP_STORAGE_HUGEMEM_HPP
+
+#include <cstddef>
+
+namespace ipxp {
+
+static const int NUMA_NODE_ANY = -1;
+
+/**
+ * \brief Anonymous memory mapping used for flow cache tables.
+ *
+ * Memory is zero filled and allocated lazily by the kernel, unless it is prefaulted.
+ */
+class HugeMemory
+{
+public:
+   HugeMemory();
+   ~HugeMemory();
+   HugeMemory(const HugeMemory &) = delete;
+   HugeMemory &operator=(const HugeMemory &) = delete;
+
+   /**
+    * \brief Map new memory, previous mapping is released.
+    * \param [in] size Requested size in bytes.
+    * \param [in] hugepage_size Size of explicit hugepages to try first, 0 uses normal pages.
+    *    Transparent hugepages are requested when explicit hugepages are not available
+    *    or the memory would not fill a single hugepage.
+    * \param [in] numa_node Node to bind the memory to or NUMA_NODE_ANY.
+    * \param [in] prefault Fault all pages in advance.
+    * \return Pointer to the memory or nullptr on failure.
+    */
+   void *allocate(size_t size, size_t hugepage_size, int numa_node, bool prefault);
+   void release();
+
+   void *get() const { return m_addr; }
+   /**
+    * \brief Get size of pages backing the memory, 0 when it is unknown (transparent hugepages).
+    */
+   size_t get_page_size() const { return m_page_size; }
+   /**
+    * \brief Check whether binding to the requested NUMA node failed.
+    */
+   bool bind_failed() const { return m_bind_failed; }
+
+   /**
+    * \brief Get NUMA node of the CPU the calling thread is running on.
+    * \return Node number or NUMA_NODE_ANY when it is unknown.
+    */
+   static int current_numa_node();
+
+private:
+   void *m_addr;
+   size_t m_size;
+   size_t m_page_size;
+   bool m_bind_failed;
+
+   void *map(size_t size, size_t hugepage_size);
+   bool bind(int numa_node);
+   void populate();
+};
+
+}
+#endif /* IPXP_STORAGE_HUGEMEM_HPP */
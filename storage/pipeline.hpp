@@ -0,0 +1,207 @@
+/**
+ * \file pipeline.hpp
+ * \brief Statically composed pipeline of process plugins
+ * \date 2026
+ */
+/*
+ * Copyright (C) 2026 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *
+ *
+ */
+#ifndef IPXP_STORAGE_PIPELINE_HPP
+#define IPXP_STORAGE_PIPELINE_HPP
+
+#include <cstddef>
+#include <tuple>
+#include <type_traits>
+#include <typeinfo>
+#include <vector>
+
+#include <ipfixprobe/storage.hpp>
+
+namespace ipxp {
+
+/**
+ * \brief Hooks of the first I plugins of a static pipeline, called in the order of the plugins.
+ * Hooks are called by qualified name, so they are not virtual and hooks a plugin does not override are
+ * compiled out.
+ */
+template<size_t I, typename Tuple>
+struct PipelineStage {
+   typedef PipelineStage<I - 1, Tuple> Prev;
+   typedef typename std::remove_pointer<typename std::tuple_element<I - 1, Tuple>::type>::type Plugin;
+
+   static bool bind(Tuple &plugins, const std::vector<ProcessPlugin *> &list)
+   {
+      if (typeid(*list[I - 1]) != typeid(Plugin)) {
+         return false;
+      }
+      std::get<I - 1>(plugins) = static_cast<Plugin *>(list[I - 1]);
+      return Prev::bind(plugins, list);
+   }
+
+   static int pre_create(const Tuple &plugins, const ProcessDispatch *dispatch, Packet &pkt)
+   {
+      int ret = Prev::pre_create(plugins, dispatch, pkt);
+      const ProcessDispatch &it = dispatch[I - 1];
+      if ((it.hooks & PROCESS_HOOK_PRE_CREATE) && it.match(pkt)) {
+         ret |= std::get<I - 1>(plugins)->Plugin::pre_create(pkt);
+      }
+      return ret;
+   }
+
+   static int post_create(const Tuple &plugins, const ProcessDispatch *dispatch, Flow &rec, const Packet &pkt)
+   {
+      int ret = Prev::post_create(plugins, dispatch, rec, pkt);
+      const ProcessDispatch &it = dispatch[I - 1];
+      if ((it.hooks & PROCESS_HOOK_POST_CREATE) && it.match(pkt)) {
+         ret |= std::get<I - 1>(plugins)->Plugin::post_create(rec, pkt);
+      }
+      return ret;
+   }
+
+   static int pre_update(const Tuple &plugins, const ProcessDispatch *dispatch, Flow &rec, Packet &pkt)
+   {
+      int ret = Prev::pre_update(plugins, dispatch, rec, pkt);
+      const ProcessDispatch &it = dispatch[I - 1];
+      if ((it.hooks & PROCESS_HOOK_PRE_UPDATE) && it.match(pkt)) {
+         ret |= std::get<I - 1>(plugins)->Plugin::pre_update(rec, pkt);
+      }
+      return ret;
+   }
+
+   static int post_update(const Tuple &plugins, const ProcessDispatch *dispatch, Flow &rec, const Packet &pkt)
+   {
+      int ret = Prev::post_update(plugins, dispatch, rec, pkt);
+      const ProcessDispatch &it = dispatch[I - 1];
+      if ((it.hooks & PROCESS_HOOK_POST_UPDATE) && it.match(pkt)) {
+         ret |= std::get<I - 1>(plugins)->Plugin::post_update(rec, pkt);
+      }
+      return ret;
+   }
+
+   static void pre_export(const Tuple &plugins, const ProcessDispatch *dispatch, Flow &rec)
+   {
+      Prev::pre_export(plugins, dispatch, rec);
+      const ProcessDispatch &it = dispatch[I - 1];
+      if ((it.hooks & PROCESS_HOOK_PRE_EXPORT) && it.match(rec.ip_proto, rec.src_port, rec.dst_port)) {
+         std::get<I - 1>(plugins)->Plugin::pre_export(rec);
+      }
+   }
+};
+
+template<typename Tuple>
+struct PipelineStage<0, Tuple> {
+   static bool bind(Tuple &plugins, const std::vector<ProcessPlugin *> &list)
+   {
+      return true;
+   }
+   static int pre_create(const Tuple &plugins, const ProcessDispatch *dispatch, Packet &pkt)
+   {
+      return 0;
+   }
+   static int post_create(const Tuple &plugins, const ProcessDispatch *dispatch, Flow &rec, const Packet &pkt)
+   {
+      return 0;
+   }
+   static int pre_update(const Tuple &plugins, const ProcessDispatch *dispatch, Flow &rec, Packet &pkt)
+   {
+      return 0;
+   }
+   static int post_update(const Tuple &plugins, const ProcessDispatch *dispatch, Flow &rec, const Packet &pkt)
+   {
+      return 0;
+   }
+   static void pre_export(const Tuple &plugins, const ProcessDispatch *dispatch, Flow &rec)
+   {
+   }
+};
+
+/**
+ * \brief Process plugins known at build time, called without virtual dispatch.
+ * The pipeline is usable only when the plugins added to the storage plugin are exactly instances of Plugins
+ * in the same order, otherwise the storage plugin keeps calling its dynamic plugin list.
+ * Hooks and packets are filtered by the interest of each plugin as by StoragePlugin.
+ */
+template<typename... Plugins>
+class StaticPipeline
+{
+public:
+   StaticPipeline() : m_bound(false)
+   {
+   }
+
+   /**
+    * \brief Bind instances of the plugins.
+    * \param [in] plugins Initialized plugins in the order they are called.
+    * \return True when the plugins match the pipeline.
+    */
+   bool bind(const std::vector<ProcessPlugin *> &plugins)
+   {
+      m_dispatch.clear();
+      m_bound = plugins.size() == sizeof...(Plugins) && Stages::bind(m_plugins, plugins);
+      if (m_bound) {
+         for (auto plugin : plugins) {
+            m_dispatch.push_back(ProcessDispatch(plugin, plugin->get_interest()));
+         }
+      }
+      return m_bound;
+   }
+
+   bool bound() const
+   {
+      return m_bound;
+   }
+
+   int pre_create(Packet &pkt) const
+   {
+      return Stages::pre_create(m_plugins, m_dispatch.data(), pkt);
+   }
+
+   int post_create(Flow &rec, const Packet &pkt) const
+   {
+      return Stages::post_create(m_plugins, m_dispatch.data(), rec, pkt);
+   }
+
+   int pre_update(Flow &rec, Packet &pkt) const
+   {
+      return Stages::pre_update(m_plugins, m_dispatch.data(), rec, pkt);
+   }
+
+   int post_update(Flow &rec, const Packet &pkt) const
+   {
+      return Stages::post_update(m_plugins, m_dispatch.data(), rec, pkt);
+   }
+
+   void pre_export(Flow &rec) const
+   {
+      Stages::pre_export(m_plugins, m_dispatch.data(), rec);
+   }
+
+private:
+   typedef std::tuple<Plugins *...> Tuple;
+   typedef PipelineStage<sizeof...(Plugins), Tuple> Stages;
+
+   Tuple m_plugins;
+   std::vector<ProcessDispatch> m_dispatch;
+   bool m_bound;
+};
+
+}
+#endif /* IPXP_STORAGE_PIPELINE_HPP */
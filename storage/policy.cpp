@@ -0,0 +1,197 @@
+/**
+ * \file policy.cpp
+ * \brief Replacement policies of flow cache lines
+ * \date 2026
+ */
+/*
+ * Copyright (C) 2026 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *
+ *
+ */
+
+#include "policy.hpp"
+#include "cache.hpp"
+
+namespace ipxp {
+
+static const uint8_t CLOCK_REF = 0x01;
+
+static const uint8_t S3FIFO_FREQ = 0x03;
+static const uint8_t S3FIFO_MAIN = 0x04;
+
+ReplacementPolicy *ReplacementPolicy::create(const std::string &name, uint32_t line_size)
+{
+   if (name == "lru") {
+      return new LRUPolicy(line_size);
+   } else if (name == "clock") {
+      return new ClockPolicy(line_size);
+   } else if (name == "s3fifo") {
+      return new S3FifoPolicy(line_size);
+   }
+   return nullptr;
+}
+
+ReplacementPolicy::ReplacementPolicy(uint32_t line_size) :
+   m_line_size(line_size), m_line_shift(__builtin_ctz(line_size))
+{
+}
+
+FlowLineMeta &ReplacementPolicy::get_line(FlowTable &table, uint32_t line_index) const
+{
+   return table.m_line_meta[line_index >> m_line_shift];
+}
+
+LRUPolicy::LRUPolicy(uint32_t line_size) : ReplacementPolicy(line_size), m_new_idx(line_size / 2)
+{
+}
+
+uint32_t LRUPolicy::hit(FlowTable &table, uint32_t line_index, uint32_t flow_index)
+{
+   move_flow(table, flow_index, line_index);
+   return line_index;
+}
+
+uint32_t LRUPolicy::victim(FlowTable &table, uint32_t line_index)
+{
+   return line_index + m_line_size - 1;
+}
+
+uint32_t LRUPolicy::insert(FlowTable &table, uint32_t line_index, uint32_t flow_index, uint16_t tag, bool evicted)
+{
+   if (!evicted) {
+      return flow_index;
+   }
+   move_flow(table, flow_index, line_index + m_new_idx);
+   return line_index + m_new_idx;
+}
+
+/**
+ * \brief Move record to a lower index in its line, records in between are shifted by one.
+ */
+void LRUPolicy::move_flow(FlowTable &table, uint32_t from, uint32_t to)
+{
+   FlowRecord *flow = table.m_flow_table[from];
+   uint16_t tag = table.m_flow_tags[from];
+   for (uint32_t j = from; j > to; j--) {
+      table.m_flow_table[j] = table.m_flow_table[j - 1];
+      table.m_flow_tags[j] = table.m_flow_tags[j - 1];
+   }
+   table.m_flow_table[to] = flow;
+   table.m_flow_tags[to] = tag;
+}
+
+ClockPolicy::ClockPolicy(uint32_t line_size) : ReplacementPolicy(line_size)
+{
+}
+
+uint32_t ClockPolicy::hit(FlowTable &table, uint32_t line_index, uint32_t flow_index)
+{
+   table.m_flow_meta[flow_index] = CLOCK_REF;
+   return flow_index;
+}
+
+uint32_t ClockPolicy::victim(FlowTable &table, uint32_t line_index)
+{
+   uint8_t *meta = table.m_flow_meta + line_index;
+   FlowLineMeta &line = get_line(table, line_index);
+   uint32_t i = line.m_hand;
+
+   // All reference bits are cleared after a single round
+   while (meta[i] & CLOCK_REF) {
+      meta[i] = 0;
+      i = (i + 1) & (m_line_size - 1);
+   }
+   line.m_hand = (i + 1) & (m_line_size - 1);
+   return line_index + i;
+}
+
+uint32_t ClockPolicy::insert(FlowTable &table, uint32_t line_index, uint32_t flow_index, uint16_t tag, bool evicted)
+{
+   table.m_flow_meta[flow_index] = 0;
+   return flow_index;
+}
+
+S3FifoPolicy::S3FifoPolicy(uint32_t line_size) : ReplacementPolicy(line_size), m_small_size(line_size / 10)
+{
+}
+
+uint32_t S3FifoPolicy::hit(FlowTable &table, uint32_t line_index, uint32_t flow_index)
+{
+   uint8_t &meta = table.m_flow_meta[flow_index];
+   if ((meta & S3FIFO_FREQ) != S3FIFO_FREQ) {
+      meta++;
+   }
+   return flow_index;
+}
+
+uint32_t S3FifoPolicy::victim(FlowTable &table, uint32_t line_index)
+{
+   uint8_t *meta = table.m_flow_meta + line_index;
+   FlowLineMeta &line = get_line(table, line_index);
+   uint32_t mask = m_line_size - 1;
+   uint32_t small = 0;
+
+   for (uint32_t i = 0; i < m_line_size; i++) {
+      small += !(meta[i] & S3FIFO_MAIN);
+   }
+
+   if (small > m_small_size) {
+      for (uint32_t n = 0; n < m_line_size; n++) {
+         uint32_t i = (line.m_hand + n) & mask;
+         if (meta[i] & S3FIFO_MAIN) {
+            continue;
+         }
+         if (!(meta[i] & S3FIFO_FREQ)) {
+            line.m_ghost[line.m_ghost_idx] = table.m_flow_tags[line_index + i];
+            line.m_ghost_idx = (line.m_ghost_idx + 1) % POLICY_GHOST_SIZE;
+            line.m_hand = (i + 1) & mask;
+            return line_index + i;
+         }
+         meta[i] = S3FIFO_MAIN;
+      }
+   }
+
+   // Line holds a main queue record now, frequency of each one drops to 0 within 4 rounds
+   uint32_t i = line.m_hand;
+   while (!(meta[i] & S3FIFO_MAIN) || (meta[i] & S3FIFO_FREQ)) {
+      if (meta[i] & S3FIFO_MAIN) {
+         meta[i]--;
+      }
+      i = (i + 1) & mask;
+   }
+   line.m_hand = (i + 1) & mask;
+   return line_index + i;
+}
+
+uint32_t S3FifoPolicy::insert(FlowTable &table, uint32_t line_index, uint32_t flow_index, uint16_t tag, bool evicted)
+{
+   FlowLineMeta &line = get_line(table, line_index);
+   uint8_t meta = 0;
+   for (uint32_t i = 0; i < POLICY_GHOST_SIZE; i++) {
+      if (line.m_ghost[i] == tag) {
+         line.m_ghost[i] = 0;
+         meta = S3FIFO_MAIN;
+         break;
+      }
+   }
+   table.m_flow_meta[flow_index] = meta;
+   return flow_index;
+}
+
+}
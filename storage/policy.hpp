@@ -0,0 +1,154 @@
+/**
+ * \file policy.hpp
+ * \brief Replacement policies of flow cache lines
+ * \date 2026
+ */
+/*
+ * Copyright (C) 2026 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *
+ *
+ */
+#ifndef IPXP_STORAGE_POLICY_HPP
+#define IPXP_STORAGE_POLICY_HPP
+
+#include <cstdint>
+#include <string>
+
+namespace ipxp {
+
+class FlowTable;
+
+static const uint32_t POLICY_GHOST_SIZE = 4; /**< Tags of recently evicted flows remembered per line. */
+
+/**
+ * \brief Replacement policy state of a flow line.
+ *
+ * Zeroed state is valid, so it needs no construction.
+ */
+struct FlowLineMeta {
+   uint32_t m_hand; /**< Offset of the next record examined for eviction. */
+   uint32_t m_ghost_idx; /**< Position of the next tag written to m_ghost. */
+   uint16_t m_ghost[POLICY_GHOST_SIZE]; /**< Tags of flows evicted before their second packet. */
+};
+
+/**
+ * \brief Replacement policy deciding positions of records in a flow line and victims of full lines.
+ *
+ * Policy keeps its state in FlowTable::m_flow_meta and FlowTable::m_line_meta, so a single
+ * policy can be used with any number of tables. Meta of a record is zeroed when it is exported.
+ */
+class ReplacementPolicy
+{
+public:
+   /**
+    * \brief Create policy by its name.
+    * \param [in] name Policy name, lru, clock or s3fifo.
+    * \param [in] line_size Number of records in a line.
+    * \return New policy or nullptr for an unknown name.
+    */
+   static ReplacementPolicy *create(const std::string &name, uint32_t line_size);
+
+   ReplacementPolicy(uint32_t line_size);
+   virtual ~ReplacementPolicy()
+   {
+   }
+
+   /**
+    * \brief Record was hit by a packet.
+    * \return Index of the record after the hit.
+    */
+   virtual uint32_t hit(FlowTable &table, uint32_t line_index, uint32_t flow_index) = 0;
+
+   /**
+    * \brief Select record to be evicted from a full line.
+    */
+   virtual uint32_t victim(FlowTable &table, uint32_t line_index) = 0;
+
+   /**
+    * \brief Empty record is going to hold a new flow.
+    * \param [in] tag Tag of the new flow.
+    * \param [in] evicted Record was emptied by eviction of the victim.
+    * \return Index of the record which holds the new flow.
+    */
+   virtual uint32_t insert(FlowTable &table, uint32_t line_index, uint32_t flow_index, uint16_t tag, bool evicted) = 0;
+
+protected:
+   uint32_t m_line_size;
+   uint32_t m_line_shift;
+
+   FlowLineMeta &get_line(FlowTable &table, uint32_t line_index) const;
+};
+
+/**
+ * \brief Least recently used records are evicted, records are kept ordered in their lines.
+ *
+ * Hit record is moved to the beginning of its line, new record is inserted in the middle
+ * of a full line, so flows with a single packet are evicted first.
+ */
+class LRUPolicy : public ReplacementPolicy
+{
+public:
+   LRUPolicy(uint32_t line_size);
+   uint32_t hit(FlowTable &table, uint32_t line_index, uint32_t flow_index);
+   uint32_t victim(FlowTable &table, uint32_t line_index);
+   uint32_t insert(FlowTable &table, uint32_t line_index, uint32_t flow_index, uint16_t tag, bool evicted);
+
+private:
+   uint32_t m_new_idx; /**< Offset in a full line where new record is inserted. */
+
+   void move_flow(FlowTable &table, uint32_t from, uint32_t to);
+};
+
+/**
+ * \brief Second chance policy, hit sets a reference bit and records never move.
+ *
+ * Hand of the line clears reference bits until it finds a record without one to evict.
+ */
+class ClockPolicy : public ReplacementPolicy
+{
+public:
+   ClockPolicy(uint32_t line_size);
+   uint32_t hit(FlowTable &table, uint32_t line_index, uint32_t flow_index);
+   uint32_t victim(FlowTable &table, uint32_t line_index);
+   uint32_t insert(FlowTable &table, uint32_t line_index, uint32_t flow_index, uint16_t tag, bool evicted);
+};
+
+/**
+ * \brief S3-FIFO style policy applied to each line, records never move.
+ *
+ * New records start in the small queue. When the small queue holds more than a tenth
+ * of a full line, its records are evicted unless they were hit, hit ones are promoted
+ * to the main queue. Main queue records are evicted like CLOCK with a 2-bit frequency
+ * instead of a reference bit. Flows evicted from the small queue are remembered
+ * by their tag, so they enter the main queue directly when they come back.
+ */
+class S3FifoPolicy : public ReplacementPolicy
+{
+public:
+   S3FifoPolicy(uint32_t line_size);
+   uint32_t hit(FlowTable &table, uint32_t line_index, uint32_t flow_index);
+   uint32_t victim(FlowTable &table, uint32_t line_index);
+   uint32_t insert(FlowTable &table, uint32_t line_index, uint32_t flow_index, uint16_t tag, bool evicted);
+
+private:
+   uint32_t m_small_size; /**< Maximal number of small queue records in a full line before they are evicted. */
+};
+
+}
+#endif /* IPXP_STORAGE_POLICY_HPP */
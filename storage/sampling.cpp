@@ -0,0 +1,103 @@
+/**
+ * \file sampling.cpp
+ * \brief Packet and flow sampling of overloaded flow cache
+ * \date 2026
+ */
+/*
+ * Copyright (C) 2026 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *
+ *
+ */
+
+#include "sampling.hpp"
+
+namespace ipxp {
+
+int RecordExtSAMPLING::REGISTERED_ID = -1;
+
+__attribute__((constructor)) static void register_this_extension()
+{
+   RecordExtSAMPLING::REGISTERED_ID = register_extension();
+}
+
+static const time_t SAMPLING_HOLD = 10; /**< Seconds without input drops before the adaptive rate is lowered. */
+
+FlowSampler::FlowSampler() : m_enabled(false), m_base_rate(1), m_max_rate(1), m_packet_rate(1), m_flow_rate(1),
+   m_flow_threshold(static_cast<uint64_t>(1) << 32), m_countdown(0), m_level(0), m_input_drops(0), m_last_drops(0),
+   m_last_step(0), m_last_drop_time(0)
+{
+}
+
+/**
+ * \brief Set sampling rates.
+ * \param [in] packet_rate 1 out of packet_rate packets is processed.
+ * \param [in] flow_rate 1 out of flow_rate flows is processed.
+ * \param [in] max_packet_rate Maximal packet rate of adaptive sampling, adaptive sampling is disabled when it is not above packet_rate.
+ */
+void FlowSampler::configure(uint32_t packet_rate, uint32_t flow_rate, uint32_t max_packet_rate)
+{
+   m_base_rate = packet_rate;
+   m_max_rate = max_packet_rate > packet_rate ? max_packet_rate : packet_rate;
+   m_packet_rate = packet_rate;
+   m_flow_rate = flow_rate;
+   m_flow_threshold = (static_cast<uint64_t>(1) << 32) / flow_rate;
+   m_countdown = 0;
+   m_level = 0;
+   m_enabled = packet_rate > 1 || flow_rate > 1 || is_adaptive();
+}
+
+/**
+ * \brief Adapt packet sampling rate to input drops, called with time of processed packets.
+ */
+void FlowSampler::update(time_t now)
+{
+   if (now == m_last_step) {
+      return;
+   }
+   m_last_step = now;
+
+   if (m_input_drops != m_last_drops) {
+      m_last_drops = m_input_drops;
+      m_last_drop_time = now;
+      if (m_packet_rate < m_max_rate) {
+         m_level++;
+      }
+   } else if (m_level && now - m_last_drop_time >= SAMPLING_HOLD) {
+      // Rate is lowered step by step, each step waits for drops again
+      m_last_drop_time = now;
+      m_level--;
+   } else {
+      return;
+   }
+   m_packet_rate = get_packet_rate(m_level);
+   if (m_countdown >= m_packet_rate) {
+      m_countdown = m_packet_rate - 1;
+   }
+}
+
+/**
+ * \brief Get packet sampling rate of an adaptive level.
+ */
+uint32_t FlowSampler::get_packet_rate(uint8_t level) const
+{
+   uint64_t rate = static_cast<uint64_t>(m_base_rate) << level;
+   return rate < m_max_rate ? rate : m_max_rate;
+}
+
+}
@@ -0,0 +1,187 @@
+/**
+ * \file sampling.hpp
+ * \brief Packet and flow sampling of overloaded flow cache
+ * \date 2026
+ */
+/*
+ * Copyright (C) 2026 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *
+ *
+ */
+#ifndef IPXP_STORAGE_SAMPLING_HPP
+#define IPXP_STORAGE_SAMPLING_HPP
+
+#include <cstdint>
+#include <ctime>
+#include <sstream>
+#include <string>
+
+#include <arpa/inet.h>
+
+#include <ipfixprobe/flowifc.hpp>
+#include <ipfixprobe/ipfix-elements.hpp>
+
+namespace ipxp {
+
+/**
+ * \brief Sampling rates of the packets counted in a flow, added by the cache to exported flows.
+ *
+ * Rates are reported as PSAMP interval and space, i.e. 1 packet out of space + 1 packets
+ * and 1 flow out of spacing + 1 flows was selected.
+ */
+struct RecordExtSAMPLING : public RecordExt {
+   static int REGISTERED_ID;
+
+   uint32_t packet_space;
+   uint32_t flow_spacing;
+
+   RecordExtSAMPLING(uint32_t packet_rate, uint32_t flow_rate) : RecordExt(REGISTERED_ID),
+      packet_space(packet_rate - 1), flow_spacing(flow_rate - 1)
+   {
+   }
+
+   virtual int fill_ipfix(uint8_t *buffer, int size)
+   {
+      const int LEN = 16;
+
+      if (size < LEN) {
+         return -1;
+      }
+
+      *reinterpret_cast<uint32_t *>(buffer) = htonl(1);
+      *reinterpret_cast<uint32_t *>(buffer + 4) = htonl(packet_space);
+      *reinterpret_cast<uint32_t *>(buffer + 8) = htonl(1);
+      *reinterpret_cast<uint32_t *>(buffer + 12) = htonl(flow_spacing);
+
+      return LEN;
+   }
+
+   const char **get_ipfix_tmplt() const
+   {
+      static const char *ipfix_template[] = {
+         IPFIX_SAMPLING_TEMPLATE(IPFIX_FIELD_NAMES)
+         NULL
+      };
+      return ipfix_template;
+   }
+
+   std::string get_text() const
+   {
+      std::ostringstream out;
+      out << "pktsampling=1/" << packet_space + 1ULL << ",flowsampling=1/" << flow_spacing + 1ULL;
+      return out.str();
+   }
+};
+
+/**
+ * \brief Selects packets processed by a flow cache when it cannot keep up with the traffic.
+ *
+ * Packets are selected by systematic count-based sampling, 1 out of each N packets, and
+ * their flows by hash-based flow sampling, so all packets of a selected flow are kept.
+ * Adaptive sampling doubles the packet sampling rate each second in which the input
+ * dropped packets and halves it back after a while without drops.
+ */
+class FlowSampler
+{
+public:
+   FlowSampler();
+
+   void configure(uint32_t packet_rate, uint32_t flow_rate, uint32_t max_packet_rate);
+   void update(time_t now);
+
+   /**
+    * \brief Check whether any packet may be skipped, so sampling has to be applied.
+    */
+   bool is_enabled() const
+   {
+      return m_enabled;
+   }
+
+   bool is_adaptive() const
+   {
+      return m_max_rate > m_base_rate;
+   }
+
+   /**
+    * \brief Decide whether the next packet is processed.
+    */
+   bool select_packet()
+   {
+      if (m_countdown) {
+         m_countdown--;
+         return false;
+      }
+      m_countdown = m_packet_rate - 1;
+      return true;
+   }
+
+   /**
+    * \brief Decide whether packets of a flow are processed.
+    * \param [in] hash Hash of the flow key, bits used by the cache are mixed, so selected flows are spread over the whole cache.
+    */
+   bool select_flow(uint64_t hash) const
+   {
+      return ((hash * 0x9E3779B97F4A7C15ULL) >> 32) < m_flow_threshold;
+   }
+
+   /**
+    * \brief Set number of packets dropped by the input so far.
+    */
+   void set_input_drops(uint64_t dropped)
+   {
+      m_input_drops = dropped;
+   }
+
+   /**
+    * \brief Get adaptive level, packet sampling rate is the base rate multiplied by 2^level.
+    */
+   uint8_t get_level() const
+   {
+      return m_level;
+   }
+
+   uint32_t get_packet_rate() const
+   {
+      return m_packet_rate;
+   }
+
+   uint32_t get_packet_rate(uint8_t level) const;
+
+   uint32_t get_flow_rate() const
+   {
+      return m_flow_rate;
+   }
+
+private:
+   bool m_enabled;
+   uint32_t m_base_rate; /**< Configured packet sampling rate. */
+   uint32_t m_max_rate; /**< Upper limit of the adaptive packet sampling rate. */
+   uint32_t m_packet_rate; /**< Packet sampling rate in effect. */
+   uint32_t m_flow_rate;
+   uint64_t m_flow_threshold; /**< Flows with mixed hash below the threshold are selected. */
+   uint32_t m_countdown; /**< Packets to skip before the next selected one. */
+   uint8_t m_level;
+   uint64_t m_input_drops;
+   uint64_t m_last_drops; /**< Input drops at the last adaptive step. */
+   time_t m_last_step;
+   time_t m_last_drop_time;
+};
+
+}
+#endif /* IPXP_STORAGE_SAMPLING_HPP */
@@ -0,0 +1,231 @@
+/**
+ * \file snapshot.cpp
+ * \brief Flow cache snapshot file used for warm restart
+ * \date 2026
+ */
+/*
+ * Copyright (C) 2026 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *
+ *
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <ipfixprobe/plugin.hpp>
+
+#include "snapshot.hpp"
+
+namespace ipxp {
+
+SnapshotWriter::SnapshotWriter() : m_file(nullptr), m_header()
+{
+}
+
+SnapshotWriter::~SnapshotWriter()
+{
+   if (m_file != nullptr) {
+      fclose(m_file);
+      unlink((m_path + ".tmp").c_str());
+   }
+}
+
+/**
+ * \brief Start writing snapshot.
+ * \param [in] path Path of the snapshot, a temporary file next to it is written meanwhile.
+ * \param [in] split_biflow Cache splits biflows.
+ * \param [in] ext_names Names of plugins owning extensions which may be saved with flows.
+ */
+void SnapshotWriter::open(const std::string &path, bool split_biflow, const std::vector<SnapshotExtName> &ext_names)
+{
+   m_path = path;
+   m_file = fopen((m_path + ".tmp").c_str(), "wb");
+   if (m_file == nullptr) {
+      throw PluginError("unable to create flow cache snapshot " + m_path + ".tmp: " + strerror(errno));
+   }
+
+   memcpy(m_header.m_magic, SNAPSHOT_MAGIC, sizeof(m_header.m_magic));
+   m_header.m_version = SNAPSHOT_VERSION;
+   m_header.m_record_size = sizeof(FlowRecord);
+   m_header.m_split_biflow = split_biflow;
+   m_header.m_ext_cnt = ext_names.size();
+   m_header.m_flow_cnt = 0;
+   write_data(&m_header, sizeof(m_header));
+   if (!ext_names.empty()) {
+      write_data(ext_names.data(), ext_names.size() * sizeof(SnapshotExtName));
+   }
+}
+
+/**
+ * \brief Write a flow.
+ * \param [in] flow Hot part of the flow.
+ * \param [in] data Cold part of the flow.
+ * \param [in] exts SnapshotExt entries with saved extensions.
+ * \param [in] ext_cnt Number of SnapshotExt entries.
+ * \param [in] ext_size Size of SnapshotExt entries with their data.
+ */
+void SnapshotWriter::write(const FlowRecord &flow, const Flow &data, const uint8_t *exts, uint16_t ext_cnt, uint32_t ext_size)
+{
+   SnapshotFlow rec;
+   memcpy(rec.m_record, &flow, sizeof(rec.m_record));
+   rec.m_time_first = data.time_first;
+   memcpy(rec.m_src_mac, data.src_mac, sizeof(rec.m_src_mac));
+   memcpy(rec.m_dst_mac, data.dst_mac, sizeof(rec.m_dst_mac));
+   rec.m_src_ip = data.src_ip;
+   rec.m_dst_ip = data.dst_ip;
+   rec.m_src_port = data.src_port;
+   rec.m_dst_port = data.dst_port;
+   rec.m_ip_version = data.ip_version;
+   rec.m_ip_proto = data.ip_proto;
+   rec.m_ext_cnt = ext_cnt;
+   rec.m_ext_size = ext_size;
+   write_data(&rec, sizeof(rec));
+   if (ext_size) {
+      write_data(exts, ext_size);
+   }
+   m_header.m_flow_cnt++;
+}
+
+/**
+ * \brief Finish the snapshot and replace the previous one.
+ */
+void SnapshotWriter::close()
+{
+   if (fseek(m_file, 0, SEEK_SET) != 0) {
+      throw PluginError("unable to write flow cache snapshot " + m_path + ".tmp: " + strerror(errno));
+   }
+   write_data(&m_header, sizeof(m_header));
+   int ret = fclose(m_file);
+   m_file = nullptr;
+   if (ret != 0 || rename((m_path + ".tmp").c_str(), m_path.c_str()) != 0) {
+      unlink((m_path + ".tmp").c_str());
+      throw PluginError("unable to write flow cache snapshot " + m_path + ": " + strerror(errno));
+   }
+}
+
+void SnapshotWriter::write_data(const void *data, size_t size)
+{
+   if (fwrite(data, size, 1, m_file) != 1) {
+      throw PluginError("unable to write flow cache snapshot " + m_path + ".tmp: " + strerror(errno));
+   }
+}
+
+SnapshotReader::SnapshotReader() :
+   m_data(nullptr), m_size(0), m_offset(0), m_flows_left(0), m_ext_names(nullptr)
+{
+}
+
+SnapshotReader::~SnapshotReader()
+{
+   close();
+}
+
+/**
+ * \brief Map snapshot file.
+ * \param [in] path Path of the snapshot.
+ * \param [in] split_biflow Cache splits biflows.
+ * \return False when there is no snapshot.
+ */
+bool SnapshotReader::open(const std::string &path, bool split_biflow)
+{
+   m_path = path;
+   int fd = ::open(path.c_str(), O_RDONLY);
+   if (fd < 0) {
+      if (errno == ENOENT) {
+         return false;
+      }
+      throw PluginError("unable to open flow cache snapshot " + path + ": " + strerror(errno));
+   }
+
+   struct stat st;
+   if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(SnapshotHeader)) {
+      ::close(fd);
+      throw PluginError("flow cache snapshot " + path + " is truncated");
+   }
+   m_size = st.st_size;
+   void *data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+   ::close(fd);
+   if (data == MAP_FAILED) {
+      throw PluginError("unable to map flow cache snapshot " + path + ": " + strerror(errno));
+   }
+   m_data = static_cast<const uint8_t *>(data);
+
+   const SnapshotHeader *hdr = reinterpret_cast<const SnapshotHeader *>(m_data);
+   if (memcmp(hdr->m_magic, SNAPSHOT_MAGIC, sizeof(hdr->m_magic)) != 0 || hdr->m_version != SNAPSHOT_VERSION ||
+      hdr->m_record_size != sizeof(FlowRecord)) {
+      close();
+      throw PluginError("flow cache snapshot " + path + " was created by incompatible version");
+   }
+   if (hdr->m_split_biflow != split_biflow) {
+      close();
+      throw PluginError("flow cache snapshot " + path + " was created with different split option");
+   }
+   m_offset = sizeof(SnapshotHeader) + hdr->m_ext_cnt * sizeof(SnapshotExtName);
+   if (m_offset > m_size) {
+      close();
+      throw PluginError("flow cache snapshot " + path + " is truncated");
+   }
+
+   // Flows are checked before any of them is read, so a truncated snapshot is not restored partially
+   size_t offset = m_offset;
+   for (uint64_t i = 0; i < hdr->m_flow_cnt; i++) {
+      const SnapshotFlow *flow = reinterpret_cast<const SnapshotFlow *>(m_data + offset);
+      if (m_size - offset < sizeof(SnapshotFlow) || m_size - offset - sizeof(SnapshotFlow) < flow->m_ext_size) {
+         close();
+         throw PluginError("flow cache snapshot " + path + " is truncated");
+      }
+      offset += sizeof(SnapshotFlow) + flow->m_ext_size;
+   }
+   m_ext_names = reinterpret_cast<const SnapshotExtName *>(m_data + sizeof(SnapshotHeader));
+   m_flows_left = hdr->m_flow_cnt;
+   return true;
+}
+
+/**
+ * \brief Get next flow, its extensions follow it.
+ * \return Flow or nullptr when there is no more flows.
+ */
+const SnapshotFlow *SnapshotReader::next()
+{
+   if (m_flows_left == 0 || m_size - m_offset < sizeof(SnapshotFlow)) {
+      return nullptr;
+   }
+   const SnapshotFlow *flow = reinterpret_cast<const SnapshotFlow *>(m_data + m_offset);
+   if (m_size - m_offset - sizeof(SnapshotFlow) < flow->m_ext_size) {
+      return nullptr;
+   }
+   m_offset += sizeof(SnapshotFlow) + flow->m_ext_size;
+   m_flows_left--;
+   return flow;
+}
+
+void SnapshotReader::close()
+{
+   if (m_data != nullptr) {
+      munmap(const_cast<uint8_t *>(m_data), m_size);
+      m_data = nullptr;
+   }
+   m_ext_names = nullptr;
+}
+
+}
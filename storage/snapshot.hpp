@@ -0,0 +1,145 @@
+/**
+ * \file snapshot.hpp
+ * \brief Flow cache snapshot file used for warm restart
+ * \date 2026
+ */
+/*
+ * Copyright (C) 2026 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *
+ *
+ */
+#ifndef IPXP_STORAGE_SNAPSHOT_HPP
+#define IPXP_STORAGE_SNAPSHOT_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <ipfixprobe/flowifc.hpp>
+
+#include "cache.hpp"
+
+namespace ipxp {
+
+static const char SNAPSHOT_MAGIC[8] = {'I', 'P', 'X', 'P', 'S', 'N', 'A', 'P'};
+static const uint32_t SNAPSHOT_VERSION = 1; /**< Increased when layout of the file or of FlowRecord changes. */
+static const uint32_t SNAPSHOT_EXT_NAME_SIZE = 32;
+
+/**
+ * \brief Snapshot file header.
+ *
+ * File consists of the header, m_ext_cnt SnapshotExtName entries and m_flow_cnt flows.
+ * Each flow is a SnapshotFlow followed by m_ext_cnt SnapshotExt entries with their data.
+ * Everything is stored in host byte order, so the file is mapped and read in place.
+ */
+struct __attribute__((packed)) SnapshotHeader {
+   char m_magic[8];
+   uint32_t m_version;
+   uint16_t m_record_size; /**< Size of FlowRecord. */
+   uint8_t m_split_biflow; /**< Flow hashes depend on the biflow setting. */
+   uint8_t m_ext_cnt;
+   uint64_t m_flow_cnt;
+};
+
+/**
+ * \brief Name of the process plugin which owns the extension identifier used in the snapshot.
+ *
+ * Extension identifiers are assigned at startup, so they are matched by plugin names on restore.
+ */
+struct __attribute__((packed)) SnapshotExtName {
+   int32_t m_ext_id;
+   char m_name[SNAPSHOT_EXT_NAME_SIZE];
+};
+
+struct __attribute__((packed)) SnapshotFlow {
+   uint8_t m_record[sizeof(FlowRecord)]; /**< Hot record including the flow hash. */
+   struct timeval m_time_first;
+   uint8_t m_src_mac[6];
+   uint8_t m_dst_mac[6];
+   ipaddr_t m_src_ip;
+   ipaddr_t m_dst_ip;
+   uint16_t m_src_port;
+   uint16_t m_dst_port;
+   uint8_t m_ip_version;
+   uint8_t m_ip_proto;
+   uint16_t m_ext_cnt;
+   uint32_t m_ext_size; /**< Size of SnapshotExt entries with their data following the flow. */
+};
+
+struct __attribute__((packed)) SnapshotExt {
+   int32_t m_ext_id;
+   uint32_t m_size; /**< Size of data saved by RecordExt::save() following the entry. */
+};
+
+/**
+ * \brief Writes snapshot into a temporary file, which replaces the snapshot when it is complete.
+ */
+class SnapshotWriter
+{
+public:
+   SnapshotWriter();
+   ~SnapshotWriter();
+
+   void open(const std::string &path, bool split_biflow, const std::vector<SnapshotExtName> &ext_names);
+   void write(const FlowRecord &flow, const Flow &data, const uint8_t *exts, uint16_t ext_cnt, uint32_t ext_size);
+   void close();
+
+private:
+   FILE *m_file;
+   std::string m_path;
+   SnapshotHeader m_header;
+
+   void write_data(const void *data, size_t size);
+};
+
+/**
+ * \brief Maps snapshot file and iterates over its flows.
+ */
+class SnapshotReader
+{
+public:
+   SnapshotReader();
+   ~SnapshotReader();
+
+   bool open(const std::string &path, bool split_biflow);
+   const SnapshotFlow *next();
+   void close();
+
+   const SnapshotExtName *get_ext_names() const
+   {
+      return m_ext_names;
+   }
+
+   uint8_t get_ext_cnt() const
+   {
+      return m_ext_names != nullptr ? reinterpret_cast<const SnapshotHeader *>(m_data)->m_ext_cnt : 0;
+   }
+
+private:
+   const uint8_t *m_data;
+   size_t m_size;
+   size_t m_offset;
+   uint64_t m_flows_left;
+   const SnapshotExtName *m_ext_names;
+   std::string m_path;
+};
+
+}
+#endif /* IPXP_STORAGE_SNAPSHOT_HPP */
@@ -0,0 +1,193 @@
+/**
+ * \file staging.cpp
+ * \brief Staging table of flows waiting for their second packet
+ * \date 2026
+ */
+/*
+ * Copyright (C) 2026 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *
+ *
+ */
+
+#include <cstring>
+#include <netinet/in.h>
+
+#include "staging.hpp"
+
+namespace ipxp {
+
+void StagedFlow::stage(const Packet &pkt, uint64_t hash, bool swapped)
+{
+   m_hash = hash;
+   m_ts = pkt.ts;
+   memcpy(m_src_mac, pkt.src_mac, sizeof(m_src_mac));
+   memcpy(m_dst_mac, pkt.dst_mac, sizeof(m_dst_mac));
+   m_src_ip = pkt.src_ip;
+   m_dst_ip = pkt.dst_ip;
+   m_tcp_options = pkt.tcp_options;
+   m_vlan_id = pkt.vlan_id;
+   m_tcp_mss = pkt.tcp_mss;
+   m_tcp_seq = pkt.tcp_seq;
+   m_tcp_ack = pkt.tcp_ack;
+   m_ethertype = pkt.ethertype;
+   m_ip_len = pkt.ip_len;
+   m_ip_payload_len = pkt.ip_payload_len;
+   m_src_port = pkt.src_port;
+   m_dst_port = pkt.dst_port;
+   m_tcp_window = pkt.tcp_window;
+   m_packet_len_wire = pkt.packet_len_wire;
+   m_ip_version = pkt.ip_version;
+   m_ip_ttl = pkt.ip_ttl;
+   m_ip_proto = pkt.ip_proto;
+   m_ip_tos = pkt.ip_tos;
+   m_ip_flags = pkt.ip_flags;
+   m_tcp_flags = pkt.tcp_flags;
+   m_swapped = swapped;
+}
+
+/**
+ * \brief Rebuild the staged packet, so it can be passed to plugins when the flow is created.
+ */
+void StagedFlow::restore(Packet &pkt) const
+{
+   pkt.ts = m_ts;
+   memcpy(pkt.src_mac, m_src_mac, sizeof(m_src_mac));
+   memcpy(pkt.dst_mac, m_dst_mac, sizeof(m_dst_mac));
+   pkt.src_ip = m_src_ip;
+   pkt.dst_ip = m_dst_ip;
+   pkt.tcp_options = m_tcp_options;
+   pkt.vlan_id = m_vlan_id;
+   pkt.tcp_mss = m_tcp_mss;
+   pkt.tcp_seq = m_tcp_seq;
+   pkt.tcp_ack = m_tcp_ack;
+   pkt.ethertype = m_ethertype;
+   pkt.ip_len = m_ip_len;
+   pkt.ip_payload_len = m_ip_payload_len;
+   pkt.src_port = m_src_port;
+   pkt.dst_port = m_dst_port;
+   pkt.tcp_window = m_tcp_window;
+   pkt.packet_len_wire = m_packet_len_wire;
+   pkt.ip_version = m_ip_version;
+   pkt.ip_ttl = m_ip_ttl;
+   pkt.ip_proto = m_ip_proto;
+   pkt.ip_tos = m_ip_tos;
+   pkt.ip_flags = m_ip_flags;
+   pkt.tcp_flags = m_tcp_flags;
+   pkt.source_pkt = true;
+}
+
+/**
+ * \brief Fill flow data of a flow with the single staged packet.
+ */
+void StagedFlow::fill(Flow &flow) const
+{
+   flow.time_first = m_ts;
+   flow.time_last = m_ts;
+   flow.src_bytes = m_ip_len;
+   flow.dst_bytes = 0;
+   flow.src_packets = 1;
+   flow.dst_packets = 0;
+   flow.src_tcp_flags = m_ip_proto == IPPROTO_TCP ? m_tcp_flags : 0;
+   flow.dst_tcp_flags = 0;
+   flow.ip_version = m_ip_version;
+   flow.ip_proto = m_ip_proto;
+   flow.src_port = m_src_port;
+   flow.dst_port = m_dst_port;
+   flow.src_ip = m_src_ip;
+   flow.dst_ip = m_dst_ip;
+   memcpy(flow.src_mac, m_src_mac, sizeof(m_src_mac));
+   memcpy(flow.dst_mac, m_dst_mac, sizeof(m_dst_mac));
+}
+
+/**
+ * \brief Create table.
+ * \param [in] size Number of staged flows, multiple of STAGING_LINE_SIZE and power of two.
+ * \param [in] qsize Number of records for export, export waits for the output when all of them are exported.
+ */
+StagingTable::StagingTable(uint32_t size, uint32_t qsize) :
+   m_flows(new StagedFlow[size]()), m_size(size), m_line_mask((size - 1) & ~(STAGING_LINE_SIZE - 1)),
+   m_count(0), m_sweep_time(0), m_exports(new Flow[qsize]()), m_returns(qsize)
+{
+   m_spare.reserve(qsize);
+   for (uint32_t i = 0; i < qsize; i++) {
+      m_exports[i].return_queue = &m_returns;
+      m_spare.push_back(&m_exports[i]);
+   }
+}
+
+StagingTable::~StagingTable()
+{
+   delete[] m_flows;
+   delete[] m_exports;
+}
+
+/**
+ * \brief Find staged flow with given hash.
+ * \return Flow or nullptr when it is not staged.
+ */
+StagedFlow *StagingTable::find(uint64_t hash)
+{
+   StagedFlow *line = m_flows + (hash & m_line_mask);
+   for (uint32_t i = 0; i < STAGING_LINE_SIZE; i++) {
+      if (line[i].m_hash == hash) {
+         return &line[i];
+      }
+   }
+   return nullptr;
+}
+
+/**
+ * \brief Get entry for a new flow, the oldest flow of a full line is returned and has to be exported first.
+ */
+StagedFlow *StagingTable::get_slot(uint64_t hash)
+{
+   StagedFlow *line = m_flows + (hash & m_line_mask);
+   StagedFlow *oldest = line;
+   for (uint32_t i = 0; i < STAGING_LINE_SIZE; i++) {
+      if (line[i].m_hash == 0) {
+         return &line[i];
+      }
+      if (timercmp(&line[i].m_ts, &oldest->m_ts, <)) {
+         oldest = &line[i];
+      }
+   }
+   return oldest;
+}
+
+void StagingTable::remove(StagedFlow &flow)
+{
+   flow.m_hash = 0;
+   m_count--;
+}
+
+/**
+ * \brief Get record for an exported flow, records are reused in the same way as spare records of flow tables.
+ */
+Flow &StagingTable::get_export()
+{
+   Flow *flow;
+   while ((flow = m_spare.empty() ? m_returns.wait() : m_returns.pop()) != nullptr) {
+      m_spare.push_back(flow);
+   }
+   flow = m_spare.back();
+   m_spare.pop_back();
+   return *flow;
+}
+
+}
@@ -0,0 +1,148 @@
+/**
+ * \file staging.hpp
+ * \brief Staging table of flows waiting for their second packet
+ * \date 2026
+ */
+/*
+ * Copyright (C) 2026 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *
+ *
+ */
+#ifndef IPXP_STORAGE_STAGING_HPP
+#define IPXP_STORAGE_STAGING_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <sys/time.h>
+
+#include <ipfixprobe/flowifc.hpp>
+#include <ipfixprobe/packet.hpp>
+#include <ipfixprobe/storage.hpp>
+
+namespace ipxp {
+
+static const uint32_t STAGING_LINE_SIZE = 4; /**< Number of staged flows sharing a line, the oldest one is replaced. */
+
+/**
+ * \brief Flow which has seen a single packet without payload, headers of the packet are kept instead of a flow record.
+ */
+struct StagedFlow {
+   uint64_t m_hash; /**< Flow hash, 0 marks an empty entry. */
+   struct timeval m_ts;
+   uint8_t m_src_mac[6];
+   uint8_t m_dst_mac[6];
+   ipaddr_t m_src_ip;
+   ipaddr_t m_dst_ip;
+   uint64_t m_tcp_options;
+   uint32_t m_vlan_id;
+   uint32_t m_tcp_mss;
+   uint32_t m_tcp_seq;
+   uint32_t m_tcp_ack;
+   uint16_t m_ethertype;
+   uint16_t m_ip_len;
+   uint16_t m_ip_payload_len;
+   uint16_t m_src_port;
+   uint16_t m_dst_port;
+   uint16_t m_tcp_window;
+   uint16_t m_packet_len_wire;
+   uint8_t m_ip_version;
+   uint8_t m_ip_ttl;
+   uint8_t m_ip_proto;
+   uint8_t m_ip_tos;
+   uint8_t m_ip_flags;
+   uint8_t m_tcp_flags;
+   bool m_swapped; /**< Key of the packet was swapped to the canonical order. */
+
+   void stage(const Packet &pkt, uint64_t hash, bool swapped);
+   void restore(Packet &pkt) const;
+   void fill(Flow &flow) const;
+};
+
+/**
+ * \brief Small table of flows which did not prove to be real traffic yet.
+ *
+ * Flows enter the table with a payload-less first packet, so scans and SYN floods neither
+ * occupy flow records nor reach process plugins. A flow is moved to the cache by its second
+ * packet, flows which never get one are exported directly from the table without extensions.
+ */
+class StagingTable
+{
+public:
+   StagingTable(uint32_t size, uint32_t qsize);
+   ~StagingTable();
+   StagingTable(const StagingTable &) = delete;
+   StagingTable &operator=(const StagingTable &) = delete;
+
+   StagedFlow *find(uint64_t hash);
+   StagedFlow *get_slot(uint64_t hash);
+   void remove(StagedFlow &flow);
+   Flow &get_export();
+
+   /**
+    * \brief Check whether get_export() returns a record without waiting for the output.
+    */
+   bool has_spare() const
+   {
+      return !m_spare.empty();
+   }
+
+   /**
+    * \brief Check whether the table should be searched for expired flows at given time.
+    */
+   bool need_sweep(time_t now)
+   {
+      if (now == m_sweep_time || m_count == 0) {
+         return false;
+      }
+      m_sweep_time = now;
+      return true;
+   }
+
+   uint32_t get_size() const
+   {
+      return m_size;
+   }
+
+   StagedFlow &get_flow(uint32_t index)
+   {
+      return m_flows[index];
+   }
+
+   /**
+    * \brief Account a flow written into a slot returned by get_slot().
+    */
+   void added()
+   {
+      m_count++;
+   }
+
+private:
+   StagedFlow *m_flows;
+   uint32_t m_size;
+   uint32_t m_line_mask;
+   uint32_t m_count;
+   time_t m_sweep_time; /**< Time of the last search for expired flows. */
+   Flow *m_exports; /**< Records of exported flows, reused after the output returns them. */
+   std::vector<Flow *> m_spare; /**< Records which are not exported. */
+   FlowReturnQueue m_returns;
+};
+
+}
+#endif /* IPXP_STORAGE_STAGING_HPP */
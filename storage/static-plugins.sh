@@ -0,0 +1,37 @@
+#!/bin/sh
+# Generate the static plugin pipeline of the flow cache.
+# Usage: static-plugins.sh SRCDIR PLUGIN...
+# Each plugin is named as its header in SRCDIR/process, the pipeline type is composed of the
+# ProcessPlugin classes declared there, in the order of the arguments.
+
+SRCDIR="$1"
+shift
+
+TYPES=""
+INCLUDES=""
+for PLUGIN in "$@"; do
+   HEADER="$SRCDIR/process/$PLUGIN.hpp"
+   CLASS=$(sed -n 's/^class \([A-Za-z0-9_]*\) *: *public ProcessPlugin.*/\1/p' "$HEADER" | head -n 1)
+   if [ -z "$CLASS" ]; then
+      echo "static-plugins.sh: no process plugin class in $HEADER" >&2
+      exit 1
+   fi
+   INCLUDES="$INCLUDES#include \"process/$PLUGIN.hpp\"
+"
+   TYPES="$TYPES${TYPES:+, }$CLASS"
+done
+
+cat <<END
+/* Generated by static-plugins.sh from --with-static-plugins, do not edit. */
+#ifndef IPXP_STORAGE_STATIC_PLUGINS_HPP
+#define IPXP_STORAGE_STATIC_PLUGINS_HPP
+
+#include "storage/pipeline.hpp"
+$INCLUDES
+namespace ipxp {
+
+typedef StaticPipeline<$TYPES> StaticPlugins;
+
+}
+#endif /* IPXP_STORAGE_STATIC_PLUGINS_HPP */
+END
@@ -0,0 +1,277 @@
+/**
+ * \file timerwheel.hpp
+ * \brief Hierarchical timer wheel used for flow expiration
+ * \date 2026
+ */
+/*
+ * Copyright (C) 2026 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *
+ *
+ */
+#ifndef IPXP_STORAGE_TIMERWHEEL_HPP
+#define IPXP_STORAGE_TIMERWHEEL_HPP
+
+#include <cstdint>
+#include <ctime>
+
+namespace ipxp {
+
+/**
+ * \brief Intrusive timer list node, embedded into objects which are scheduled in TimerWheel.
+ *
+ * Copying a node does not copy its scheduling state.
+ */
+struct TimerNode {
+   TimerNode *m_timer_prev;
+   TimerNode *m_timer_next;
+   time_t m_timer_expire;
+
+   TimerNode() : m_timer_prev(nullptr), m_timer_next(nullptr), m_timer_expire(0)
+   {
+   }
+
+   TimerNode(const TimerNode &) : m_timer_prev(nullptr), m_timer_next(nullptr), m_timer_expire(0)
+   {
+   }
+
+   TimerNode &operator=(const TimerNode &)
+   {
+      return *this;
+   }
+
+   bool is_scheduled() const
+   {
+      return m_timer_next != nullptr;
+   }
+};
+
+/**
+ * \brief Hierarchical timer wheel with 1 second resolution.
+ *
+ * Level 0 holds timers expiring within TIMER_SLOTS seconds, every next level covers
+ * TIMER_SLOTS times longer interval and is cascaded into the lower levels when its slot
+ * is reached. Scheduling and cancelling is O(1), advancing the time costs one slot check
+ * per second plus the number of fired timers. Timers beyond the range of the wheel fire
+ * at its end, users are expected to check the real deadline and schedule them again.
+ */
+class TimerWheel
+{
+public:
+   static const unsigned TIMER_SLOT_BITS = 6;
+   static const unsigned TIMER_SLOTS = 1 << TIMER_SLOT_BITS;
+   static const unsigned TIMER_LEVELS = 4;
+   static const time_t TIMER_RANGE = static_cast<time_t>(1) << (TIMER_SLOT_BITS * TIMER_LEVELS);
+
+   TimerWheel() : m_now(0), m_count(0)
+   {
+      clear();
+   }
+
+   TimerWheel(const TimerWheel &) = delete;
+   TimerWheel &operator=(const TimerWheel &) = delete;
+
+   /**
+    * \brief Forget all scheduled timers.
+    */
+   void clear()
+   {
+      for (unsigned i = 0; i < TIMER_LEVELS * TIMER_SLOTS; i++) {
+         m_slots[i].m_timer_prev = &m_slots[i];
+         m_slots[i].m_timer_next = &m_slots[i];
+      }
+      m_count = 0;
+   }
+
+   /**
+    * \brief Forget all scheduled timers and start at given time.
+    */
+   void clear(time_t now)
+   {
+      clear();
+      m_now = now;
+   }
+
+   /**
+    * \brief Get time up to which all timers already fired.
+    */
+   time_t get_time() const
+   {
+      return m_now;
+   }
+
+   /**
+    * \brief Schedule timer or move already scheduled timer.
+    * \param [in,out] node Timer to schedule.
+    * \param [in] expire Time in seconds, timers in the past fire on the next advance.
+    */
+   void schedule(TimerNode *node, time_t expire)
+   {
+      if (node->is_scheduled()) {
+         unlink(node);
+      } else {
+         m_count++;
+      }
+      node->m_timer_expire = expire > m_now ? expire : m_now + 1;
+      link(node);
+   }
+
+   /**
+    * \brief Remove timer from the wheel, does nothing when the timer is not scheduled.
+    */
+   void cancel(TimerNode *node)
+   {
+      if (node->is_scheduled()) {
+         unlink(node);
+         node->m_timer_prev = nullptr;
+         node->m_timer_next = nullptr;
+         m_count--;
+      }
+   }
+
+   /**
+    * \brief Advance time and fire all timers which expired.
+    *
+    * The callback is called with a timer which is already removed from the wheel,
+    * so it can be freely scheduled again.
+    * \param [in] now Current time in seconds.
+    * \param [in] callback Function called as callback(TimerNode *node).
+    */
+   template<typename Callback>
+   void advance(time_t now, Callback callback)
+   {
+      if (now <= m_now) {
+         return;
+      }
+      if (m_count == 0) {
+         m_now = now;
+         return;
+      }
+      if (now - m_now >= TIMER_RANGE) {
+         // Too long time jump, fire everything and let the callback reschedule the rest
+         TimerNode list;
+         list.m_timer_prev = list.m_timer_next = &list;
+         for (unsigned i = 0; i < TIMER_LEVELS * TIMER_SLOTS; i++) {
+            splice(&m_slots[i], &list);
+         }
+         m_now = now;
+         fire(&list, callback);
+         return;
+      }
+
+      while (m_now < now && m_count) {
+         m_now++;
+         unsigned level = 0;
+         while (level + 1 < TIMER_LEVELS && slot_index(m_now, level) == 0) {
+            level++;
+         }
+         // Cascade from the highest wrapped level down, so lower levels get refilled first
+         for (; level > 0; level--) {
+            TimerNode list;
+            list.m_timer_prev = list.m_timer_next = &list;
+            splice(&m_slots[level * TIMER_SLOTS + slot_index(m_now, level)], &list);
+            while (list.m_timer_next != &list) {
+               TimerNode *node = list.m_timer_next;
+               unlink(node);
+               link(node);
+            }
+         }
+
+         TimerNode list;
+         list.m_timer_prev = list.m_timer_next = &list;
+         splice(&m_slots[slot_index(m_now, 0)], &list);
+         fire(&list, callback);
+      }
+      if (m_now < now) {
+         m_now = now;
+      }
+   }
+
+   /**
+    * \brief Get number of scheduled timers.
+    */
+   uint64_t size() const
+   {
+      return m_count;
+   }
+
+private:
+   time_t m_now; /**< All timers up to this time already fired. */
+   uint64_t m_count;
+   TimerNode m_slots[TIMER_LEVELS * TIMER_SLOTS]; /**< Circular list sentinels. */
+
+   static unsigned slot_index(time_t time, unsigned level)
+   {
+      return (static_cast<uint64_t>(time) >> (TIMER_SLOT_BITS * level)) & (TIMER_SLOTS - 1);
+   }
+
+   void link(TimerNode *node)
+   {
+      time_t delta = node->m_timer_expire - m_now;
+      unsigned level = 0;
+      while (level + 1 < TIMER_LEVELS && delta >= static_cast<time_t>(1) << (TIMER_SLOT_BITS * (level + 1))) {
+         level++;
+      }
+      if (delta >= TIMER_RANGE) {
+         node->m_timer_expire = m_now + TIMER_RANGE - 1;
+      }
+
+      TimerNode *head = &m_slots[level * TIMER_SLOTS + slot_index(node->m_timer_expire, level)];
+      node->m_timer_prev = head->m_timer_prev;
+      node->m_timer_next = head;
+      head->m_timer_prev->m_timer_next = node;
+      head->m_timer_prev = node;
+   }
+
+   static void unlink(TimerNode *node)
+   {
+      node->m_timer_prev->m_timer_next = node->m_timer_next;
+      node->m_timer_next->m_timer_prev = node->m_timer_prev;
+   }
+
+   /**
+    * \brief Move all nodes from one list to the end of another.
+    */
+   static void splice(TimerNode *from, TimerNode *to)
+   {
+      if (from->m_timer_next == from) {
+         return;
+      }
+      from->m_timer_next->m_timer_prev = to->m_timer_prev;
+      from->m_timer_prev->m_timer_next = to;
+      to->m_timer_prev->m_timer_next = from->m_timer_next;
+      to->m_timer_prev = from->m_timer_prev;
+      from->m_timer_prev = from->m_timer_next = from;
+   }
+
+   template<typename Callback>
+   void fire(TimerNode *list, Callback &callback)
+   {
+      while (list->m_timer_next != list) {
+         TimerNode *node = list->m_timer_next;
+         unlink(node);
+         node->m_timer_prev = nullptr;
+         node->m_timer_next = nullptr;
+         m_count--;
+         callback(node);
+      }
+   }
+};
+
+}
+#endif /* IPXP_STORAGE_TIMERWHEEL_HPP */
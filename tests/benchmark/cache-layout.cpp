@@ -0,0 +1,116 @@
+/**
+ * \file cache-layout.cpp
+ * \brief Flow cache record layout benchmark
+ *
+ * Prints memory touched by a packet of an already cached flow and measures
+ * time per packet for lookups of random flows in a table larger than CPU caches.
+ *
+ * Usage: cache_layout [CACHE_SIZE_EXPONENT [FLOWS [PACKETS [CACHE_OPTIONS]]]]
+ */
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <ipfixprobe/packet.hpp>
+#include <ipfixprobe/ring.h>
+
+#include "storage/cache.hpp"
+
+using namespace ipxp;
+
+static const size_t CACHE_LINE = 64;
+
+static size_t lines_spanned(size_t from, size_t to)
+{
+   return (to - 1) / CACHE_LINE - from / CACHE_LINE + 1;
+}
+
+static size_t member_offset(const void *rec, const void *member)
+{
+   return static_cast<const uint8_t *>(member) - static_cast<const uint8_t *>(rec);
+}
+
+static void drain(ipx_ring_t *ring)
+{
+   while (ipx_ring_cnt(ring)) {
+      Flow *flow = static_cast<Flow *>(ipx_ring_pop(ring));
+      if (flow != nullptr) {
+         return_flow(*flow);
+      }
+   }
+}
+
+int main(int argc, char **argv)
+{
+   unsigned exponent = argc > 1 ? atoi(argv[1]) : 20;
+   size_t flows = argc > 2 ? strtoul(argv[2], nullptr, 10) : (static_cast<size_t>(1) << exponent) / 2;
+   size_t packets = argc > 3 ? strtoul(argv[3], nullptr, 10) : 20000000;
+   std::string options = argc > 4 ? std::string(";") + argv[4] : "";
+   const size_t block_size = 64;
+
+   // Records are not standard-layout, so offsets of their members are taken from an instance
+   ColdFlowRecord rec;
+   size_t cold_from = member_offset(&rec, &rec.m_flow.time_last);
+   size_t cold_to = member_offset(&rec, &rec.m_flow.dst_tcp_flags) + sizeof(rec.m_flow.dst_tcp_flags);
+   size_t hot_lines = lines_spanned(0, sizeof(FlowRecord));
+   size_t cold_lines = lines_spanned(cold_from, cold_to);
+
+   printf("hot record:  %zu B\n", sizeof(FlowRecord));
+   printf("cold record: %zu B\n", sizeof(ColdFlowRecord));
+   printf("cache lines touched by a packet of existing flow: %zu without plugins (%zu B), %zu with plugins (%zu B)\n",
+      2 + hot_lines, (2 + hot_lines) * CACHE_LINE,
+      2 + hot_lines + cold_lines, (2 + hot_lines + cold_lines) * CACHE_LINE);
+   printf("hot table: %zu MiB for %u records\n",
+      (static_cast<size_t>(1) << exponent) * (sizeof(FlowRecord) + sizeof(FlowRecord *) + sizeof(uint16_t)) >> 20, 1U << exponent);
+
+   ipx_ring_t *ring = ipx_ring_init(1 << 16, 0);
+   NHTFlowCache cache;
+   cache.set_queue(ring);
+   cache.init(("s=" + std::to_string(exponent) + ";i=100000;a=100000" + options).c_str());
+   static_cast<StoragePlugin &>(cache).thread_init();
+
+   std::mt19937_64 rnd(1);
+   std::vector<uint32_t> addrs(flows);
+   for (auto &addr : addrs) {
+      addr = rnd();
+   }
+
+   PacketBlock block(block_size);
+   for (size_t i = 0; i < block_size; i++) {
+      Packet &pkt = block.pkts[i];
+      pkt.ip_version = IP::v4;
+      pkt.ip_proto = IPPROTO_UDP;
+      pkt.dst_ip.v4 = 0x0a000001;
+      pkt.src_port = 1234;
+      pkt.dst_port = 53;
+      pkt.ip_len = 100;
+      pkt.ts = {1000, 0};
+   }
+
+   // Insert all flows first, then measure lookups of existing flows only
+   for (int pass = 0; pass < 2; pass++) {
+      size_t total = pass ? packets : flows;
+      auto start = std::chrono::steady_clock::now();
+      for (size_t done = 0; done < total; done += block_size) {
+         block.cnt = std::min(block_size, total - done);
+         for (size_t i = 0; i < block.cnt; i++) {
+            block.pkts[i].src_ip.v4 = addrs[pass ? rnd() % flows : done + i];
+         }
+         cache.put_pkts(block);
+         drain(ring);
+      }
+      auto end = std::chrono::steady_clock::now();
+      double ns = std::chrono::duration<double, std::nano>(end - start).count();
+      printf("%s: %zu packets, %.1f ns/packet\n", pass ? "lookup" : "insert", total, ns / total);
+   }
+
+   cache.close();
+   ipx_ring_destroy(ring);
+   return 0;
+}
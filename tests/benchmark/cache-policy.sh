@@ -0,0 +1,61 @@
+#!/bin/bash
+#
+# Compare replacement policies of the flow cache.
+#
+# Prints hit ratio of packets of already cached flows and cache time per packet
+# for each bundled pcap (when ipfixprobe is built with pcap input) and for synthetic
+# traffic with Zipf distributed flow popularity.
+#
+# Usage: cache-policy.sh [CACHE_OPTIONS [PACKETS [FLOWS]]]
+#   e.g. cache-policy.sh 's=16;l=4' 5000000 1000000
+
+export LC_ALL=C
+export LANG=C
+
+test -z "$srcdir" && export srcdir=.
+
+ipfixprobe_bin=${ipfixprobe_bin:-../../ipfixprobe}
+pcap_dir=$srcdir/../../pcaps
+policies="lru clock s3fifo"
+skews="0.8 1.0 1.2"
+
+cache_opts=${1:-s=16}
+packets=${2:-5000000}
+flows=${3:-1000000}
+
+if ! [ -x "$ipfixprobe_bin" ]; then
+   echo "ipfixprobe not compiled"
+   exit 1
+fi
+
+# Usage: run_policy <label> <policy> <input>
+run_policy() {
+   "$ipfixprobe_bin" -i "$3" -s "cache;$cache_opts;policy=$2" -o "text;f=/dev/null" | awk -v label="$1" -v policy="$2" '
+      /^Input stats:/ { table = "input"; next }
+      /^Output stats:/ { table = ""; next }
+      /^Storage stats:/ { table = "storage"; next }
+      table == "input" && $1 ~ /^[0-9]+$/ { packets += $2; qtime += $6 }
+      table == "storage" && $1 ~ /^[0-9]+$/ { hits += $4; created += $5; evicted += $7 }
+      END {
+         printf "%-24s %-8s %10d %10d %8.2f%% %10d %8.1f\n", label, policy, packets, created,
+            packets ? 100.0 * hits / packets : 0, evicted, packets ? qtime / packets : 0
+      }'
+}
+
+printf "%-24s %-8s %10s %10s %9s %10s %8s\n" "input" "policy" "packets" "flows" "hits" "evicted" "ns/pkt"
+
+if "$ipfixprobe_bin" -h input | grep -q '^pcap'; then
+   for pcap in "$pcap_dir"/*.pcap; do
+      for policy in $policies; do
+         run_policy "$(basename "$pcap")" $policy "pcap;file=$pcap"
+      done
+   done
+else
+   echo "compiled without pcap input, pcaps skipped"
+fi
+
+for skew in $skews; do
+   for policy in $policies; do
+      run_policy "zipf skew=$skew" $policy "benchmark;m=zipf;F=$flows;z=$skew;p=$packets;S=policy"
+   done
+done
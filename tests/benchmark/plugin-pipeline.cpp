@@ -0,0 +1,139 @@
+/**
+ * \file plugin-pipeline.cpp
+ * \brief Process plugin dispatch benchmark
+ *
+ * Measures time per packet spent in hooks of the basicplus, pstats, phists and dns plugins
+ * called through the dynamic plugin list of the storage plugin and through the static pipeline.
+ *
+ * Usage: plugin_pipeline [FLOWS [PACKETS_PER_FLOW [DNS_SHARE]]]
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <ipfixprobe/packet.hpp>
+#include <ipfixprobe/storage.hpp>
+
+#include "storage/pipeline.hpp"
+#include "process/basicplus.hpp"
+#include "process/dns.hpp"
+#include "process/phists.hpp"
+#include "process/pstats.hpp"
+
+using namespace ipxp;
+
+typedef StaticPipeline<BASICPLUSPlugin, PSTATSPlugin, PHISTSPlugin, DNSPlugin> BenchPipeline;
+
+/**
+ * \brief Storage plugin exposing its dynamic hook dispatch.
+ */
+class BenchStorage : public StoragePlugin
+{
+public:
+   OptionsParser *get_parser() const { return nullptr; }
+   std::string get_name() const { return "bench"; }
+   int put_pkt(Packet &pkt) { return 0; }
+
+   int pre_create(Packet &pkt) { return plugins_pre_create(pkt); }
+   int post_create(Flow &rec, const Packet &pkt) { return plugins_post_create(rec, pkt); }
+   int pre_update(Flow &rec, Packet &pkt) { return plugins_pre_update(rec, pkt); }
+   int post_update(Flow &rec, const Packet &pkt) { return plugins_post_update(rec, pkt); }
+   void pre_export(Flow &rec) { plugins_pre_export(rec); }
+};
+
+/**
+ * \brief Run hooks of every flow as the flow cache does, packets of a flow go one after another.
+ */
+template<typename Hooks>
+static double run(Hooks &hooks, std::vector<Packet> &pkts, size_t per_flow)
+{
+   Flow flow;
+   auto start = std::chrono::steady_clock::now();
+   for (size_t i = 0; i < pkts.size(); i++) {
+      Packet &pkt = pkts[i];
+      if (i % per_flow == 0) {
+         flow.src_packets = 1;
+         flow.ip_proto = pkt.ip_proto;
+         flow.src_port = pkt.src_port;
+         flow.dst_port = pkt.dst_port;
+         hooks.pre_create(pkt);
+         hooks.post_create(flow, pkt);
+      } else {
+         hooks.pre_update(flow, pkt);
+         flow.src_packets++;
+         hooks.post_update(flow, pkt);
+      }
+      if (i % per_flow == per_flow - 1) {
+         hooks.pre_export(flow);
+         flow.remove_extensions();
+      }
+   }
+   auto end = std::chrono::steady_clock::now();
+   flow.remove_extensions();
+   return std::chrono::duration<double, std::nano>(end - start).count() / pkts.size();
+}
+
+int main(int argc, char **argv)
+{
+   size_t flows = argc > 1 ? strtoul(argv[1], nullptr, 10) : 100000;
+   size_t per_flow = argc > 2 ? strtoul(argv[2], nullptr, 10) : 20;
+   double dns_share = argc > 3 ? atof(argv[3]) : 0.05;
+   if (per_flow == 0) {
+      per_flow = 1;
+   }
+
+   BASICPLUSPlugin basicplus;
+   PSTATSPlugin pstats;
+   PHISTSPlugin phists;
+   DNSPlugin dns;
+   std::vector<ProcessPlugin *> plugins = {&basicplus, &pstats, &phists, &dns};
+   BenchStorage storage;
+   BenchPipeline pipeline;
+   for (auto plugin : plugins) {
+      plugin->init("");
+      storage.add_plugin(plugin);
+   }
+   if (!pipeline.bind(plugins)) {
+      fprintf(stderr, "static pipeline does not match the plugins\n");
+      return 1;
+   }
+
+   std::mt19937_64 rnd(1);
+   std::vector<uint8_t> payload(64, 0);
+   std::vector<Packet> pkts(flows * per_flow);
+   for (size_t f = 0; f < flows; f++) {
+      bool is_dns = rnd() % 1000 < dns_share * 1000;
+      uint16_t src_port = 1024 + rnd() % 60000;
+      uint16_t dst_port = is_dns ? 53 : 1024 + rnd() % 60000;
+      for (size_t i = 0; i < per_flow; i++) {
+         Packet &pkt = pkts[f * per_flow + i];
+         pkt.ip_version = IP::v4;
+         pkt.ip_proto = IPPROTO_UDP;
+         pkt.src_port = src_port;
+         pkt.dst_port = dst_port;
+         pkt.source_pkt = true;
+         pkt.ip_len = 100;
+         pkt.payload = payload.data();
+         pkt.payload_len = i % 4 ? payload.size() : 0;
+         pkt.payload_len_wire = pkt.payload_len;
+         pkt.ts = {static_cast<long>(1000 + i), 0};
+      }
+   }
+
+   printf("%zu flows, %zu packets per flow, %.0f%% DNS flows\n", flows, per_flow, dns_share * 100);
+   // First rounds warm up caches and the extension pool
+   for (int round = 0; round < 3; round++) {
+      double dynamic_ns = run(storage, pkts, per_flow);
+      double static_ns = run(pipeline, pkts, per_flow);
+      printf("round %d: dynamic %.1f ns/packet, static %.1f ns/packet\n", round, dynamic_ns, static_ns);
+   }
+
+   for (auto plugin : plugins) {
+      plugin->close();
+   }
+   return 0;
+}
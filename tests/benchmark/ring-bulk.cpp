@@ -0,0 +1,112 @@
+/**
+ * \file ring-bulk.cpp
+ * \brief Message ring throughput benchmark
+ *
+ * A writer thread pushes messages to a ring read by another thread, once message by message
+ * and then in batches of various sizes by ipx_ring_push_bulk() and ipx_ring_pop_bulk().
+ * Prints millions of messages per second for each batch size.
+ *
+ * Usage: ring_bulk [MESSAGES [RING_SIZE [WRITERS]]]
+ */
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include <ipfixprobe/ring.h>
+
+static const uint32_t BATCHES[] = {1, 4, 16, 64, 256};
+
+/**
+ * \brief Push messages of a writer, batch 0 pushes them one by one by ipx_ring_push().
+ * Messages are values of the writer counter, so the reader can check their order.
+ */
+static void writer(ipx_ring_t *ring, uintptr_t messages, uint32_t batch)
+{
+   std::vector<ipx_msg_t *> msgs(batch ? batch : 1);
+   uintptr_t next = 1;
+   while (next <= messages) {
+      if (batch == 0) {
+         ipx_ring_push(ring, reinterpret_cast<ipx_msg_t *>(next++));
+         continue;
+      }
+      uint32_t cnt = 0;
+      while (cnt < batch && next <= messages) {
+         msgs[cnt++] = reinterpret_cast<ipx_msg_t *>(next++);
+      }
+      ipx_ring_push_bulk(ring, msgs.data(), cnt);
+   }
+   ipx_ring_flush(ring);
+}
+
+/**
+ * \brief Run writers and read all their messages in the calling thread.
+ * \return Millions of messages per second, negative when a message was lost or reordered.
+ */
+static double run(uintptr_t messages, uint32_t ring_size, uint32_t writers, uint32_t batch)
+{
+   ipx_ring_t *ring = ipx_ring_init(ring_size, writers > 1);
+   if (ring == nullptr) {
+      return -1;
+   }
+   std::vector<ipx_msg_t *> msgs(batch ? batch : 1);
+   uintptr_t total = messages * writers;
+   uintptr_t read = 0;
+   uintptr_t sum = 0;
+   uintptr_t last = 0;
+   bool ordered = true;
+
+   auto start = std::chrono::steady_clock::now();
+   std::vector<std::thread> threads;
+   for (uint32_t i = 0; i < writers; i++) {
+      threads.emplace_back(writer, ring, messages, batch);
+   }
+   while (read < total) {
+      uint32_t cnt;
+      if (batch == 0) {
+         msgs[0] = ipx_ring_pop(ring);
+         cnt = msgs[0] != nullptr;
+      } else {
+         cnt = ipx_ring_pop_bulk(ring, msgs.data(), batch);
+      }
+      for (uint32_t i = 0; i < cnt; i++) {
+         uintptr_t value = reinterpret_cast<uintptr_t>(msgs[i]);
+         // Messages of a single writer come in the order they were pushed
+         ordered = ordered && (writers > 1 || value == last + 1);
+         last = value;
+         sum += value;
+      }
+      read += cnt;
+   }
+   auto end = std::chrono::steady_clock::now();
+   for (auto &it : threads) {
+      it.join();
+   }
+   ipx_ring_destroy(ring);
+
+   if (!ordered || sum != writers * (messages * (messages + 1) / 2)) {
+      return -1;
+   }
+   return total / std::chrono::duration<double, std::micro>(end - start).count();
+}
+
+int main(int argc, char **argv)
+{
+   uintptr_t messages = argc > 1 ? strtoul(argv[1], nullptr, 10) : 10000000;
+   uint32_t ring_size = argc > 2 ? strtoul(argv[2], nullptr, 10) : 16536; // Default output queue size
+   uint32_t writers = argc > 3 ? strtoul(argv[3], nullptr, 10) : 1;
+   if (writers == 0) {
+      writers = 1;
+   }
+
+   printf("%lu messages per writer, ring of %u messages, %u writers\n",
+      static_cast<unsigned long>(messages), ring_size, writers);
+   printf("single: %.1f Mmsg/s\n", run(messages, ring_size, writers, 0));
+   for (auto batch : BATCHES) {
+      printf("batch %3u: %.1f Mmsg/s\n", batch, run(messages, ring_size, writers, batch));
+   }
+   return 0;
+}
@@ -0,0 +1,120 @@
+#include "gtest/gtest.h"
+
+#include <vector>
+
+#include <ipfixprobe/ring.h>
+
+#include "../../storage/cache.hpp"
+
+namespace ipxp_test {
+
+using namespace ipxp;
+
+static const uint16_t QUIET_VLAN = 100;
+
+static Packet create_packet(time_t ts, uint16_t vlan, uint16_t src_port)
+{
+   Packet pkt;
+   pkt.ts = {ts, 0};
+   pkt.ip_version = IP::v4;
+   pkt.ip_proto = IPPROTO_UDP;
+   pkt.ip_len = 100;
+   pkt.payload_len = 72;
+   pkt.payload_len_wire = 72;
+   pkt.src_ip.v4 = 0x0100000a;
+   pkt.dst_ip.v4 = 0x0200000a;
+   pkt.src_port = src_port;
+   pkt.dst_port = 53;
+   pkt.vlan_id = vlan;
+   return pkt;
+}
+
+class Cache : public ::testing::Test
+{
+protected:
+   ipx_ring_t *m_queue;
+   StoragePlugin *m_cache;
+
+   void SetUp()
+   {
+      m_queue = ipx_ring_init(1024, false);
+      ASSERT_NE(nullptr, m_queue);
+      m_cache = new NHTFlowCache();
+      m_cache->set_queue(m_queue);
+   }
+
+   void TearDown()
+   {
+      delete m_cache;
+      ipx_ring_destroy(m_queue);
+   }
+
+   /**
+    * \brief Take flows exported so far and give them back to the cache.
+    * \return Source ports and end reasons of the exported flows.
+    */
+   std::vector<std::pair<uint16_t, uint8_t>> exported()
+   {
+      std::vector<std::pair<uint16_t, uint8_t>> flows;
+      ipx_ring_flush(m_queue);
+      ipx_msg_t *msg;
+      while ((msg = ipx_ring_pop(m_queue)) != nullptr) {
+         Flow *flow = reinterpret_cast<Flow *>(msg);
+         flows.push_back(std::make_pair(flow->src_port, flow->end_reason));
+         return_flow(*flow);
+      }
+      return flows;
+   }
+};
+
+TEST_F(Cache, quietPartitionExpires) {
+   m_cache->init(("s=8;l=4;i=5;a=300;V=" + std::to_string(QUIET_VLAN) + ":6").c_str());
+   m_cache->thread_init();
+
+   Packet quiet = create_packet(1000, QUIET_VLAN, 1000);
+   m_cache->put_pkt(quiet);
+
+   // Only the default partition receives packets after the first one
+   for (time_t ts = 1000; ts <= 1010; ts++) {
+      Packet busy = create_packet(ts, 0, 2000);
+      m_cache->put_pkt(busy);
+   }
+
+   auto flows = exported();
+   ASSERT_EQ(1U, flows.size());
+   EXPECT_EQ(1000, flows[0].first);
+   EXPECT_EQ(FLOW_END_INACTIVE, flows[0].second);
+}
+
+TEST_F(Cache, quietShardExpires) {
+   m_cache->init("s=8;l=4;i=5;a=300;c;k=2");
+   m_cache->thread_init();
+
+   // Flows of different ports are spread over the shards, only one of them keeps receiving packets
+   for (uint16_t port = 1; port <= 32; port++) {
+      Packet pkt = create_packet(1000, 0, port);
+      m_cache->put_pkt(pkt);
+   }
+   for (time_t ts = 1001; ts <= 1010; ts++) {
+      Packet busy = create_packet(ts, 0, 1);
+      m_cache->put_pkt(busy);
+   }
+
+   auto flows = exported();
+   EXPECT_EQ(31U, flows.size());
+   for (auto &flow : flows) {
+      EXPECT_NE(1, flow.first);
+      EXPECT_EQ(FLOW_END_INACTIVE, flow.second);
+   }
+   m_cache->finish();
+   exported();
+}
+
+}
+
+int main(int argc, char **argv)
+{
+   // invoking the tests
+   ::testing::InitGoogleTest(&argc, argv);
+   return RUN_ALL_TESTS();
+}
@@ -86,6 +86,45 @@ TEST_F(TestRec, remove)
    EXPECT_EQ(get_extension(1), nullptr);
 }
 
+TEST_F(TestRec, removeDuplicate)
+{
+   EXPECT_TRUE(remove_extension(1));
+   EXPECT_EQ(get_extension(1), m_vec[2]);
+   EXPECT_TRUE(remove_extension(1));
+   EXPECT_EQ(get_extension(1), nullptr);
+   EXPECT_EQ(m_ext_mask, (1U << 2) | (1U << 3));
+}
+
+TEST_F(TestRec, mask)
+{
+   EXPECT_EQ(m_ext_mask, (1U << 1) | (1U << 2) | (1U << 3));
+   add_extension(genext(40));
+   EXPECT_EQ(m_ext_mask, (1ULL << 40) | (1U << 1) | (1U << 2) | (1U << 3));
+}
+
+TEST_F(TestRec, copy)
+{
+   Record copy;
+   copy = *this;
+   EXPECT_EQ(copy.get_extension(2), m_vec[1]);
+   EXPECT_EQ(copy.m_ext_mask, m_ext_mask);
+
+   release_extensions();
+   EXPECT_EQ(get_extension(2), nullptr);
+   EXPECT_EQ(m_ext_mask, 0U);
+   copy.remove_extensions();
+}
+
+TEST(RecordExt, chain)
+{
+   Record rec;
+   RecordExt *head = genext(1);
+   head->add_extension(genext(2));
+   rec.add_extension(head);
+   EXPECT_EQ(rec.get_extension(1), head);
+   EXPECT_EQ(rec.get_extension(2), head->m_next);
+}
+
 TEST(TestExt, registration)
 {
    Record rec;
@@ -105,6 +144,27 @@ TEST(TestExt, registration)
    EXPECT_EQ(rec.get_extension(TestExt::REGISTERED_ID)->m_ext_id, id);
 }
 
+TEST(TestExt, pool)
+{
+   RecordExt *ext = new TestExt();
+   delete ext;
+
+   ExtensionAllocStats before = get_extension_alloc_stats();
+   RecordExt *reused = new TestExt();
+   ExtensionAllocStats after = get_extension_alloc_stats();
+   EXPECT_EQ(reused, ext);
+   EXPECT_EQ(after.allocated, before.allocated);
+   EXPECT_EQ(after.reused, before.reused + 1);
+
+   // Earlier tests may leave more extensions in the pool, so the next one is either reused or allocated
+   RecordExt *other = new TestExt();
+   ExtensionAllocStats last = get_extension_alloc_stats();
+   EXPECT_NE(other, reused);
+   EXPECT_EQ(last.allocated + last.reused, after.allocated + after.reused + 1);
+   delete reused;
+   delete other;
+}
+
 }
 
 int main(int argc, char **argv)
@@ -0,0 +1,58 @@
+#include "gtest/gtest.h"
+
+#include "../../output/ipfix.hpp"
+
+namespace ipxp_test {
+
+using namespace ipxp;
+
+class FillExt : public RecordExt
+{
+public:
+   uint8_t m_value;
+
+   FillExt(int id, uint8_t value) : RecordExt(id), m_value(value) {}
+
+   int fill_ipfix(uint8_t *buffer, int size)
+   {
+      if (size < 1) {
+         return -1;
+      }
+      buffer[0] = m_value;
+      return 1;
+   }
+};
+
+class TestExporter : public IPFIXExporter
+{
+public:
+   using IPFIXExporter::fill_extensions;
+   using IPFIXExporter::get_template_id;
+};
+
+TEST(IPFIXExporter, duplicateExtensionId) {
+   TestExporter exporter;
+   Record rec;
+   rec.add_extension(new FillExt(3, 0x11));
+   rec.add_extension(new FillExt(1, 0x22));
+   rec.add_extension(new FillExt(3, 0x33));
+
+   // One template field set per ID, the record fills the first extension of each ID
+   EXPECT_EQ((1ULL << 1) | (1ULL << 3), exporter.get_template_id(rec));
+   uint8_t buffer[4] = {0};
+   ASSERT_EQ(2, exporter.fill_extensions(rec, buffer, sizeof(buffer)));
+   EXPECT_EQ(0x22, buffer[0]);
+   EXPECT_EQ(0x11, buffer[1]);
+   EXPECT_EQ(-1, exporter.fill_extensions(rec, buffer, 1));
+
+   rec.remove_extensions();
+}
+
+}
+
+int main(int argc, char **argv)
+{
+   // invoking the tests
+   ::testing::InitGoogleTest(&argc, argv);
+   return RUN_ALL_TESTS();
+}
@@ -0,0 +1,343 @@
+#include "gtest/gtest.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "../../storage/snapshot.hpp"
+#include "../../process/basicplus.hpp"
+#include "../../process/icmp.hpp"
+#include "../../process/phists.hpp"
+#include "../../process/pstats.hpp"
+
+namespace ipxp_test {
+
+using namespace ipxp;
+
+static const char *SNAPSHOT_PATH = "snapshot-test.snap";
+
+static SnapshotExtName ext_name(int32_t id, const char *name)
+{
+   SnapshotExtName ext;
+   memset(&ext, 0, sizeof(ext));
+   ext.m_ext_id = id;
+   strncpy(ext.m_name, name, sizeof(ext.m_name) - 1);
+   return ext;
+}
+
+static std::vector<SnapshotExtName> ext_names()
+{
+   std::vector<SnapshotExtName> names;
+   names.push_back(ext_name(RecordExtBASICPLUS::REGISTERED_ID, "basicplus"));
+   names.push_back(ext_name(RecordExtICMP::REGISTERED_ID, "icmp"));
+   names.push_back(ext_name(RecordExtPHISTS::REGISTERED_ID, "phists"));
+   names.push_back(ext_name(RecordExtPSTATS::REGISTERED_ID, "pstats"));
+   return names;
+}
+
+static RecordExt *create_ext(int32_t id)
+{
+   if (id == RecordExtBASICPLUS::REGISTERED_ID) {
+      return new RecordExtBASICPLUS();
+   } else if (id == RecordExtICMP::REGISTERED_ID) {
+      return new RecordExtICMP();
+   } else if (id == RecordExtPHISTS::REGISTERED_ID) {
+      return new RecordExtPHISTS();
+   } else if (id == RecordExtPSTATS::REGISTERED_ID) {
+      return new RecordExtPSTATS();
+   }
+   return nullptr;
+}
+
+/**
+ * \brief Write flow with its extensions the same way the cache does.
+ */
+static void write_flow(SnapshotWriter &writer, const FlowRecord &flow, const Flow &data)
+{
+   std::vector<uint8_t> buffer(4096);
+   uint32_t size = 0;
+   uint16_t cnt = 0;
+
+   for (RecordExt *ext = data.m_exts; ext != nullptr; ext = ext->m_next) {
+      int len = ext->save(buffer.data() + size + sizeof(SnapshotExt), buffer.size() - size - sizeof(SnapshotExt));
+      ASSERT_GE(len, 0);
+      SnapshotExt hdr;
+      hdr.m_ext_id = ext->m_ext_id;
+      hdr.m_size = len;
+      memcpy(buffer.data() + size, &hdr, sizeof(hdr));
+      size += sizeof(SnapshotExt) + len;
+      cnt++;
+   }
+   writer.write(flow, data, buffer.data(), cnt, size);
+}
+
+/**
+ * \brief Load extensions following a saved flow.
+ */
+static void read_exts(const SnapshotFlow &rec, Flow &data)
+{
+   const uint8_t *ext_data = reinterpret_cast<const uint8_t *>(&rec + 1);
+   for (uint16_t i = 0; i < rec.m_ext_cnt; i++) {
+      SnapshotExt hdr;
+      memcpy(&hdr, ext_data, sizeof(hdr));
+      ext_data += sizeof(hdr);
+      RecordExt *ext = create_ext(hdr.m_ext_id);
+      ASSERT_NE(nullptr, ext);
+      ASSERT_TRUE(ext->load(ext_data, hdr.m_size));
+      data.add_extension(ext);
+      ext_data += hdr.m_size;
+   }
+}
+
+static void create_flow(FlowRecord &flow, ColdFlowRecord &data, uint64_t hash)
+{
+   Packet pkt;
+   pkt.ts = {1000, 500};
+   pkt.ip_version = IP::v4;
+   pkt.ip_proto = IPPROTO_TCP;
+   pkt.ip_len = 120;
+   pkt.tcp_flags = 0x02;
+   pkt.src_ip.v4 = 0x0100000a;
+   pkt.dst_ip.v4 = 0x0200000a;
+   pkt.src_port = 1234;
+   pkt.dst_port = 80;
+   pkt.src_mac[5] = 1;
+   pkt.dst_mac[5] = 2;
+
+   flow.erase();
+   flow.create(pkt, hash, false);
+   pkt.ts = {1002, 0};
+   flow.update(pkt, false);
+   data.create(pkt);
+   data.m_flow.time_first = {1000, 500};
+}
+
+class Snapshot : public ::testing::Test
+{
+protected:
+   void TearDown()
+   {
+      unlink(SNAPSHOT_PATH);
+   }
+
+   /**
+    * \brief Write snapshot with a single flow without extensions.
+    */
+   void write_snapshot(bool split_biflow)
+   {
+      FlowRecord flow;
+      ColdFlowRecord data;
+      create_flow(flow, data, 42);
+      SnapshotWriter writer;
+      writer.open(SNAPSHOT_PATH, split_biflow, ext_names());
+      write_flow(writer, flow, data.m_flow);
+      writer.close();
+   }
+
+   std::vector<uint8_t> read_file()
+   {
+      std::vector<uint8_t> content;
+      FILE *file = fopen(SNAPSHOT_PATH, "rb");
+      if (file == nullptr) {
+         return content;
+      }
+      int c;
+      while ((c = fgetc(file)) != EOF) {
+         content.push_back(c);
+      }
+      fclose(file);
+      return content;
+   }
+
+   void write_file(const std::vector<uint8_t> &content)
+   {
+      FILE *file = fopen(SNAPSHOT_PATH, "wb");
+      ASSERT_NE(nullptr, file);
+      ASSERT_EQ(1U, fwrite(content.data(), content.size(), 1, file));
+      fclose(file);
+   }
+};
+
+TEST_F(Snapshot, missing) {
+   SnapshotReader reader;
+   EXPECT_FALSE(reader.open(SNAPSHOT_PATH, false));
+}
+
+TEST_F(Snapshot, roundTrip) {
+   FlowRecord flow;
+   ColdFlowRecord data;
+   create_flow(flow, data, 0x123456789abcULL);
+
+   RecordExtBASICPLUS *basicplus = new RecordExtBASICPLUS();
+   basicplus->ip_ttl[0] = 64;
+   basicplus->ip_ttl[1] = 128;
+   basicplus->tcp_win[1] = 1024;
+   basicplus->tcp_opt[0] = 0x1234567890ULL;
+   basicplus->tcp_mss[0] = 1460;
+   basicplus->tcp_syn_size = 60;
+   basicplus->dst_filled = true;
+   RecordExtICMP *icmp = new RecordExtICMP();
+   icmp->type_code = 0x0803;
+   RecordExtPHISTS *phists = new RecordExtPHISTS();
+   phists->size_hist[0][1] = 5;
+   phists->ipt_hist[1][7] = 9;
+   phists->last_ts[1] = 123456;
+   RecordExtPSTATS *pstats = new RecordExtPSTATS();
+   memset(pstats->pkt_sizes, 0, sizeof(pstats->pkt_sizes));
+   memset(pstats->pkt_tcp_flgs, 0, sizeof(pstats->pkt_tcp_flgs));
+   memset(pstats->pkt_timestamps, 0, sizeof(pstats->pkt_timestamps));
+   memset(pstats->pkt_dirs, 0, sizeof(pstats->pkt_dirs));
+   pstats->pkt_count = 2;
+   pstats->pkt_sizes[0] = 60;
+   pstats->pkt_sizes[1] = 1500;
+   pstats->pkt_timestamps[1] = {1002, 0};
+   pstats->pkt_dirs[1] = -1;
+   pstats->tcp_seq[0] = 1000;
+   data.m_flow.add_extension(basicplus);
+   data.m_flow.add_extension(icmp);
+   data.m_flow.add_extension(phists);
+   data.m_flow.add_extension(pstats);
+
+   FlowRecord plain;
+   ColdFlowRecord plain_data;
+   create_flow(plain, plain_data, 7);
+
+   SnapshotWriter writer;
+   writer.open(SNAPSHOT_PATH, true, ext_names());
+   write_flow(writer, flow, data.m_flow);
+   write_flow(writer, plain, plain_data.m_flow);
+   writer.close();
+
+   SnapshotReader reader;
+   ASSERT_TRUE(reader.open(SNAPSHOT_PATH, true));
+   std::vector<SnapshotExtName> names = ext_names();
+   ASSERT_EQ(names.size(), reader.get_ext_cnt());
+   for (size_t i = 0; i < names.size(); i++) {
+      EXPECT_EQ(names[i].m_ext_id, reader.get_ext_names()[i].m_ext_id);
+      EXPECT_STREQ(names[i].m_name, reader.get_ext_names()[i].m_name);
+   }
+
+   const SnapshotFlow *rec = reader.next();
+   ASSERT_NE(nullptr, rec);
+   FlowRecord restored;
+   memcpy(&restored, rec->m_record, sizeof(restored));
+   EXPECT_EQ(0, memcmp(&flow, &restored, sizeof(flow)));
+   EXPECT_EQ(flow.m_time_last.tv_sec, restored.m_time_last.tv_sec);
+   EXPECT_EQ(flow.m_src_bytes, restored.m_src_bytes);
+   EXPECT_EQ(flow.m_dst_bytes, restored.m_dst_bytes);
+   EXPECT_EQ(1U, restored.m_src_packets);
+   EXPECT_EQ(1U, restored.m_dst_packets);
+   EXPECT_EQ(0x02, restored.m_src_tcp_flags);
+   EXPECT_EQ(1000, rec->m_time_first.tv_sec);
+   EXPECT_EQ(500, rec->m_time_first.tv_usec);
+   EXPECT_EQ(1, rec->m_src_mac[5]);
+   EXPECT_EQ(2, rec->m_dst_mac[5]);
+   ipaddr_t src_ip = rec->m_src_ip;
+   EXPECT_EQ(0x0100000aU, src_ip.v4);
+   EXPECT_EQ(1234, rec->m_src_port);
+   EXPECT_EQ(80, rec->m_dst_port);
+   EXPECT_EQ(IP::v4, rec->m_ip_version);
+   EXPECT_EQ(IPPROTO_TCP, rec->m_ip_proto);
+   ASSERT_EQ(4, rec->m_ext_cnt);
+
+   ColdFlowRecord loaded_data;
+   read_exts(*rec, loaded_data.m_flow);
+   Flow &out = loaded_data.m_flow;
+
+   RecordExtBASICPLUS *basicplus_out = static_cast<RecordExtBASICPLUS *>(out.get_extension(RecordExtBASICPLUS::REGISTERED_ID));
+   ASSERT_NE(nullptr, basicplus_out);
+   EXPECT_EQ(64, basicplus_out->ip_ttl[0]);
+   EXPECT_EQ(128, basicplus_out->ip_ttl[1]);
+   EXPECT_EQ(1024, basicplus_out->tcp_win[1]);
+   EXPECT_EQ(0x1234567890ULL, basicplus_out->tcp_opt[0]);
+   EXPECT_EQ(1460U, basicplus_out->tcp_mss[0]);
+   EXPECT_EQ(60, basicplus_out->tcp_syn_size);
+   EXPECT_TRUE(basicplus_out->dst_filled);
+
+   RecordExtICMP *icmp_out = static_cast<RecordExtICMP *>(out.get_extension(RecordExtICMP::REGISTERED_ID));
+   ASSERT_NE(nullptr, icmp_out);
+   EXPECT_EQ(0x0803, icmp_out->type_code);
+
+   RecordExtPHISTS *phists_out = static_cast<RecordExtPHISTS *>(out.get_extension(RecordExtPHISTS::REGISTERED_ID));
+   ASSERT_NE(nullptr, phists_out);
+   EXPECT_EQ(0, memcmp(phists->size_hist, phists_out->size_hist, sizeof(phists->size_hist)));
+   EXPECT_EQ(0, memcmp(phists->ipt_hist, phists_out->ipt_hist, sizeof(phists->ipt_hist)));
+   EXPECT_EQ(123456U, phists_out->last_ts[1]);
+
+   RecordExtPSTATS *pstats_out = static_cast<RecordExtPSTATS *>(out.get_extension(RecordExtPSTATS::REGISTERED_ID));
+   ASSERT_NE(nullptr, pstats_out);
+   EXPECT_EQ(2, pstats_out->pkt_count);
+   EXPECT_EQ(0, memcmp(pstats->pkt_sizes, pstats_out->pkt_sizes, sizeof(pstats->pkt_sizes)));
+   EXPECT_EQ(1002, pstats_out->pkt_timestamps[1].tv_sec);
+   EXPECT_EQ(-1, pstats_out->pkt_dirs[1]);
+   EXPECT_EQ(1000U, pstats_out->tcp_seq[0]);
+
+   rec = reader.next();
+   ASSERT_NE(nullptr, rec);
+   memcpy(&restored, rec->m_record, sizeof(restored));
+   EXPECT_EQ(0, memcmp(&plain, &restored, sizeof(plain)));
+   EXPECT_EQ(0, rec->m_ext_cnt);
+   EXPECT_EQ(0U, rec->m_ext_size);
+
+   EXPECT_EQ(nullptr, reader.next());
+   reader.close();
+   data.erase();
+   plain_data.erase();
+   loaded_data.erase();
+}
+
+TEST_F(Snapshot, truncated) {
+   write_snapshot(false);
+   std::vector<uint8_t> content = read_file();
+   ASSERT_GT(content.size(), sizeof(SnapshotHeader));
+
+   // Flow is cut off
+   content.resize(content.size() - 1);
+   write_file(content);
+   SnapshotReader reader;
+   EXPECT_THROW(reader.open(SNAPSHOT_PATH, false), PluginError);
+
+   // Extension names are cut off
+   content.resize(sizeof(SnapshotHeader) + 1);
+   write_file(content);
+   EXPECT_THROW(reader.open(SNAPSHOT_PATH, false), PluginError);
+
+   // Header is cut off
+   content.resize(sizeof(SnapshotHeader) - 1);
+   write_file(content);
+   EXPECT_THROW(reader.open(SNAPSHOT_PATH, false), PluginError);
+}
+
+TEST_F(Snapshot, versionMismatch) {
+   write_snapshot(false);
+   std::vector<uint8_t> content = read_file();
+   SnapshotHeader hdr;
+   memcpy(&hdr, content.data(), sizeof(hdr));
+   hdr.m_version = SNAPSHOT_VERSION + 1;
+   memcpy(content.data(), &hdr, sizeof(hdr));
+   write_file(content);
+
+   SnapshotReader reader;
+   EXPECT_THROW(reader.open(SNAPSHOT_PATH, false), PluginError);
+}
+
+TEST_F(Snapshot, splitMismatch) {
+   write_snapshot(false);
+   SnapshotReader reader;
+   EXPECT_THROW(reader.open(SNAPSHOT_PATH, true), PluginError);
+
+   write_snapshot(true);
+   EXPECT_TRUE(reader.open(SNAPSHOT_PATH, true));
+   EXPECT_NE(nullptr, reader.next());
+}
+
+}
+
+int main(int argc, char **argv)
+{
+   // invoking the tests
+   ::testing::InitGoogleTest(&argc, argv);
+   return RUN_ALL_TESTS();
+}
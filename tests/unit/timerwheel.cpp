@@ -0,0 +1,127 @@
+#include "gtest/gtest.h"
+
+#include <vector>
+
+#include "../../storage/timerwheel.hpp"
+
+namespace ipxp_test {
+
+using namespace ipxp;
+
+struct TestTimer : public TimerNode {
+   int m_id;
+   time_t m_fired;
+
+   TestTimer(int id = 0) : m_id(id), m_fired(0) {}
+};
+
+static std::vector<TestTimer *> advance(TimerWheel &wheel, time_t now)
+{
+   std::vector<TestTimer *> fired;
+   wheel.advance(now, [&fired, now](TimerNode *node) {
+      TestTimer *timer = static_cast<TestTimer *>(node);
+      timer->m_fired = now;
+      fired.push_back(timer);
+   });
+   return fired;
+}
+
+TEST(TimerWheel, fireInOrder) {
+   TimerWheel wheel;
+   TestTimer t1(1), t2(2), t3(3);
+   advance(wheel, 1000);
+
+   wheel.schedule(&t2, 1010);
+   wheel.schedule(&t1, 1005);
+   wheel.schedule(&t3, 1010);
+   EXPECT_EQ(3U, wheel.size());
+
+   EXPECT_TRUE(advance(wheel, 1004).empty());
+   auto fired = advance(wheel, 1005);
+   ASSERT_EQ(1U, fired.size());
+   EXPECT_EQ(1, fired[0]->m_id);
+   EXPECT_FALSE(t1.is_scheduled());
+
+   fired = advance(wheel, 1020);
+   ASSERT_EQ(2U, fired.size());
+   EXPECT_EQ(2, fired[0]->m_id);
+   EXPECT_EQ(3, fired[1]->m_id);
+   EXPECT_EQ(0U, wheel.size());
+}
+
+TEST(TimerWheel, cancelAndReschedule) {
+   TimerWheel wheel;
+   TestTimer t1(1), t2(2);
+   advance(wheel, 100);
+
+   wheel.schedule(&t1, 110);
+   wheel.schedule(&t2, 110);
+   wheel.cancel(&t1);
+   wheel.cancel(&t1);
+   EXPECT_EQ(1U, wheel.size());
+
+   wheel.schedule(&t2, 200);
+   EXPECT_EQ(1U, wheel.size());
+   EXPECT_TRUE(advance(wheel, 199).empty());
+   EXPECT_EQ(1U, advance(wheel, 200).size());
+}
+
+TEST(TimerWheel, pastTimerFiresOnNextAdvance) {
+   TimerWheel wheel;
+   TestTimer t1;
+   advance(wheel, 100);
+
+   wheel.schedule(&t1, 50);
+   EXPECT_EQ(1U, advance(wheel, 101).size());
+}
+
+TEST(TimerWheel, cascade) {
+   TimerWheel wheel;
+   std::vector<TestTimer> timers(1000);
+   advance(wheel, 7);
+
+   for (size_t i = 0; i < timers.size(); i++) {
+      wheel.schedule(&timers[i], 8 + i * 37);
+   }
+   for (time_t now = 8; now < static_cast<time_t>(8 + timers.size() * 37); now += 5) {
+      advance(wheel, now);
+   }
+   for (size_t i = 0; i < timers.size(); i++) {
+      time_t expire = 8 + i * 37;
+      EXPECT_GE(timers[i].m_fired, expire);
+      EXPECT_LT(timers[i].m_fired, expire + 5);
+   }
+   EXPECT_EQ(0U, wheel.size());
+}
+
+TEST(TimerWheel, timeJump) {
+   TimerWheel wheel;
+   TestTimer t1, t2;
+   advance(wheel, 10);
+
+   wheel.schedule(&t1, 20);
+   wheel.schedule(&t2, 10 + 2 * TimerWheel::TIMER_RANGE);
+   EXPECT_EQ(2U, advance(wheel, 10 + TimerWheel::TIMER_RANGE).size());
+}
+
+TEST(TimerNode, copyIsNotScheduled) {
+   TimerWheel wheel;
+   TestTimer t1;
+   wheel.schedule(&t1, 10);
+
+   TestTimer t2(t1);
+   TestTimer t3;
+   t3 = t1;
+   EXPECT_TRUE(t1.is_scheduled());
+   EXPECT_FALSE(t2.is_scheduled());
+   EXPECT_FALSE(t3.is_scheduled());
+}
+
+}
+
+int main(int argc, char **argv)
+{
+   // invoking the tests
+   ::testing::InitGoogleTest(&argc, argv);
+   return RUN_ALL_TESTS();
+}
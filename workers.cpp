@@ -26,7 +26,12 @@
  *
  */
 
+#include <cstring>
+#include <thread>
+#include <pthread.h>
+#include <sched.h>
 #include <unistd.h>
+#include <sys/syscall.h>
 #include <sys/time.h>
 
 #include "workers.hpp"
@@ -36,27 +41,641 @@ namespace ipxp {
 
 #define MICRO_SEC 1000000L
 
-void input_storage_worker(InputPlugin *plugin, StoragePlugin *cache, size_t queue_size, uint64_t pkt_limit,
-                  std::promise<WorkerResult> *out, std::atomic<InputStats> *out_stats)
+/** Flows popped from the output queue at once. */
+static const uint32_t OUTPUT_BATCH = 64;
+
+#ifdef __linux__
+static const clockid_t clk_id = CLOCK_MONOTONIC_COARSE;
+#else
+static const clockid_t clk_id = CLOCK_MONOTONIC;
+#endif
+
+/**
+ * \brief Get number of seconds the input is idle, flows are expired by the last packet timestamp advanced by it.
+ * \param [in,out] timeout Input was idle already before.
+ * \param [in,out] begin Time when the input became idle.
+ */
+static time_t idle_seconds(bool &timeout, struct timespec &begin)
+{
+   struct timespec end;
+   clock_gettime(clk_id, &end);
+   if (!timeout) {
+      timeout = true;
+      begin = end;
+   }
+   struct timespec diff = {end.tv_sec - begin.tv_sec, end.tv_nsec - begin.tv_nsec};
+   if (diff.tv_nsec < 0) {
+      diff.tv_nsec += 1000000000;
+      diff.tv_sec--;
+   }
+   return diff.tv_sec;
+}
+
+bool pin_thread(const std::vector<int> &cpus)
+{
+   if (cpus.empty()) {
+      return true;
+   }
+   cpu_set_t set;
+   CPU_ZERO(&set);
+   for (auto cpu : cpus) {
+      CPU_SET(cpu, &set);
+   }
+   return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+std::vector<int> thread_cpus(const std::vector<int> &cpus, size_t idx)
+{
+   if (idx < cpus.size()) {
+      return std::vector<int>(1, cpus[idx]);
+   }
+   return cpus;
+}
+
+/**
+ * \brief CPU, NUMA node and CPU time of the calling thread, reported in stats.
+ * Looked up again once in a while, as the scheduler moves threads which are not pinned to a single CPU.
+ */
+class Placement
+{
+public:
+   Placement() : m_calls(0), m_cpu(-1), m_node(-1), m_cputime(0)
+   {
+   }
+
+   template<typename Stats>
+   void update(Stats &stats)
+   {
+      if ((m_calls++ & 0xff) == 0) {
+         refresh();
+      }
+      stats.cpu = m_cpu;
+      stats.node = m_node;
+      stats.cputime = m_cputime;
+   }
+
+   void refresh()
+   {
+      unsigned cur_cpu;
+      unsigned cur_node;
+      struct timespec cputime;
+      if (syscall(SYS_getcpu, &cur_cpu, &cur_node, nullptr) == 0) {
+         m_cpu = cur_cpu;
+         m_node = cur_node;
+      }
+      if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cputime) == 0) {
+         m_cputime = cputime.tv_sec * 1000000000ULL + cputime.tv_nsec;
+      }
+   }
+
+private:
+   uint32_t m_calls;
+   int64_t m_cpu;
+   int64_t m_node;
+   uint64_t m_cputime;
+};
+
+static void store_storage_stats(StoragePlugin *cache, Placement &placement, SeqlockStats<StorageStats> *out)
+{
+   StorageStats stats = cache->get_stats();
+   placement.update(stats);
+   out->store(stats);
+}
+
+/**
+ * \brief Put block into the cache and measure the time spent in the cache.
+ * \return Nanoseconds spent in the cache.
+ */
+static int64_t put_block(StoragePlugin *cache, PacketBlock &block, struct timeval &ts)
 {
    struct timespec start_cache;
    struct timespec end_cache;
+
+   clock_gettime(clk_id, &start_cache);
+   cache->put_pkts(block);
+   ts = block.pkts[block.cnt - 1].ts;
+   clock_gettime(clk_id, &end_cache);
+
+   int64_t time = end_cache.tv_nsec - start_cache.tv_nsec;
+   if (start_cache.tv_sec != end_cache.tv_sec) {
+      time += 1000000000;
+   }
+   return time;
+}
+
+void ParsedBlock::copy_data()
+{
+   size_t total = 0;
+   for (size_t i = 0; i < block.cnt; i++) {
+      const Packet &pkt = block.pkts[i];
+      total += pkt.packet_len + pkt.payload_len + pkt.custom_len;
+   }
+   if (data.size() < total) {
+      data.resize(total);
+   }
+
+   // Payload and custom data usually point into the packet, these are moved along with it.
+   // Payload of a packet without packet data is left as is.
+   uint8_t *ptr = data.data();
+   for (size_t i = 0; i < block.cnt; i++) {
+      Packet &pkt = block.pkts[i];
+      if (pkt.packet == nullptr) {
+         continue;
+      }
+      const uint8_t *from = pkt.packet;
+      const uint8_t *to = pkt.packet + pkt.packet_len;
+      memcpy(ptr, pkt.packet, pkt.packet_len);
+      pkt.packet = ptr;
+      ptr += pkt.packet_len;
+
+      if (pkt.payload != nullptr) {
+         if (pkt.payload >= from && pkt.payload + pkt.payload_len <= to) {
+            pkt.payload = pkt.packet + (pkt.payload - from);
+         } else {
+            memcpy(ptr, pkt.payload, pkt.payload_len);
+            pkt.payload = ptr;
+            ptr += pkt.payload_len;
+         }
+      }
+      if (pkt.custom != nullptr) {
+         if (pkt.custom >= from && pkt.custom + pkt.custom_len <= to) {
+            pkt.custom = const_cast<uint8_t *>(pkt.packet) + (pkt.custom - from);
+         } else {
+            memcpy(ptr, pkt.custom, pkt.custom_len);
+            pkt.custom = ptr;
+            ptr += pkt.custom_len;
+         }
+      }
+   }
+}
+
+ParsedBlockRing::ParsedBlockRing(size_t blocks, size_t block_size) : m_head(0), m_tail(0)
+{
+   size_t cnt = 1;
+   while (cnt < blocks) {
+      cnt <<= 1;
+   }
+   m_mask = cnt - 1;
+   for (size_t i = 0; i < cnt; i++) {
+      m_blocks.push_back(new ParsedBlock(block_size));
+   }
+}
+
+ParsedBlockRing::~ParsedBlockRing()
+{
+   for (auto block : m_blocks) {
+      delete block;
+   }
+}
+
+ParsedBlock *ParsedBlockRing::begin_write()
+{
+   size_t head = m_head.load(std::memory_order_relaxed);
+   if (head - m_tail.load(std::memory_order_acquire) > m_mask) {
+      return nullptr;
+   }
+   return m_blocks[head & m_mask];
+}
+
+void ParsedBlockRing::end_write()
+{
+   m_head.store(m_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+   m_reader.wake();
+}
+
+ParsedBlock *ParsedBlockRing::begin_read()
+{
+   size_t tail = m_tail.load(std::memory_order_relaxed);
+   if (tail == m_head.load(std::memory_order_acquire)) {
+      return nullptr;
+   }
+   return m_blocks[tail & m_mask];
+}
+
+void ParsedBlockRing::end_read()
+{
+   m_tail.store(m_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+   m_writer.wake();
+}
+
+void ParsedBlockRing::wait_read(const std::atomic<bool> &done, std::chrono::microseconds timeout)
+{
+   m_reader.wait([&]() {
+      return m_tail.load(std::memory_order_relaxed) != m_head.load(std::memory_order_acquire)
+         || done.load(std::memory_order_acquire);
+   }, timeout);
+}
+
+void ParsedBlockRing::wait_write(std::chrono::microseconds timeout)
+{
+   m_writer.wait([&]() {
+      return m_head.load(std::memory_order_relaxed) - m_tail.load(std::memory_order_acquire) <= m_mask;
+   }, timeout);
+}
+
+void ParsedBlockRing::wake_reader()
+{
+   m_reader.wake();
+}
+
+/** Markers pushed to merged export queues after flows of an input block and after the last flow of a storage. */
+static char block_marker;
+static char end_marker;
+
+/** Longest sleep of a worker waiting for its producer, bounds reaction to stop requests and to an idle input. */
+static const std::chrono::microseconds IDLE_WAIT(1000);
+/** Longest sleep after the input plugin timed out, bounds delay of packets arriving meanwhile. */
+static const uint32_t INPUT_SLEEP_US = 100;
+
+/**
+ * \brief Flags shared by the parser and the storage threads of an input.
+ */
+struct PipelineState {
+   const IdleMode mode;
+   std::atomic<bool> stop; /**< A storage thread failed. */
+   std::atomic<bool> idle; /**< Input returns timeouts. */
+   std::atomic<bool> done; /**< Parser does not fill more blocks. */
+
+   PipelineState(IdleMode mode) : mode(mode), stop(false), idle(false), done(false)
+   {
+   }
+};
+
+/**
+ * \brief Storage thread of an input with its ring of parsed blocks.
+ */
+struct StorageWorker {
+   StoragePlugin *cache;
+   ParsedBlockRing ring;
+   ipx_ring_t *merge_queue;
+   SeqlockStats<StorageStats> *out_stats;
+   std::atomic<uint64_t> qtime; /**< Nanoseconds spent in the cache. */
+   std::vector<int> cpus;
+   WorkerResult res;
+
+   StorageWorker(const WorkPipeline::Storage &storage, size_t blocks, size_t block_size, const std::vector<int> &cpus) :
+      cache(storage.plugin), ring(blocks, block_size), merge_queue(storage.queue), out_stats(storage.stats), qtime(0),
+      cpus(cpus), res({false, ""})
+   {
+   }
+};
+
+static inline uint64_t mix64(uint64_t x)
+{
+   x ^= x >> 33;
+   x *= 0xff51afd7ed558ccdULL;
+   x ^= x >> 33;
+   x *= 0xc4ceb9fe1a85ec53ULL;
+   x ^= x >> 33;
+   return x;
+}
+
+static inline uint64_t endpoint_hash(const ipaddr_t &ip, uint16_t port, uint8_t ip_version)
+{
+   if (ip_version == IP::v4) {
+      return mix64(static_cast<uint64_t>(ip.v4) << 16 | port);
+   }
+   uint64_t parts[2];
+   memcpy(parts, ip.v6, sizeof(parts));
+   return mix64(parts[0] ^ mix64(parts[1] ^ port));
+}
+
+/**
+ * \brief Hash of the flow key of the packet, both directions of a flow get the same hash.
+ */
+static inline uint64_t flow_hash(const Packet &pkt)
+{
+   uint64_t endpoints = endpoint_hash(pkt.src_ip, pkt.src_port, pkt.ip_version)
+      + endpoint_hash(pkt.dst_ip, pkt.dst_port, pkt.ip_version);
+   return mix64(endpoints ^ (static_cast<uint64_t>(pkt.vlan_id) << 16 | pkt.ip_proto << 8 | pkt.ip_version));
+}
+
+/**
+ * \brief Get block of the ring to fill, waits while the storage thread processes all blocks.
+ * \return Empty block or nullptr when the input is terminated or a storage thread failed.
+ */
+static ParsedBlock *acquire_block(ParsedBlockRing &ring, const PipelineState &state)
+{
+   ParsedBlock *parsed;
+   Idler idler(state.mode);
+   while ((parsed = ring.begin_write()) == nullptr) {
+      if (terminate_input || state.stop.load(std::memory_order_relaxed)) {
+         return nullptr;
+      }
+      if (idler.round()) {
+         ring.wait_write(IDLE_WAIT);
+      }
+   }
+   parsed->block.cnt = 0;
+   parsed->block.bytes = 0;
+   parsed->mark = false;
+   return parsed;
+}
+
+/**
+ * \brief Copy packet data to the block and hand it over to the storage thread.
+ */
+static void send_block(InputPlugin *plugin, ParsedBlockRing &ring, ParsedBlock *parsed)
+{
+   parsed->copy_data();
+   parsed->seen = plugin->m_seen;
+   parsed->parsed = plugin->m_parsed;
+   parsed->dropped = plugin->m_dropped;
+   ring.end_write();
+}
+
+/**
+ * \brief Distribute packets of the block to the storage threads by flow.
+ * Every storage thread gets a block with the merge mark at the end of the block when flows are merged.
+ * \param [in,out] parts Blocks being filled for each storage thread.
+ * \return False when the input is terminated or a storage thread failed.
+ */
+static bool distribute_block(InputPlugin *plugin, const PacketBlock &block, std::vector<StorageWorker *> &workers,
+   std::vector<ParsedBlock *> &parts, bool merge, const PipelineState &state)
+{
+   for (size_t i = 0; i < block.cnt; i++) {
+      const Packet &pkt = block.pkts[i];
+      size_t idx = flow_hash(pkt) % workers.size();
+      ParsedBlock *&part = parts[idx];
+      if (part == nullptr && (part = acquire_block(workers[idx]->ring, state)) == nullptr) {
+         return false;
+      }
+      PacketBlock &target = part->block;
+      target.pkts[target.cnt++] = pkt;
+      target.bytes += pkt.packet_len_wire;
+      if (target.cnt == target.size) {
+         send_block(plugin, workers[idx]->ring, part);
+         part = nullptr;
+      }
+   }
+
+   for (size_t idx = 0; idx < workers.size(); idx++) {
+      ParsedBlock *&part = parts[idx];
+      if (part == nullptr) {
+         if (!merge) {
+            continue;
+         }
+         if ((part = acquire_block(workers[idx]->ring, state)) == nullptr) {
+            return false;
+         }
+      }
+      part->mark = merge;
+      send_block(plugin, workers[idx]->ring, part);
+      part = nullptr;
+   }
+   return true;
+}
+
+/**
+ * \brief Parse packets of the input into rings of the storage threads until the input ends or a storage thread stops.
+ * A single storage thread gets packets parsed right into its ring, otherwise packets are parsed into a staging
+ * block and distributed from it.
+ */
+static void parser_loop(InputPlugin *plugin, std::vector<StorageWorker *> &workers, bool merge, size_t queue_size,
+   uint64_t pkt_limit, PipelineState &state, Placement &placement, InputStats &stats, WorkerResult &res,
+   SeqlockStats<InputStats> *out_stats)
+{
+   bool distribute = workers.size() > 1 || merge;
+   PacketBlock staging(distribute ? queue_size : 1);
+   std::vector<ParsedBlock *> parts(workers.size(), nullptr);
+   InputPlugin::Result ret;
+   Idler idler(state.mode);
+
+   while (!terminate_input && !state.stop.load(std::memory_order_relaxed)) {
+      ParsedBlock *parsed = nullptr;
+      PacketBlock *block = &staging;
+      if (!distribute) {
+         parsed = acquire_block(workers[0]->ring, state);
+         if (parsed == nullptr) {
+            break;
+         }
+         block = &parsed->block;
+      }
+      block->cnt = 0;
+      block->bytes = 0;
+      block->size = queue_size;
+
+      if (pkt_limit && plugin->m_parsed + block->size >= pkt_limit) {
+         if (plugin->m_parsed >= pkt_limit) {
+            break;
+         }
+         block->size = pkt_limit - plugin->m_parsed;
+      }
+      try {
+         ret = plugin->get(*block);
+      } catch (PluginError &e) {
+         res.error = true;
+         res.msg = e.what();
+         break;
+      }
+      state.idle.store(ret == InputPlugin::Result::TIMEOUT, std::memory_order_relaxed);
+      if (ret == InputPlugin::Result::TIMEOUT) {
+         if (idler.round()) {
+            idler.sleep(INPUT_SLEEP_US);
+         }
+         continue;
+      } else if (ret == InputPlugin::Result::ERROR) {
+         res.error = true;
+         res.msg = "error occured during reading";
+         break;
+      } else if (ret == InputPlugin::Result::END_OF_FILE) {
+         break;
+      }
+
+      idler.reset();
+      stats.packets = plugin->m_seen;
+      stats.parsed = plugin->m_parsed;
+      stats.dropped = plugin->m_dropped;
+      stats.bytes += block->bytes;
+      if (!distribute) {
+         send_block(plugin, workers[0]->ring, parsed);
+      } else if (!distribute_block(plugin, *block, workers, parts, merge, state)) {
+         break;
+      }
+
+      stats.qtime = 0;
+      for (auto worker : workers) {
+         stats.qtime += worker->qtime.load(std::memory_order_relaxed);
+      }
+      placement.update(stats);
+      out_stats->store(stats);
+   }
+   state.done.store(true, std::memory_order_release);
+   for (auto worker : workers) {
+      worker->ring.wake_reader();
+   }
+}
+
+/**
+ * \brief Put parsed blocks from the ring into the cache until the parser is done.
+ */
+static void storage_worker(StorageWorker *worker, PipelineState *state)
+{
+   StoragePlugin *cache = worker->cache;
+   Placement placement;
+   struct timespec begin = {0, 0};
+   struct timeval ts = {0, 0};
+   bool timeout = false;
+   bool ready = true;
+   Idler idler(state->mode);
+
+   // CPUs were checked on start
+   pin_thread(worker->cpus);
+   try {
+      cache->thread_init();
+      store_storage_stats(cache, placement, worker->out_stats);
+   } catch (PluginError &e) {
+      worker->res.error = true;
+      worker->res.msg = e.what();
+      state->stop = true;
+      ready = false;
+   }
+
+   while (ready) {
+      ParsedBlock *parsed = worker->ring.begin_read();
+      if (parsed == nullptr) {
+         // Blocks filled before the parser finished are visible once it is done
+         if (state->done.load(std::memory_order_acquire)) {
+            parsed = worker->ring.begin_read();
+            if (parsed == nullptr) {
+               break;
+            }
+         } else {
+            if (state->idle.load(std::memory_order_relaxed)) {
+               cache->export_expired(ts.tv_sec + idle_seconds(timeout, begin));
+               store_storage_stats(cache, placement, worker->out_stats);
+            }
+            if (idler.round()) {
+               worker->ring.wait_read(state->done, IDLE_WAIT);
+            }
+            continue;
+         }
+      }
+
+      idler.reset();
+      PacketBlock &block = parsed->block;
+      if (block.cnt) {
+         cache->set_input_drops(parsed->dropped);
+         try {
+            worker->qtime.fetch_add(put_block(cache, block, ts), std::memory_order_relaxed);
+         } catch (PluginError &e) {
+            worker->res.error = true;
+            worker->res.msg = e.what();
+            state->stop = true;
+            break;
+         }
+         timeout = false;
+         store_storage_stats(cache, placement, worker->out_stats);
+      }
+      if (parsed->mark) {
+         ipx_ring_push(worker->merge_queue, &block_marker);
+         ipx_ring_flush(worker->merge_queue);
+      }
+      worker->ring.end_read();
+   }
+
+   if (ready) {
+      cache->finish();
+      placement.refresh();
+      store_storage_stats(cache, placement, worker->out_stats);
+   }
+   if (worker->merge_queue != nullptr) {
+      ipx_ring_push(worker->merge_queue, &end_marker);
+      ipx_ring_flush(worker->merge_queue);
+   }
+}
+
+/**
+ * \brief Move flows exported by the storages of an input to the output queue.
+ * Flows exported until the end of an input block are moved storage by storage, so the order does not depend
+ * on timing of the storage threads as long as flows are not expired by an idle input.
+ * The thread runs on any CPU of the pipeline.
+ */
+static void merge_worker(std::vector<ipx_ring_t *> queues, ipx_ring_t *output_queue, std::vector<int> cpus)
+{
+   pin_thread(cpus);
+   std::vector<bool> ended(queues.size(), false);
+   size_t running = queues.size();
+
+   while (running) {
+      for (size_t i = 0; i < queues.size(); i++) {
+         while (!ended[i]) {
+            ipx_msg_t *msg = ipx_ring_pop(queues[i]);
+            if (msg == nullptr) {
+               continue;
+            } else if (msg == &block_marker) {
+               break;
+            } else if (msg == &end_marker) {
+               ended[i] = true;
+               running--;
+               break;
+            }
+            ipx_ring_push(output_queue, msg);
+         }
+      }
+   }
+}
+
+/**
+ * \brief Parse packets in this thread and put them into the caches from storage threads.
+ */
+static void pipelined_loop(InputPlugin *plugin, const std::vector<WorkPipeline::Storage> &storage, ipx_ring_t *output_queue,
+   size_t queue_size, size_t blocks, uint64_t pkt_limit, const std::vector<int> &cpus, IdleMode idle, Placement &placement,
+   InputStats &stats, WorkerResult &res, SeqlockStats<InputStats> *out_stats)
+{
+   PipelineState state(idle);
+   std::vector<StorageWorker *> workers;
+   std::vector<ipx_ring_t *> merge_queues;
+   std::vector<std::thread> threads;
+   std::thread merger;
+
+   for (auto &it : storage) {
+      workers.push_back(new StorageWorker(it, blocks, queue_size, thread_cpus(cpus, workers.size() + 1)));
+      if (it.queue != nullptr) {
+         merge_queues.push_back(it.queue);
+      }
+   }
+   for (auto worker : workers) {
+      threads.push_back(std::thread(storage_worker, worker, &state));
+   }
+   if (!merge_queues.empty()) {
+      merger = std::thread(merge_worker, merge_queues, output_queue, cpus);
+   }
+
+   parser_loop(plugin, workers, !merge_queues.empty(), queue_size, pkt_limit, state, placement, stats, res, out_stats);
+
+   for (auto &it : threads) {
+      it.join();
+   }
+   if (merger.joinable()) {
+      merger.join();
+   }
+
+   stats.qtime = 0;
+   for (auto worker : workers) {
+      stats.qtime += worker->qtime.load(std::memory_order_relaxed);
+      if (!res.error && worker->res.error) {
+         res = worker->res;
+      }
+      delete worker;
+   }
+}
+
+/**
+ * \brief Parse packets and put them into the cache from this thread.
+ */
+static void direct_loop(InputPlugin *plugin, StoragePlugin *cache, size_t queue_size, uint64_t pkt_limit,
+   IdleMode idle, Placement &placement, InputStats &stats, WorkerResult &res, SeqlockStats<InputStats> *out_stats,
+   SeqlockStats<StorageStats> *out_storage_stats)
+{
    struct timespec begin = {0, 0};
-   struct timespec end = {0, 0};
    struct timeval ts = {0, 0};
    bool timeout = false;
    InputPlugin::Result ret;
-   InputStats stats = {0, 0, 0, 0, 0};
-   WorkerResult res = {false, ""};
+   Idler idler(idle);
 
    PacketBlock block(queue_size);
 
-#ifdef __linux__
-   const clockid_t clk_id = CLOCK_MONOTONIC_COARSE;
-#else
-   const clockid_t clk_id = CLOCK_MONOTONIC;
-#endif
-
    while (!terminate_input) {
       block.cnt = 0;
       block.bytes = 0;
@@ -75,45 +694,31 @@ void input_storage_worker(InputPlugin *plugin, StoragePlugin *cache, size_t queu
          break;
       }
       if (ret == InputPlugin::Result::TIMEOUT) {
-         clock_gettime(clk_id, &end);
-         if (!timeout) {
-            timeout = true;
-            begin = end;
-         }
-         struct timespec diff = {end.tv_sec - begin.tv_sec, end.tv_nsec - begin.tv_nsec};
-         if (diff.tv_nsec < 0) {
-            diff.tv_nsec += 1000000000;
-            diff.tv_sec--;
-         }
-         cache->export_expired(ts.tv_sec + diff.tv_sec);
-         usleep(1);
+         cache->export_expired(ts.tv_sec + idle_seconds(timeout, begin));
+         store_storage_stats(cache, placement, out_storage_stats);
+         if (idler.round()) {
+            idler.sleep(INPUT_SLEEP_US);
+         }
          continue;
       } else if (ret == InputPlugin::Result::PARSED) {
+         idler.reset();
          stats.packets = plugin->m_seen;
          stats.parsed = plugin->m_parsed;
          stats.dropped = plugin->m_dropped;
          stats.bytes += block.bytes;
-         clock_gettime(clk_id, &start_cache);
+         cache->set_input_drops(plugin->m_dropped);
          try {
-            for (unsigned i = 0; i < block.cnt; i++) {
-               cache->put_pkt(block.pkts[i]);
-            }
-            ts = block.pkts[block.cnt - 1].ts;
+            stats.qtime += put_block(cache, block, ts);
          } catch (PluginError &e) {
             res.error = true;
             res.msg = e.what();
             break;
          }
          timeout = false;
-         clock_gettime(clk_id, &end_cache);
-
-         int64_t time = end_cache.tv_nsec - start_cache.tv_nsec;
-         if (start_cache.tv_sec != end_cache.tv_sec) {
-            time += 1000000000;
-         }
-         stats.qtime += time;
 
+         placement.update(stats);
          out_stats->store(stats);
+         store_storage_stats(cache, placement, out_storage_stats);
       } else if (ret == InputPlugin::Result::ERROR) {
          res.error = true;
          res.msg = "error occured during reading";
@@ -122,14 +727,47 @@ void input_storage_worker(InputPlugin *plugin, StoragePlugin *cache, size_t queu
          break;
       }
    }
+}
+
+void input_storage_worker(InputPlugin *plugin, std::vector<WorkPipeline::Storage> storage, ipx_ring_t *output_queue,
+   size_t queue_size, size_t blocks, uint64_t pkt_limit, std::vector<int> cpus, IdleMode idle,
+   std::promise<WorkerResult> *out, SeqlockStats<InputStats> *out_stats)
+{
+   InputStats stats = {0, 0, 0, 0, 0, -1, -1, 0};
+   WorkerResult res = {false, ""};
+   Placement placement;
+
+   // CPUs were checked on start
+   pin_thread(thread_cpus(cpus, 0));
+   placement.update(stats);
+   out_stats->store(stats);
+   if (blocks != 0 || storage.size() > 1) {
+      pipelined_loop(plugin, storage, output_queue, queue_size, blocks ? blocks : 1, pkt_limit, cpus, idle, placement, stats,
+         res, out_stats);
+   } else {
+      StoragePlugin *cache = storage[0].plugin;
+      try {
+         cache->thread_init();
+         store_storage_stats(cache, placement, storage[0].stats);
+      } catch (PluginError &e) {
+         res.error = true;
+         res.msg = e.what();
+         out->set_value(res);
+         return;
+      }
+      direct_loop(plugin, cache, queue_size, pkt_limit, idle, placement, stats, res, out_stats, storage[0].stats);
+      cache->finish();
+      placement.refresh();
+      store_storage_stats(cache, placement, storage[0].stats);
+   }
 
    stats.packets = plugin->m_seen;
    stats.parsed = plugin->m_parsed;
    stats.dropped = plugin->m_dropped;
+   placement.refresh();
+   placement.update(stats);
    out_stats->store(stats);
-   cache->finish();
-   auto outq = cache->get_queue();
-   while (ipx_ring_cnt(outq)) {
+   while (ipx_ring_cnt(output_queue)) {
       usleep(1);
    }
    out->set_value(res);
@@ -141,33 +779,43 @@ static long timeval_diff(const struct timeval *start, const struct timeval *end)
           + (end->tv_usec - start->tv_usec);
 }
 
-void output_worker(OutputPlugin *exp, ipx_ring_t *queue, std::promise<WorkerResult> *out, std::atomic<OutputStats> *out_stats,
-   uint32_t fps)
+void output_worker(OutputPlugin *exp, ipx_ring_t *queue, std::promise<WorkerResult> *out, SeqlockStats<OutputStats> *out_stats,
+   uint32_t fps, std::vector<int> cpus)
 {
    WorkerResult res = {false, ""};
-   OutputStats stats = {0, 0, 0, 0};
+   OutputStats stats = {0, 0, 0, 0, -1, -1, 0};
+   Placement placement;
    struct timespec sleep_time = {0};
    struct timeval begin;
    struct timeval end;
    struct timeval last_flush;
    uint32_t pkts_from_begin = 0;
    double time_per_pkt = 0;
+   Flow *flows[OUTPUT_BATCH];
+   uint32_t cnt;
 
    if (fps != 0) {
       time_per_pkt = 1000000.0 / fps; // [micro seconds]
    }
 
    // Rate limiting algorithm from https://github.com/CESNET/ipfixcol2/blob/master/src/tools/ipfixsend/sender.c#L98
+   // CPUs were checked on start
+   pin_thread(cpus);
+   placement.update(stats);
+   out_stats->store(stats);
    gettimeofday(&begin, nullptr);
    last_flush = begin;
-   while (1) {
+   while (!res.error) {
       gettimeofday(&end, nullptr);
 
-      Flow *flow = static_cast<Flow *>(ipx_ring_pop(queue));
-      if (!flow) {
+      // Rate limited flows are popped one by one, so each of them is timed
+      cnt = ipx_ring_pop_bulk(queue, reinterpret_cast<ipx_msg_t **>(flows), fps == 0 ? OUTPUT_BATCH : 1);
+      if (!cnt) {
          if (end.tv_sec - last_flush.tv_sec > 1) {
             last_flush = end;
             exp->flush();
+            placement.update(stats);
+            out_stats->store(stats);
          }
          if (terminate_export && !ipx_ring_cnt(queue)) {
             break;
@@ -175,21 +823,26 @@ void output_worker(OutputPlugin *exp, ipx_ring_t *queue, std::promise<WorkerResu
          continue;
       }
 
-      stats.biflows++;
-      stats.bytes += flow->src_bytes + flow->dst_bytes;
-      stats.packets += flow->src_packets + flow->dst_packets;
+      for (uint32_t i = 0; i < cnt; i++) {
+         Flow *flow = flows[i];
+         stats.biflows++;
+         stats.bytes += flow->src_bytes + flow->dst_bytes;
+         stats.packets += flow->src_packets + flow->dst_packets;
+         try {
+            exp->export_flow(*flow);
+         } catch (PluginError &e) {
+            res.error = true;
+            res.msg = e.what();
+            break;
+         }
+         return_flow(*flow);
+      }
       stats.dropped = exp->m_flows_dropped;
+      placement.update(stats);
       out_stats->store(stats);
-      try {
-         exp->export_flow(*flow);
-      } catch (PluginError &e) {
-         res.error = true;
-         res.msg = e.what();
-         break;
-      }
 
-      pkts_from_begin++;
-      if (fps == 0) {
+      pkts_from_begin += cnt;
+      if (fps == 0 || res.error) {
          // Limit for packets/s is not enabled
          continue;
       }
@@ -223,6 +876,8 @@ void output_worker(OutputPlugin *exp, ipx_ring_t *queue, std::promise<WorkerResu
 
    exp->flush();
    stats.dropped = exp->m_flows_dropped;
+   placement.refresh();
+   placement.update(stats);
    out_stats->store(stats);
    out->set_value(res);
 }
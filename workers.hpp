@@ -29,8 +29,15 @@
 #ifndef IPXP_WORKERS_HPP
 #define IPXP_WORKERS_HPP
 
+#include <algorithm>
 #include <future>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include <ipfixprobe/input.hpp>
 #include <ipfixprobe/storage.hpp>
@@ -55,26 +62,238 @@ struct WorkPipeline {
       InputPlugin *plugin;
       std::thread *thread;
       std::promise<WorkerResult> *promise;
-      std::atomic<InputStats> *stats;
+      SeqlockStats<InputStats> *stats;
    } input;
-   struct {
+   struct Storage {
       StoragePlugin *plugin;
       std::vector<ProcessPlugin *> plugins;
-   } storage;
+      SeqlockStats<StorageStats> *stats;
+      ipx_ring_t *queue; /**< Export queue of the storage merged into the output queue, nullptr when not merged. */
+   };
+   std::vector<Storage> storage; /**< Storages the packets of the input are distributed to by flow. */
 };
 
 struct OutputWorker {
    OutputPlugin *plugin;
    std::thread *thread;
    std::promise<WorkerResult> *promise;
-   std::atomic<OutputStats> *stats;
+   SeqlockStats<OutputStats> *stats;
    ipx_ring_t *queue;
 };
 
-void input_storage_worker(InputPlugin *plugin, StoragePlugin *cache, size_t queue_size, uint64_t pkt_limit, 
-      std::promise<WorkerResult> *out, std::atomic<InputStats> *out_stats);
-void output_worker(OutputPlugin *exp, ipx_ring_t *queue, std::promise<WorkerResult> *out, std::atomic<OutputStats> *out_stats,
-      uint32_t fps);
+/**
+ * \brief What a worker does while it has nothing to process.
+ */
+enum class IdleMode {
+   SPIN, /**< Poll all the time, lowest latency. */
+   YIELD, /**< Poll and yield the CPU to other threads in between. */
+   ADAPTIVE /**< Spin, yield, then sleep until woken up by the producer or a timeout. */
+};
+
+/**
+ * \brief Sleeping consumer woken up by its producer.
+ * The producer pays a fence and a load per wake up unless the consumer sleeps.
+ */
+class Waker
+{
+public:
+   Waker() : m_sleeping(false)
+   {
+   }
+
+   /**
+    * \brief Wake up the consumer, called by the producer after it made work visible.
+    */
+   void wake()
+   {
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (m_sleeping.load(std::memory_order_relaxed)) {
+         std::lock_guard<std::mutex> lock(m_mutex);
+         m_cond.notify_one();
+      }
+   }
+
+   /**
+    * \brief Sleep until woken up or timeout.
+    * \param [in] ready Checked after the consumer announced it sleeps, so a wake up cannot be missed.
+    */
+   template<typename Ready>
+   void wait(Ready ready, std::chrono::microseconds timeout)
+   {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_sleeping.store(true, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (!ready()) {
+         m_cond.wait_for(lock, timeout);
+      }
+      m_sleeping.store(false, std::memory_order_relaxed);
+   }
+
+private:
+   std::atomic<bool> m_sleeping;
+   std::mutex m_mutex;
+   std::condition_variable m_cond;
+};
+
+/**
+ * \brief Idle rounds of a worker, escalating from spinning to yielding to sleeping in the adaptive mode.
+ */
+class Idler
+{
+public:
+   static const uint32_t SPIN_ROUNDS = 64;
+   static const uint32_t YIELD_ROUNDS = 64;
+
+   Idler(IdleMode mode) : m_mode(mode), m_rounds(0), m_sleep_us(1)
+   {
+   }
+
+   /**
+    * \brief Start over after work was found.
+    */
+   void reset()
+   {
+      m_rounds = 0;
+      m_sleep_us = 1;
+   }
+
+   /**
+    * \brief Spin or yield once.
+    * \return True when the worker should sleep instead.
+    */
+   bool round()
+   {
+      if (m_mode == IdleMode::SPIN || (m_mode == IdleMode::ADAPTIVE && m_rounds < SPIN_ROUNDS)) {
+         m_rounds++;
+         cpu_relax();
+         return false;
+      }
+      if (m_mode == IdleMode::YIELD || m_rounds < SPIN_ROUNDS + YIELD_ROUNDS) {
+         m_rounds++;
+         std::this_thread::yield();
+         return false;
+      }
+      return true;
+   }
+
+   /**
+    * \brief Sleep without a producer to wake the worker up, each sleep is twice as long up to the limit.
+    */
+   void sleep(uint32_t max_us)
+   {
+      std::this_thread::sleep_for(std::chrono::microseconds(m_sleep_us));
+      if (m_sleep_us < max_us) {
+         m_sleep_us = std::min(2 * m_sleep_us, max_us);
+      }
+   }
+
+private:
+   IdleMode m_mode;
+   uint32_t m_rounds;
+   uint32_t m_sleep_us;
+
+   static inline void cpu_relax()
+   {
+#if defined(__x86_64__) || defined(__i386__)
+      __builtin_ia32_pause();
+#elif defined(__aarch64__)
+      __asm__ __volatile__("yield");
+#endif
+   }
+};
+
+/**
+ * \brief Packet block parsed by the parser thread of an input.
+ * Packet data are copied to the block, so they stay valid after the input plugin reuses its buffers.
+ */
+struct ParsedBlock {
+   PacketBlock block;
+   std::vector<uint8_t> data; /**< Copy of data of the packets. */
+   uint64_t seen; /**< Counters of the input plugin after the block was parsed. */
+   uint64_t parsed;
+   uint64_t dropped;
+   bool mark; /**< Last part of an input block for the storage, flows exported until now are merged. */
+
+   ParsedBlock(size_t size) :
+      block(size), seen(0), parsed(0), dropped(0), mark(false)
+   {
+   }
+
+   void copy_data();
+};
+
+/**
+ * \brief Lock-free ring of parsed blocks between the parser thread and a storage thread of an input.
+ * Blocks stay in their slots, so a block is refilled once the storage thread processed it.
+ */
+class ParsedBlockRing
+{
+public:
+   ParsedBlockRing(size_t blocks, size_t block_size);
+   ~ParsedBlockRing();
+
+   /**
+    * \brief Get block to fill, called by the parser thread.
+    * \return Block or nullptr when all blocks wait for the storage thread.
+    */
+   ParsedBlock *begin_write();
+   void end_write();
+
+   /**
+    * \brief Get oldest filled block, called by the storage thread.
+    * \return Block or nullptr when no block is filled.
+    */
+   ParsedBlock *begin_read();
+   void end_read();
+
+   /**
+    * \brief Sleep until a block is filled, the parser is done or timeout, called by the storage thread.
+    */
+   void wait_read(const std::atomic<bool> &done, std::chrono::microseconds timeout);
+
+   /**
+    * \brief Sleep until a block is processed or timeout, called by the parser thread.
+    */
+   void wait_write(std::chrono::microseconds timeout);
+
+   /**
+    * \brief Wake up the storage thread, e.g. when the parser is done.
+    */
+   void wake_reader();
+
+private:
+   std::vector<ParsedBlock *> m_blocks;
+   size_t m_mask;
+   /* Padding keeps the indexes on separate cache lines without over-aligning the ring. */
+   char m_pad_head[64];
+   std::atomic<size_t> m_head; /**< Blocks filled by the parser thread. */
+   char m_pad_tail[64];
+   std::atomic<size_t> m_tail; /**< Blocks processed by the storage thread. */
+   char m_pad_end[64];
+   Waker m_reader;
+   Waker m_writer;
+};
+
+/**
+ * \brief Pin the calling thread to the CPUs.
+ * \param [in] cpus CPUs, the thread is left as it is when empty.
+ * \return False when the thread cannot be pinned.
+ */
+bool pin_thread(const std::vector<int> &cpus);
+
+/**
+ * \brief Get CPUs of a thread of a pipeline or an output.
+ * \param [in] cpus CPUs of the pipeline, the input thread is pinned to the first one, storage threads to the following ones.
+ * \param [in] idx Index of the thread.
+ * \return CPU of the thread or all CPUs when the thread has none of its own.
+ */
+std::vector<int> thread_cpus(const std::vector<int> &cpus, size_t idx);
+
+void input_storage_worker(InputPlugin *plugin, std::vector<WorkPipeline::Storage> storage, ipx_ring_t *output_queue,
+      size_t queue_size, size_t blocks, uint64_t pkt_limit, std::vector<int> cpus, IdleMode idle, std::promise<WorkerResult> *out,
+      SeqlockStats<InputStats> *out_stats);
+void output_worker(OutputPlugin *exp, ipx_ring_t *queue, std::promise<WorkerResult> *out, SeqlockStats<OutputStats> *out_stats,
+      uint32_t fps, std::vector<int> cpus);
 
 }
 